@@ -22,12 +22,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <errno.h>
 #include "etools.h"
 #include "hex.h"
-
-#define VERSION "version 0.2 (ALPHA) (C) 1995 Mark J. Blair, distributed under GPLv3"
+#include "tools.h"
 
 void version(int bin2hex)
 {
@@ -47,14 +47,29 @@ void usage(int bin2hex)
     version(bin2hex);
     if (bin2hex) {
 	fprintf(stderr,"\nUsage:  bin2hex [-f{format}] [-b{base}] "\
-		"[-e{entry}] [-] [-q] [{infile} [{outfile}]]\n");
+		"[-e{entry}] [-s[{digests}]] [-w{start}:{end}]\n"\
+		"                [-S{digest}@{addr}[,be]] [-F{fill}] "\
+		"[-z[{method}][:{threads}]]\n"\
+		"                [-k[{mingap}]] [-l{reclen}] "\
+		"[-o{format}[:{reclen}]={file}]...\n"\
+		"                [-B{size}[:{format}]] [-x{transforms}] "\
+		"[-p] [-Z] [-] [-q]\n"\
+		"                [{infile} [{outfile}]]\n");
 	fprintf(stderr,"        bin2hex -help\n");
 	fprintf(stderr,"        bin2hex -?\n");
 	fprintf(stderr,"        bin2hex -version\n");
     }
     else {
 	fprintf(stderr,"\nUsage:  hex2bin [-f{format}] "\
-		"[-i] [-q] [-] [{infile} [{outfile}]]\n");
+		"[-i] [-r{start}:{end} [-I[{index}]]]\n"\
+		"                [-s[{digests}]] [-w{start}:{end}]\n"\
+		"                [-S{digest}@{addr}[,be]] [-F{fill}] "\
+		"[-z[{method}][:{threads}]]\n"\
+		"                [-l{reclen}] [-o{format}[:{reclen}]={file}]...\n"\
+		"                [-B{size}[:{format}]] [-x{transforms}] "\
+		"[-M{size}]\n"\
+		"                [-m[{socket}]] [-t] [-T] [-p] [-V] [-Z] [-q] [-]\n"\
+		"                [{infile} [{outfile}]]\n");
 	fprintf(stderr,"        hex2bin -help\n");
 	fprintf(stderr,"        hex2bin -?\n");
 	fprintf(stderr,"        bin2hex -version\n");
@@ -64,30 +79,250 @@ void usage(int bin2hex)
 	fprintf(stderr,"        %-16s %s\n", converters[i].name,
 		converters[i].desc);
     }
+    fprintf(stderr,"\n    digests supported (-s takes a comma separated list):\n"
+	    "        sum8 sum16 crc32 sha256 (default: sum16,crc32,sha256)\n");
+    fprintf(stderr,"\n    codec kernels in use: %s (the HEXCPU environment "
+	    "variable caps\n    them at scalar, sse4.1, avx2 or avx512)\n",
+	    hex_cpuname());
+    fprintf(stderr,"\n    compressed input is recognised automatically "
+	    "(-Z reads it as it is,\n    for a binary that only starts "
+	    "like a compressed file); output is\n    compressed with -z "
+	    "(gzip, zstd, xz, bzip2) or if {outfile} ends in\n    .gz, "
+	    ".zst, .xz or .bz2\n");
+    fprintf(stderr,"\n    -o writes another output in {format} (or \"binary\") "
+	    "to {file}, from\n    the same pass over the input; each output "
+	    "is written on its own\n    thread. -l and {reclen} set the data "
+	    "bytes per record (default %d)\n", HEXRECLEN);
+    fprintf(stderr,"\n    -B splits the output into banks of {size} bytes "
+	    "(which may end in k\n    or m), each rebased to 0 and padded "
+	    "with the fill value, in\n    {format} (default: %s). Bank {n} "
+	    "goes to {outfile} with \"%%d\"\n    replaced by {n}, or to "
+	    "{outfile}.{n}\n", bin2hex ? "the output format" : "binary");
+    fprintf(stderr,"\n    -x runs the data through a chain of transforms, "
+	    "such as\n    -xreloc=0x8000,crop=0:0xffff,swap16,fill=0xff:\n"
+	    "        reloc={base}     move the data to start at {base}\n"
+	    "        reloc=+{n}       move the data up (or with -, down) "
+	    "by {n}\n"
+	    "        crop={lo}:{hi}   drop data outside the range\n"
+	    "        swap16         swap the bytes of 16-bit words\n"
+	    "        fill={value}   fill holes, or the window of a crop "
+	    "before it\n"
+	    "    digests are taken before the transforms\n");
+    fprintf(stderr,"\n    -p reads and writes on separate threads, "
+	    "overlapping I/O with the\n    conversion\n");
+    if (bin2hex) {
+	fprintf(stderr,"\n    -k leaves out runs of at least {mingap} "
+		"(default %d) bytes of\n    the fill value, but for a byte "
+		"at each end of the data, so that\n    hex2bin gives back the "
+		"same binary\n", SKIPGAP);
+	fprintf(stderr,"\n    ELF files are recognised automatically; their "
+		"loadable segments are\n    written at their physical "
+		"addresses, with the entry address from\n    the file "
+		"unless -e is given\n");
+    }
+    else {
+	fprintf(stderr,"\n    -r writes only the given address range. With -I, "
+		"an index of the\n    input is kept in {index} (default: "
+		"{infile}.hix) so that later\n    extractions only decode the "
+		"records they need\n");
+	fprintf(stderr,"\n    -M{size} (or --max-mem={size}) decodes in at "
+		"most {size} bytes of\n    memory (which may end in k or m), "
+		"spilling sorted runs of records\n    to a temporary file and "
+		"merging them as the output is written\n");
+	fprintf(stderr,"\n    The way the input is decoded is chosen from "
+		"its size, the layout of\n    its first records, the "
+		"number of CPUs and the memory budget (-M,\n    or a "
+		"quarter of memory), as if -M and -p were given to suit; "
+		"-V\n    reports the choice\n");
+	fprintf(stderr,"\n    -m writes the output to sealed shared memory "
+		"(a memfd) instead of a\n    file. With {socket}, the "
+		"descriptor is passed to the process listening\n    on that "
+		"unix socket (@{name} for an abstract one); without, "
+		"its\n    /proc path is printed and held open until stdout "
+		"is closed, so stdout\n    must then be a pipe or socket. "
+		"Either way \"{size} {base} {entry}\"\n    goes with it\n");
+	fprintf(stderr,"\n    -t writes each record as soon as it is decoded, "
+		"filling gaps with\n    the fill value, while the addresses "
+		"ascend. If a record goes back,\n    what has been written is "
+		"read back and sorted with the rest, which\n    needs an "
+		"output file (or -m); -T makes that an error instead\n");
+    }
+}
+
+
+/* TRUE if the program was called by the given name */
+int calledas(char *argv0, char *name)
+{
+    size_t	len = strlen(argv0), nlen = strlen(name);
+
+    return len >= nlen && strcmp(argv0+len-nlen, name) == 0;
+}
+
+
+/* look up a format name in converters[], returns FMT_UNDEF if unknown */
+int getformat(char *name)
+{
+    int		i;
+
+    for(i=0; converters[i].name; i++) {
+	if (strcmp(converters[i].name,name) == 0)
+	    return i;
+    }
+    return FMT_UNDEF;
+}
+
+
+/* parse a size, which may end in k or m for kilobytes or megabytes */
+static int getsize(char *s, ULONG *size)
+{
+    char	*c;
+
+    *size = (ULONG)strtoul(s,&c,0);
+    if (c == s)
+	return FALSE;
+    if (c[0] == 'k' || c[0] == 'K') {
+	*size <<= 10;
+	c++;
+    }
+    else if (c[0] == 'm' || c[0] == 'M') {
+	*size <<= 20;
+	c++;
+    }
+    return c[0] == '\0' && *size != 0;
+}
+
+
+/* parse "{start}:{end}" into an inclusive address range */
+int getrange(char *s, ULONG *lo, ULONG *hi)
+{
+    char	*c;
+
+    *lo = (ULONG)strtoul(s,&c,0);
+    if (c == s || c[0] != ':')
+	return FALSE;
+    s = c+1;
+    *hi = (ULONG)strtoul(s,&c,0);
+    if (c == s || c[0] != '\0' || *hi < *lo)
+	return FALSE;
+    return TRUE;
+}
+
+
+/* parse "{format}[:{reclen}]={file}" for -o */
+static int getout(char *s, int *format, int *reclen, char **name)
+{
+    char	*c, *d;
+
+    if (!(c = strchr(s,'=')) || c[1] == '\0')
+	return FALSE;
+    *c = '\0';
+    *name = c+1;
+    *reclen = 0;
+    if ((c = strchr(s,':'))) {
+	*c++ = '\0';
+	*reclen = (int)strtol(c,&d,0);
+	if (c[0] == '\0' || d[0] != '\0' || *reclen < 1 || *reclen > 255)
+	    return FALSE;
+    }
+    if (strcmp(s,"binary") == 0)
+	*format = FMT_BINARY;
+    else if ((*format = getformat(s)) == FMT_UNDEF ||
+	     !converters[*format].put_hex)
+	return FALSE;
+    return TRUE;
 }
 
 
-/* this is the entry point for both hex2bin and bin2hex */
+/* set up a sink for each -o output, and a fan-out sink that passes
+   everything on to them and to primary. Binary outputs start at lo,
+   and are padded out to hi unless it is (ULONG)-1. */
+static int fanstart(HEXSINK *fan, HEXSINK *primary, HEXSINK *outs,
+		    int *format, int *reclen, FILE **f, int n,
+		    ULONG lo, ULONG hi)
+{
+    HEXSINK	*list[FANMAX+1];
+    int		i;
+
+    list[0] = primary;
+    for(i=0; i<n; i++) {
+	if (format[i] == FMT_BINARY)
+	    hex_binsink(&outs[i], f[i], lo, hi);
+	else {
+	    hex_sinkinit(&outs[i], format[i], f[i]);
+	    outs[i].reclen = reclen[i];
+	}
+	list[i+1] = &outs[i];
+    }
+    return hex_fanout(fan, list, n+1);
+}
+
+
+/* this is the entry point for hex2bin, bin2hex and the other tools */
 int main(int argc, char **argv)
 {
-    int		format = FMT_DEFAULT;
+    int		format = FMT_DEFAULT, autoformat = TRUE;
     int		bin2hex;
     int		i,j;		/* temp vars */
     int		ignoresum = FALSE, argsdone = FALSE, quiet = FALSE;
     ULONG	base = 0, entry = 0;
     FILE	*in = NULL, *out = NULL;
-    char	*c;		/* temp char pointer */
+    char	*inname = NULL, *outname = NULL, *ixname = NULL;
+    int		zmethod = -1, zthreads = 0;
+    UCHAR	magicbuf[SNIFFBUFLEN];
+    int		magiclen = 0;
+    char	*c, *d;		/* temp char pointers */
+    HEXDIGEST	digest;
+    int		dgalgs = 0, dgwindow = FALSE, stamp = 0, stampbe = FALSE;
+    ULONG	dgstart = 0, dgend = 0, stampaddr = 0;
+    int		range = FALSE, useindex = FALSE, pipelined = FALSE;
+    int		skipblank = FALSE;
+    ULONG	mingap = SKIPGAP;
+    HEXSINK	sink, skip, *first;
+    int		elf = FALSE, baseset = FALSE, entryset = FALSE;
+    HEXELF	elfimg;
+    ULONG	rangelo = 0, rangehi = 0;
+    int		reclen = HEXRECLEN, nfan = 0;
+    int		bankfmt = FMT_UNDEF;
+    ULONG	banksize = 0, maxmem = 0;
+    int		shm = FALSE, shmfd = -1;
+    char	*shmsock = NULL, shmmsg[64];
+    ULONG	shmsize;
+    HEXPLAN	plan;
+    int		verbose = FALSE, infd, compressed;
+    int		stream = FALSE, strict = FALSE, nozip = FALSE;
+    HEXSTREAM	st;
+    FILE	*rawin;
+    char	*xspec = NULL;
+    HEXSINK	xform;
+    int		fanfmt[FANMAX], fanlen[FANMAX];
+    char	*fanname[FANMAX];
+    FILE	*fanf[FANMAX];
+    HEXSINK	fan, fanouts[FANMAX];
+    HEXIMAGE	img;
+    HEXINDEX	ix;
+    HEXSPILL	spill;
+
+    /* the other tools have their own argument parsing */
+    if (calledas(argv[0],"hexcmp"))
+	exit(hexcmp_main(argc,argv));
+    if (calledas(argv[0],"hexmerge"))
+	exit(hexmerge_main(argc,argv));
+    if (calledas(argv[0],"scanhex"))
+	exit(scanhex_main(argc,argv));
+    if (calledas(argv[0],"blankcheck"))
+	exit(blankcheck_main(argc,argv));
 
     /* decide whether to convert bin to hex or vice versa */
-    if (strcmp(argv[0]+strlen(argv[0])-7,"bin2hex") == 0)
+    if (calledas(argv[0],"bin2hex"))
 	bin2hex = TRUE;
 
-    else if (strcmp(argv[0]+strlen(argv[0])-7,"hex2bin") == 0)
+    else if (calledas(argv[0],"hex2bin"))
 	bin2hex = FALSE;
 
     else {
-	fprintf(stderr,"I must be called bin2hex or " \
-		"hex2bin so that I know what to do!\n");
+	fprintf(stderr,"I must be called bin2hex, hex2bin, hexcmp, " \
+		"hexmerge, scanhex or blankcheck\nso that I know what "
+		"to do!\n");
 	exit(1);
     }
 
@@ -106,18 +341,8 @@ int main(int argc, char **argv)
 		    break;
 
 		  case 'f':
-		    format = FMT_UNDEF;
-
-		    if (strlen(argv[i]) > 2) {
-
-			for(j=0; converters[j].name ; j++) {
-
-			    if (strcmp(converters[j].name,argv[i]+2)==0) {
-				format=j;
-				break;
-			    }
-			}
-		    }
+		    format = getformat(argv[i]+2);
+		    autoformat = FALSE;
 
 		    if (format == FMT_UNDEF) {
 			fprintf(stderr,
@@ -133,6 +358,7 @@ int main(int argc, char **argv)
 
 		    if (strlen(argv[i]) > 2) {
 			base=(ULONG)strtol(argv[i]+2,&c,0);
+			baseset = TRUE;
 		    }
 
 		    if (c[0] != '\0') {
@@ -149,6 +375,7 @@ int main(int argc, char **argv)
 
 		    if (strlen(argv[i]) > 2) {
 			entry=(ULONG)strtol(argv[i]+2,&c,0);
+			entryset = TRUE;
 		    }
 
 		    if (c[0] != '\0') {
@@ -158,6 +385,111 @@ int main(int argc, char **argv)
 		    }
 		    break;
 
+		  case 's':
+		    dgalgs = DG_ALL;
+
+		    if (strlen(argv[i]) > 2) {
+			dgalgs = 0;
+			for (c=strtok(argv[i]+2,","); c; c=strtok(NULL,",")) {
+			    if (!(j = hex_dgalg(c))) {
+				fprintf(stderr,
+					"Error: unknown digest \"%s\"\n",c);
+				usage(bin2hex);
+				exit(1);
+			    }
+			    dgalgs |= j;
+			}
+		    }
+		    break;
+
+		  case 'w':
+		    if (!getrange(argv[i]+2,&dgstart,&dgend)) {
+			fprintf(stderr,"Error: invalid digest range\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    dgwindow = TRUE;
+		    break;
+
+		  case 'r':
+		    if (bin2hex || !getrange(argv[i]+2,&rangelo,&rangehi)) {
+			fprintf(stderr,"Error: invalid address range\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    range = TRUE;
+		    break;
+
+		  case 'I':
+		    if (bin2hex) {
+			fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    useindex = TRUE;
+		    if (strlen(argv[i]) > 2)
+			ixname = argv[i]+2;
+		    break;
+
+		  case 'S':
+		    /* -S{digest}@{addr}[,be] */
+		    c = argv[i]+2;
+		    d = strchr(c,'@');
+		    if (d) {
+			*d++ = '\0';
+			stamp = hex_dgalg(c);
+			stampaddr = (ULONG)strtoul(d,&c,0);
+			if (strcmp(c,",be") == 0)
+			    stampbe = TRUE;
+			else if (strcmp(c,",le") == 0 || c[0] == '\0')
+			    stampbe = FALSE;
+			else
+			    stamp = 0;
+		    }
+		    if (!d || !stamp) {
+			fprintf(stderr,"Error: invalid checksum stamp\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'F':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			hex_fill=(int)strtol(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0' || hex_fill < 0 || hex_fill > 0xff) {
+			fprintf(stderr,"Error: invalid fill value\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'z':
+		    /* -z[{method}][:{threads}] */
+		    zmethod = 0;	/* gzip */
+		    if ((c = strchr(argv[i]+2,':'))) {
+			*c++ = '\0';
+			zthreads = (int)strtol(c,&d,0);
+			if (*c == '\0' || *d != '\0' || zthreads < 0)
+			    zmethod = -1;
+		    }
+		    if (zmethod == 0 && strlen(argv[i]) > 2)
+			zmethod = hex_zmethod(argv[i]+2,FALSE);
+		    if (zmethod < 0) {
+			fprintf(stderr,
+				"Error: Unknown compression \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'Z':
+		    nozip = TRUE;
+		    break;
+
 		  case 'h':
 		  case '?':
 		    usage(bin2hex);
@@ -173,6 +505,135 @@ int main(int argc, char **argv)
 		    quiet = TRUE;
 		    break;
 
+		  case 'p':
+		    pipelined = TRUE;
+		    break;
+
+		  case 'V':
+		    if (bin2hex) {
+			fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    verbose = TRUE;
+		    break;
+
+		  case 'k':
+		    c="";
+
+		    if (strlen(argv[i]) > 2) {
+			mingap=(ULONG)strtoul(argv[i]+2,&c,0);
+			if (mingap == 0)
+			    c="M";
+		    }
+
+		    if (!bin2hex || c[0] != '\0') {
+			fprintf(stderr,"Error: invalid minimum gap\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    skipblank = TRUE;
+		    break;
+
+		  case 'l':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2)
+			reclen=(int)strtol(argv[i]+2,&c,0);
+
+		    if (c[0] != '\0' || reclen < 1 || reclen > 255) {
+			fprintf(stderr,"Error: invalid record length\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'B':
+		    /* -B{size}[:{format}] */
+		    if ((c = strchr(argv[i]+2,':'))) {
+			*c++ = '\0';
+			if (strcmp(c,"binary") == 0)
+			    bankfmt = FMT_BINARY;
+			else if ((bankfmt = getformat(c)) != FMT_UNDEF &&
+				 !converters[bankfmt].put_hex)
+			    bankfmt = FMT_UNDEF;
+		    }
+		    if (!getsize(argv[i]+2,&banksize) ||
+			(c && bankfmt == FMT_UNDEF)) {
+			fprintf(stderr,"Error: invalid bank split \"%s\"\n",
+				argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'x':
+		    if (strlen(argv[i]) < 3) {
+			fprintf(stderr,"Error: -x needs a transform\n");
+			usage(bin2hex);
+			exit(1);
+		    }
+		    xspec = argv[i]+2;
+		    break;
+
+		  case '-':
+		    /* --max-mem={size} is the same as -M{size} */
+		    if (strncmp(argv[i],"--max-mem=",10) != 0) {
+			fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    argv[i] += 8;
+		    /* fall through */
+
+		  case 'M':
+		    if (bin2hex || !getsize(argv[i]+2,&maxmem) ||
+			maxmem < SPILLMIN) {
+			fprintf(stderr,"Error: invalid memory limit "
+				"(at least %dk)\n", SPILLMIN >> 10);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    break;
+
+		  case 'm':
+		    if (bin2hex) {
+			fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    shm = TRUE;
+		    if (strlen(argv[i]) > 2)
+			shmsock = argv[i]+2;
+		    break;
+
+		  case 't':
+		  case 'T':
+		    if (bin2hex) {
+			fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    stream = TRUE;
+		    strict = argv[i][1] == 'T';
+		    break;
+
+		  case 'o':
+		    if (nfan == FANMAX) {
+			fprintf(stderr,"Error: at most %d -o outputs\n",
+				FANMAX);
+			exit(1);
+		    }
+		    if (!getout(argv[i]+2,&fanfmt[nfan],&fanlen[nfan],
+				&fanname[nfan])) {
+			fprintf(stderr,"Error: invalid output \"%s\"\n",
+				argv[i]);
+			usage(bin2hex);
+			exit(1);
+		    }
+		    nfan++;
+		    break;
+
 		  default:
 		    fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
 		    usage(bin2hex);
@@ -195,7 +656,7 @@ int main(int argc, char **argv)
 	    /* argument is a filename */
 	    if (in) {
 
-		if (out) {
+		if (outname) {
 		    /* if in and out were already specified,
 		       then there should be no more non-flag
 		       arguments */
@@ -204,17 +665,12 @@ int main(int argc, char **argv)
 		    exit(1);
 		}
 
-		else {
-		    out=fopen(argv[i],"w");
-
-		    if (!out) {
-			perror(argv[i]);
-			exit(1);
-		    }
-		}
+		else
+		    outname=argv[i];
 	    }
 	    else {
 		in=fopen(argv[i],"r");
+		inname=argv[i];
 
 		if (!in) {
 		    perror(argv[i]);
@@ -224,9 +680,33 @@ int main(int argc, char **argv)
 	}
     }
 
+    if (useindex && (!range || !inname)) {
+	fprintf(stderr,"Error: -I needs -r and an input file\n");
+	usage(bin2hex);
+	exit(1);
+    }
+
+    if (stream && (range || nfan || banksize || xspec)) {
+	fprintf(stderr,"Error: -t and -T cannot be used with -r, -o, -B "
+		"or -x\n");
+	usage(bin2hex);
+	exit(1);
+    }
+
+    /* with an index only the range is decoded, so -M is not needed */
+    if (useindex)
+	maxmem = 0;
+
     /* if input file not specified, copy stdin to a temp file
-       so that converters can fseek() in it if necessary */
-    if (!in) {
+       so that converters can fseek() in it if necessary. A
+       compressed stdin is spooled compressed. hex2bin reads stdin
+       as it is unless its plan (below) needs to rewind it. */
+    if (!in && !bin2hex && !useindex) {
+	in = stdin;
+	if (!quiet)
+	    fprintf(stderr,"(reading from stdin)\n");
+    }
+    else if (!in) {
 
 	if (!(in=tmpfile())) {
 	    perror("Error opening temporary file");
@@ -244,29 +724,428 @@ int main(int argc, char **argv)
 	rewind(in);
     }
 
-    /* if output file not specified, use stdout */
-    if (!out)
+    /* decompress the input on the fly if it is compressed, unless -Z
+       says it only looks that way */
+    infd = fileno(in);
+    rawin = in;
+    if (!nozip && !(in = hex_zfopen(in))) {
+	hex_perror("Error opening decompressor");
+	exit(1);
+    }
+    compressed = in != rawin;
+
+    /* bin2hex takes ELF files as well as raw binaries */
+    if (bin2hex && !(in = hex_elfpeek(in, &elf))) {
+	hex_perror("Error reading input");
+	if (compressed)
+	    fprintf(stderr,"(the input looked compressed; -Z reads it as "
+		    "it is)\n");
+	exit(1);
+    }
+
+    /* if no format was given for hex input, identify it from the
+       first block of the input, which the plan also looks at. The
+       block is replayed by the stream that hex_fpeek() returns, so
+       nothing is rewound or spooled */
+    if (!bin2hex) {
+	if (!(in = hex_fpeek(in, magicbuf, &magiclen))) {
+	    hex_perror("Error reading input");
+	    exit(1);
+	}
+    }
+    if (!bin2hex && autoformat) {
+	format = hex_detect(magicbuf, magiclen);
+	if (format == FMT_UNDEF) {
+	    format = FMT_DEFAULT;
+	    if (!quiet)
+		fprintf(stderr,"(unknown format, assuming %s)\n",
+			converters[format].name);
+	}
+	else if (!quiet)
+	    fprintf(stderr,"(format: %s)\n", converters[format].name);
+    }
+
+    /* if output file not specified, use stdout. With -B the output
+       file name only names the banks, and nothing goes to out. */
+    if (banksize && !outname) {
+	fprintf(stderr,"Error: -B needs an output file name\n");
+	usage(bin2hex);
+	exit(1);
+    }
+    if (shm && (outname || banksize)) {
+	fprintf(stderr,"Error: -m replaces the output file\n");
+	usage(bin2hex);
+	exit(1);
+    }
+    if (shm && !shmsock && !hex_shmpipe(stdout)) {
+	fprintf(stderr,"Error: -m without {socket} needs stdout to be a "
+		"pipe or socket\n");
+	exit(1);
+    }
+    if (shm) {
+	/* the image goes to shared memory, handed over at the end */
+	if (!(out = hex_shmopen("hex2bin", &shmfd))) {
+	    hex_perror("Error creating shared memory");
+	    exit(1);
+	}
+    }
+    else if (outname && !banksize) {
+	/* a stream may have to read back what it has written */
+	if (!(out=fopen(outname,stream ? "w+" : "w"))) {
+	    perror(outname);
+	    exit(1);
+	}
+    }
+    else
 	out=stdout;
 
+    /* compress the output if asked to, or if the output file name
+       ends in the suffix of a compression method */
+    if (zmethod < 0 && outname)
+	zmethod = hex_zmethod(outname, TRUE);
+    if (zmethod >= 0 && !banksize && !(out = hex_zfwrite(out, zmethod, zthreads))) {
+	hex_perror("Error starting compressor");
+	exit(1);
+    }
+
+    /* the -o outputs, which take the record length from -l unless
+       they give their own */
+    for (i=0; i<nfan; i++) {
+	if (!fanlen[i])
+	    fanlen[i] = reclen;
+	if (!(fanf[i] = fopen(fanname[i],"w"))) {
+	    perror(fanname[i]);
+	    exit(1);
+	}
+	if ((j = hex_zmethod(fanname[i], TRUE)) >= 0 &&
+	    !(fanf[i] = hex_zfwrite(fanf[i], j, zthreads))) {
+	    hex_perror("Error starting compressor");
+	    exit(1);
+	}
+    }
+
+    /* choose how to decode, from the input, the output and the
+       machine, keeping to -M and -p if they were given. With an index
+       only the range is decoded, which needs no planning. */
+    if (!bin2hex && !useindex) {
+	hex_planinit(&plan, infd, compressed, fileno(out));
+	plan.maxmem = maxmem;
+	plan.pipelined = pipelined;
+	plan.stream = stream;
+	hex_plan(&plan, format, magicbuf, magiclen);
+	if (verbose)
+	    hex_planprint(&plan, stderr);
+	stream = plan.how == PLAN_STREAM;
+	maxmem = plan.how == PLAN_SPILL ? plan.maxmem : 0;
+	pipelined = plan.pipelined;
+	if (plan.spool) {
+	    if (!(rawin = tmpfile())) {
+		perror("Error opening temporary file");
+		exit(1);
+	    }
+	    if (fcat(in, rawin)) {
+		perror("Error writing to temporary file");
+		exit(1);
+	    }
+	    fclose(in);
+	    in = rawin;
+	    rewind(in);
+	}
+    }
+
+    /* read and write on their own threads, so that I/O overlaps with
+       the conversion */
+    if (pipelined &&
+	(!(in = hex_pipein(in)) || !(out = hex_pipeout(out)))) {
+	hex_perror("Error starting I/O threads");
+	exit(1);
+    }
+
+    /* set up digests, which the converters update as they go */
+    if (dgalgs || stamp) {
+	hex_dginit(&digest, dgalgs);
+	digest.fill = hex_fill;
+	if (dgwindow) {
+	    digest.window = TRUE;
+	    digest.start = dgstart;
+	    digest.end = dgend;
+	}
+	if (stamp && hex_dgstamp(&digest, stamp, stampaddr, stampbe)) {
+	    hex_perror("Error: checksum stamp must follow the summed range");
+	    exit(1);
+	}
+	hex_digest = &digest;
+    }
+
     if (bin2hex) {
 	/* convert bin to hex */
-	if (converters[format].wr_hex(in,out,base,entry)) {
+	if (elf) {
+	    /* ELF segments go to their physical addresses, in the
+	       narrowest format that reaches them unless -f was given */
+	    if (hex_elfopen(in, &elfimg)) {
+		hex_perror("Error reading ELF file");
+		exit(1);
+	    }
+	    if (!entryset)
+		entry = elfimg.entry;
+	    if (autoformat) {
+		for (j=0; converters[j].name; j++) {
+		    if (converters[j].put_hex &&
+			converters[j].maxaddr >= MAX(elfimg.maxaddr, entry)) {
+			format = j;
+			break;
+		    }
+		}
+	    }
+	    if (!quiet)
+		fprintf(stderr,"(ELF: %d loadable segment%s, format: %s)\n",
+			elfimg.nload, elfimg.nload == 1 ? "" : "s",
+			converters[format].name);
+	    if (baseset && !quiet)
+		fprintf(stderr,"(ELF: -b ignored)\n");
+	}
+
+	if (elf || skipblank || nfan || banksize || xspec ||
+	    reclen != HEXRECLEN) {
+	    /* data goes through the format's sink, behind a fan-out to
+	       the -o outputs if there are any, a filter that leaves out
+	       runs of the fill value if -k was given, and the -x
+	       transforms. With -x, binary outputs start at the first
+	       address that comes out of the transforms. */
+	    if (!converters[format].put_hex) {
+		fprintf(stderr,"Error: %s is not supported for %s\n",
+			elf ? "ELF input" : "-k, -l, -o, -B or -x",
+			converters[format].name);
+		exit(1);
+	    }
+	    if (banksize) {
+		/* the banks replace the main output */
+		if (hex_banksink(&sink, bankfmt == FMT_UNDEF ? format :
+				 bankfmt, outname, xspec ? (ULONG)-1 :
+				 elf ? elfimg.minaddr : base, banksize)) {
+		    hex_perror("Error");
+		    exit(1);
+		}
+	    }
+	    else
+		hex_sinkinit(&sink, format, out);
+	    sink.reclen = reclen;
+	    first = &sink;
+	    if (nfan) {
+		if (fanstart(&fan, &sink, fanouts, fanfmt, fanlen, fanf,
+			     nfan, xspec ? (ULONG)-1 :
+			     elf ? elfimg.minaddr : base, (ULONG)-1)) {
+		    hex_perror("Error starting output threads");
+		    exit(1);
+		}
+		first = &fan;
+	    }
+	    if (skipblank) {
+		if (hex_skipsink(&skip, first, hex_fill, mingap)) {
+		    hex_perror("Error");
+		    exit(1);
+		}
+		first = &skip;
+	    }
+	    if (xspec) {
+		if (hex_xformsink(&xform, xspec, first)) {
+		    hex_perror(xspec);
+		    exit(1);
+		}
+		first = &xform;
+	    }
+	    if (elf)
+		j = hex_elfwrite(&elfimg, first) || first->end(first, entry);
+	    else
+		j = hex_wrsink(in, first, base, entry);
+	    if (j) {
+		hex_perror("Error converting binary to hex");
+		exit(1);
+	    }
+	    if (elf)
+		hex_elfclose(&elfimg);
+	}
+	else if (converters[format].wr_hex(in,out,base,entry)) {
 	    hex_perror("Error converting binary to hex");
 	    exit(1);
 	}
+	fflush(out);
+
+	if (hex_digest) {
+	    hex_dgfinal(hex_digest);
+	    if (dgalgs) {
+		hex_dgprint(hex_digest, stderr);
+		fprintf(stderr,"\n");
+	    }
+	}
     }
 
     else {
 	/* convert hex to bin */
-	/*** do magic here ***/
-	if (converters[format].rd_hex(in,out,ignoresum,&base,&entry)) {
+	if (stream) {
+	    /* binary goes out as the records are decoded */
+	    hex_streaminit(&st, out, strict, plan.maxmem);
+	    if ((j = hex_streamload(in,format,ignoresum,&st))) {
+		if (j == H_ERR_ORDER)
+		    fprintf(stderr,"Error: data at 0x%08lX goes back below "
+			    "0x%08lX, %s\n", st.backaddr, st.next, strict ?
+			    "which -T does not allow" : "and the output "
+			    "cannot be read back\n       to sort it (write "
+			    "to a file, or leave out -t)");
+		else
+		    hex_perror("Error converting hex to binary");
+		exit(1);
+	    }
+	    if (st.spilled && !quiet)
+		fprintf(stderr,"(data at 0x%08lX went back below 0x%08lX; "
+			"output sorted and rewritten)\n", st.backaddr,
+			st.next);
+	    base = st.base;
+	    entry = st.entry;
+	    hex_streamfree(&st);
+	}
+	else if (range || nfan || banksize || xspec || maxmem) {
+	    /* with an index, only the records that cover the range are
+	       decoded; without one, the whole file is decoded into a
+	       sparse image and cropped, or with -M into a spill that
+	       holds no more than maxmem bytes at a time. With -o the
+	       image is written through a fan-out to all the outputs. */
+	    hex_imginit(&img);
+	    if (useindex) {
+		if (!ixname) {
+		    if (!(ixname = malloc(strlen(inname) + 5))) {
+			perror("Error");
+			exit(1);
+		    }
+		    sprintf(ixname, "%s.hix", inname);
+		}
+		hex_ixinit(&ix);
+		if (hex_ixget(in,inname,ixname,format,ignoresum,&ix)) {
+		    hex_perror(ixname);
+		    exit(1);
+		}
+		if (ix.unsaved && !quiet) {
+		    /* it is only needed again next time */
+		    fprintf(stderr,"Warning: index not saved, ");
+		    hex_perror(ixname);
+		}
+		j = hex_ixrange(in,&ix,ignoresum,rangelo,rangehi,&img);
+		hex_ixfree(&ix);
+	    }
+	    else if (maxmem) {
+		if (!(j = hex_spillinit(&spill, maxmem))) {
+		    if (range) {
+			spill.lo = rangelo;
+			spill.hi = rangehi;
+		    }
+		    j = hex_spillload(in,format,ignoresum,&spill);
+		}
+	    }
+	    else {
+		if (!(j = converters[format].ld_hex(in,ignoresum,&img)) &&
+		    range)
+		    hex_imgcrop(&img, rangelo, rangehi);
+	    }
+	    if (!j && !range) {
+		/* the binary starts at the lowest address */
+		if (maxmem)
+		    rangelo = (ULONG)-1;
+		else if (!(j = hex_imgsort(&img)) && img.nseg)
+		    rangelo = img.seg[0].addr;
+		rangehi = (ULONG)-1;
+	    }
+	    if (xspec) {
+		/* the output starts where the transforms put the data */
+		rangelo = rangehi = (ULONG)-1;
+	    }
+	    if (!j && (nfan || banksize || xspec || maxmem)) {
+		/* the banks, if any, replace the main output */
+		if (banksize)
+		    j = hex_banksink(&sink, bankfmt == FMT_UNDEF ? FMT_BINARY :
+				     bankfmt, outname, rangelo, banksize);
+		else
+		    hex_binsink(&sink, out, rangelo, rangehi);
+		sink.reclen = reclen;
+		first = &sink;
+		if (!j && nfan &&
+		    !(j = fanstart(&fan, &sink, fanouts, fanfmt, fanlen, fanf,
+				   nfan, rangelo, rangehi)))
+		    first = &fan;
+		if (!j && xspec && !(j = hex_xformsink(&xform, xspec, first)))
+		    first = &xform;
+		if (!j)
+		    j = maxmem ? hex_spillwrite(&spill, first) :
+			hex_imgwrite(&img, first);
+		rangelo = sink.base == (ULONG)-1 ? 0 : sink.base;
+	    }
+	    else if (!j)
+		j = hex_imgwrbin(&img,out,rangelo,rangehi);
+	    if (j) {
+		hex_perror("Error converting hex to binary");
+		exit(1);
+	    }
+	    base = rangelo;
+	    entry = maxmem ? spill.entry : img.entry;
+	    hex_imgfree(&img);
+	    if (maxmem)
+		hex_spillfree(&spill);
+	}
+	else if (converters[format].rd_hex(in,out,ignoresum,&base,&entry)) {
 	    hex_perror("Error converting hex to binary");
 	    exit(1);
 	}
 	fflush(out);
 
+	if (hex_digest)
+	    hex_dgfinal(hex_digest);
+
 	if (!quiet) {
-	    fprintf(stderr,"base: 0x%08lX entry: 0x%08lX\n", base, entry);
+	    fprintf(stderr,"base: 0x%08lX entry: 0x%08lX", base, entry);
+	    if (dgalgs) {
+		fprintf(stderr," ");
+		hex_dgprint(hex_digest, stderr);
+	    }
+	    fprintf(stderr,"\n");
+	}
+	else if (dgalgs) {
+	    hex_dgprint(hex_digest, stderr);
+	    fprintf(stderr,"\n");
+	}
+    }
+
+    if (stamp && digest.stampbad) {
+	fprintf(stderr,"Error: checksum stamp must follow the summed range "
+		"(the data starts at or\n       above 0x%08lX)\n", stampaddr);
+	exit(1);
+    }
+    if (stamp && digest.stamped < digest.stamplen) {
+	fprintf(stderr,"Warning: checksum stamp address 0x%08lX is "
+		"outside the image\n", stampaddr);
+    }
+
+    /* closing the output waits for the compressor, if any */
+    if (fclose(out)) {
+	perror("Error writing output");
+	exit(1);
+    }
+    for (i=0; i<nfan; i++) {
+	if (fclose(fanf[i])) {
+	    perror(fanname[i]);
+	    exit(1);
+	}
+    }
+
+    /* seal the image, and pass it on or say where it is */
+    if (shm) {
+	if (hex_shmseal(shmfd, &shmsize)) {
+	    hex_perror("Error sealing shared memory");
+	    exit(1);
+	}
+	sprintf(shmmsg, "%lu 0x%08lX 0x%08lX\n", shmsize, base, entry);
+	if (shmsock ? hex_shmsend(shmfd, shmsock, shmmsg) :
+	    hex_shmshow(shmfd, stdout, shmmsg)) {
+	    hex_perror(shmsock ? shmsock : "Error writing output");
+	    exit(1);
 	}
     }
 
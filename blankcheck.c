@@ -0,0 +1,432 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* blankcheck: check that a binary dump (such as an EPROM programmer's
+   readback) or a hex file is blank, and profile how full it is. The
+   bytes are counted and scanned with the vector kernels in simd.c,
+   a block at a time, so a large part is checked about as fast as it
+   can be read. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+#include "tools.h"
+
+#define BLANKBUFLEN	(1024*1024)	/* read size for binary dumps */
+
+/* what has been seen so far, in address order */
+typedef struct bcstate {
+    int		blank;		/* the blank value */
+    ULONG	lo, hi;		/* window, if window is set */
+    int		window;
+    ULONG	next;		/* address after the last byte seen */
+    int		started;
+    ULONG	start;		/* first address seen */
+    ULONG	total, used;	/* bytes seen, and bytes not blank */
+    int		found;		/* a byte that is not blank was seen */
+    ULONG	first;		/* address of the first one */
+
+    /* range listing (-l): a used range, and the blank run after it,
+       are held until the next used range shows whether the blank run
+       is long enough to end it */
+    int		list;
+    ULONG	mingap;
+    int		inused;
+    ULONG	ustart, uend;	/* pending used range */
+    ULONG	bstart, bend;	/* pending blank run */
+    ULONG	nused;		/* used ranges listed */
+} BCSTATE;
+
+
+static void bcusage(void)
+{
+    int i;
+
+    fprintf(stderr,"blankcheck %s\n", VERSION);
+    fprintf(stderr,"\nUsage:  blankcheck [-f{format}] [-i] [-r] [-b{base}] "\
+	    "[-F{blank}] [-w{start}:{end}]\n"\
+	    "                  [-l] [-k{mingap}] [-q] [-] [{file}]\n");
+    fprintf(stderr,"        blankcheck -help\n");
+    fprintf(stderr,"        blankcheck -?\n");
+    fprintf(stderr,"        blankcheck -version\n");
+    fprintf(stderr,"\n    {file} (or stdin) is a hex file, or a raw binary "\
+	    "dump that starts at\n    {base} (-r forces it to be read as "\
+	    "raw binary). Every byte from\n    {start} to {end} (default: "\
+	    "all of the file) must be {blank}\n    (default 0x%02X); "\
+	    "addresses that a hex file holds no data for\n    count as "\
+	    "blank. Exits with 0 if blank, 1 if not, 2 on trouble.\n",
+	    hex_fill);
+    fprintf(stderr,"\n    -l lists the used and blank ranges. Blank runs "\
+	    "shorter than {mingap}\n    (default %d) bytes are counted "\
+	    "as part of the used range around them.\n", SKIPGAP);
+    fprintf(stderr,"\n    formats supported:\n");
+    for(i=0; converters[i].name; i++) {
+	fprintf(stderr,"        %-16s %s\n", converters[i].name,
+		converters[i].desc);
+    }
+}
+
+
+/*---------------------------------------------------------------*/
+/* range listing */
+
+static void bcprint(ULONG lo, ULONG len, char *what)
+{
+    printf("0x%08lX-0x%08lX %s (%lu byte%s)\n", lo, lo + len - 1, what,
+	   len, len == 1 ? "" : "s");
+}
+
+static void bcflush(BCSTATE *st)
+{
+    if(st->inused) {
+	bcprint(st->ustart, st->uend - st->ustart, "used");
+	st->nused++;
+	st->inused = FALSE;
+    }
+    if(st->bend > st->bstart)
+	bcprint(st->bstart, st->bend - st->bstart, "blank");
+    st->bstart = st->bend;
+}
+
+/* a run of len used or blank bytes at addr */
+static void bcrun(BCSTATE *st, ULONG addr, ULONG len, int used)
+{
+    if(!used) {
+	if(st->bend != addr)
+	    st->bstart = addr;
+	st->bend = addr + len;
+	return;
+    }
+    if(st->inused && st->bend - st->bstart < st->mingap) {
+	/* the blank run since the last used range is too short to end
+	   it */
+	st->uend = addr + len;
+	st->bstart = st->bend;
+	return;
+    }
+    bcflush(st);
+    st->inused = TRUE;
+    st->ustart = addr;
+    st->uend = addr + len;
+    st->bstart = st->bend = st->uend;
+}
+
+
+/*---------------------------------------------------------------*/
+/* len blank addresses at addr, that hold no data */
+static void bcgap(BCSTATE *st, ULONG addr, ULONG len)
+{
+    if(!len)
+	return;
+    if(!st->started) {
+	st->started = TRUE;
+	st->start = addr;
+    }
+    st->total += len;
+    if(st->list)
+	bcrun(st, addr, len, FALSE);
+    st->next = addr + len;
+}
+
+/* len bytes of data at addr; blocks come in ascending address order */
+static void bcblock(BCSTATE *st, ULONG addr, UCHAR *data, ULONG len)
+{
+    ULONG	used, i, n;
+
+    /* keep to the window, and count the holes before the block */
+    if(st->window) {
+	if(!len || addr > st->hi || addr + (len - 1) < st->lo)
+	    return;
+	if(addr < st->lo) {
+	    data += st->lo - addr;
+	    len -= st->lo - addr;
+	    addr = st->lo;
+	}
+	if(st->hi - addr < len)
+	    len = st->hi - addr + 1;
+	bcgap(st, st->started ? st->next : st->lo,
+	      addr - (st->started ? st->next : st->lo));
+    }
+    else if(st->started)
+	bcgap(st, st->next, addr - st->next);
+    if(!len)
+	return;
+    if(!st->started) {
+	st->started = TRUE;
+	st->start = addr;
+    }
+
+    used = len - hex_memcount(data, st->blank, len);
+    st->total += len;
+    st->used += used;
+    st->next = addr + len;
+    if(used && !st->found) {
+	st->found = TRUE;
+	st->first = addr + hex_memnotc(data, st->blank, len);
+    }
+
+    /* alternate between blank and used runs */
+    if(st->list) {
+	for(i=0; i < len; ) {
+	    n = hex_memnotc(data + i, st->blank, len - i);
+	    if(n)
+		bcrun(st, addr + i, n, FALSE);
+	    if((i += n) == len)
+		break;
+	    n = hex_memisc(data + i, st->blank, len - i);
+	    bcrun(st, addr + i, n, TRUE);
+	    i += n;
+	}
+    }
+}
+
+/* the end of the data: the rest of the window is blank */
+static void bcend(BCSTATE *st)
+{
+    if(st->window && (!st->started || st->next <= st->hi))
+	bcgap(st, st->started ? st->next : st->lo,
+	      st->hi - (st->started ? st->next : st->lo) + 1);
+    if(st->list)
+	bcflush(st);
+}
+
+
+/*---------------------------------------------------------------*/
+/* check a raw binary dump, a block at a time */
+static int bcraw(FILE *in, ULONG base, BCSTATE *st)
+{
+    UCHAR	*buf;
+    size_t	n;
+
+    if(!(buf = malloc(BLANKBUFLEN))) {
+	ERR(H_ERR_IO);
+    }
+    while((n = fread(buf, 1, BLANKBUFLEN, in)) > 0) {
+	bcblock(st, base, buf, n);
+	base += n;
+    }
+    free(buf);
+    if(ferror(in)) {
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
+
+/* check a hex file, decoded into an image */
+static int bchex(FILE *in, int format, int ignoresum, BCSTATE *st)
+{
+    HEXIMAGE	img;
+    int		i;
+
+    hex_imginit(&img);
+    if(converters[format].ld_hex(in, ignoresum, &img) || hex_imgsort(&img)) {
+	hex_imgfree(&img);
+	return hex_errno;
+    }
+    for(i=0; i < img.nseg; i++)
+	bcblock(st, img.seg[i].addr, img.seg[i].data, img.seg[i].len);
+    hex_imgfree(&img);
+    return H_ERR_NONE;
+}
+
+
+/* exits with 0 if blank, 1 if not, 2 on trouble */
+int blankcheck_main(int argc, char **argv)
+{
+    int		format = FMT_UNDEF;
+    int		i, ret;
+    int		ignoresum = FALSE, argsdone = FALSE, quiet = FALSE;
+    int		raw = FALSE;
+    ULONG	base = 0;
+    char	*name = NULL, *label;
+    char	*c;
+    FILE	*in;
+    BCSTATE	st;
+
+    memset(&st, 0, sizeof(st));
+    st.blank = hex_fill;
+    st.mingap = SKIPGAP;
+
+    for(i=1; i<argc; i++) {
+
+	if ((argv[i][0] == '-') && !argsdone) {
+
+	    if (strlen(argv[i]) > 1) {
+
+		switch(argv[i][1]) {
+
+		  case 'i':
+		    ignoresum = TRUE;
+		    break;
+
+		  case 'r':
+		    raw = TRUE;
+		    break;
+
+		  case 'f':
+		    if ((format = getformat(argv[i]+2)) == FMT_UNDEF) {
+			fprintf(stderr,
+				"Error: Unknown format \"%s\"\n",argv[i]);
+			bcusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'b':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			base=(ULONG)strtoul(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0') {
+			fprintf(stderr,"Error: invalid base address\n");
+			bcusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'F':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			st.blank=(int)strtol(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0' || st.blank < 0 || st.blank > 0xff) {
+			fprintf(stderr,"Error: invalid blank value\n");
+			bcusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'w':
+		    if (!getrange(argv[i]+2,&st.lo,&st.hi)) {
+			fprintf(stderr,"Error: invalid address range\n");
+			bcusage();
+			return 2;
+		    }
+		    st.window = TRUE;
+		    break;
+
+		  case 'l':
+		    st.list = TRUE;
+		    break;
+
+		  case 'k':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2)
+			st.mingap=(ULONG)strtoul(argv[i]+2,&c,0);
+
+		    if (c[0] != '\0' || st.mingap == 0) {
+			fprintf(stderr,"Error: invalid minimum gap\n");
+			bcusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'h':
+		  case '?':
+		    bcusage();
+		    return 0;
+
+		  case 'v':
+		    fprintf(stderr,"blankcheck %s\n", VERSION);
+		    return 0;
+
+		  case 'q':
+		    quiet = TRUE;
+		    break;
+
+		  default:
+		    fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+		    bcusage();
+		    return 2;
+		}
+	    }
+
+	    else {
+		/* "-" ends the flags */
+		argsdone = TRUE;
+	    }
+	}
+
+	else if (!name)
+	    name = argv[i];
+
+	else {
+	    fprintf(stderr,"Error: too many arguments\n");
+	    bcusage();
+	    return 2;
+	}
+    }
+
+    /* a hex file unless -r was given or it is not in a known format */
+    label = name ? name : "(stdin)";
+    if (raw)
+	format = FMT_DEFAULT;	/* don't sniff */
+    if (!(in = hex_fopen(name, &format))) {
+	perror(label);
+	return 2;
+    }
+    if (raw || format == FMT_UNDEF) {
+	if (!quiet)
+	    fprintf(stderr,"(%s: raw binary at 0x%08lX)\n", label, base);
+	ret = bcraw(in, base, &st);
+    }
+    else {
+	if (!quiet)
+	    fprintf(stderr,"(%s: %s)\n", label, converters[format].name);
+	ret = bchex(in, format, ignoresum, &st);
+    }
+    if (name)
+	fclose(in);
+    if (ret) {
+	hex_perror(label);
+	return 2;
+    }
+    bcend(&st);
+
+    if (!quiet) {
+	if (!st.total)
+	    printf("%s: no data\n", label);
+	else if (!st.found)
+	    printf("%s: blank (0x%02X), %lu byte%s at 0x%08lX-0x%08lX\n",
+		   label, st.blank, st.total, st.total == 1 ? "" : "s",
+		   st.start, st.next - 1);
+	else {
+	    printf("%s: not blank, first used byte at 0x%08lX\n", label,
+		   st.first);
+	    printf("%s: %lu of %lu bytes at 0x%08lX-0x%08lX used (%.2f%%)",
+		   label, st.used, st.total, st.start, st.next - 1,
+		   100.0 * st.used / st.total);
+	    if (st.list)
+		printf(", in %lu range%s", st.nused,
+		       st.nused == 1 ? "" : "s");
+	    printf("\n");
+	}
+    }
+    return st.found ? 1 : 0;
+}
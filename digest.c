@@ -0,0 +1,457 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Image digests (additive sums, CRC-32, SHA-256) computed while the
+ * converters move data, so that no second pass over the binary image
+ * is needed.  The converters call hex_dgblock() for every block of
+ * binary data they read or write, in ascending address order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "etools.h"
+#include "hex.h"
+
+#define FILLBUFLEN	4096	/* size of fill pattern used for padding */
+
+HEXDIGEST *hex_digest = NULL;
+
+static const struct {
+    char	*name;
+    int		alg;
+    int		len;		/* bytes in stamped value */
+} dgnames[] = {
+    {"sum8",	DG_SUM8,	1},
+    {"sum16",	DG_SUM16,	2},
+    {"crc32",	DG_CRC32,	4},
+    {"sha256",	DG_SHA256,	32},
+    {NULL,	0,		0}
+};
+
+
+/*---------------------------------------------------------------*/
+/* additive sum of bytes */
+
+#ifdef __SSE2__
+static ULONG sum_bytes(const UCHAR *p, ULONG len)
+{
+    __m128i	acc = _mm_setzero_si128();
+    __m128i	zero = _mm_setzero_si128();
+    ULONG	sum;
+
+    /* psadbw against zero adds 8 bytes into each 64 bit lane */
+    for(; len >= 16; p += 16, len -= 16)
+	acc = _mm_add_epi64(acc,
+		_mm_sad_epu8(_mm_loadu_si128((const __m128i *)p), zero));
+    sum = (ULONG)_mm_cvtsi128_si64(acc) +
+	(ULONG)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+    while(len--)
+	sum += *p++;
+    return sum;
+}
+#else
+static ULONG sum_bytes(const UCHAR *p, ULONG len)
+{
+    ULONG	sum = 0;
+
+    while(len--)
+	sum += *p++;
+    return sum;
+}
+#endif /* __SSE2__ */
+
+
+/*---------------------------------------------------------------*/
+/* CRC-32 (IEEE 802.3, reflected, as used by zip and most programmers) */
+
+static uint32_t crctab[8][256];
+static int crctab_ready = FALSE;
+
+static void crc32_init(void)
+{
+    uint32_t	c;
+    int		i, j;
+
+    for(i=0; i < 256; i++) {
+	for(c=i, j=0; j < 8; j++)
+	    c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+	crctab[0][i] = c;
+    }
+    for(i=0; i < 256; i++)
+	for(j=1; j < 8; j++)
+	    crctab[j][i] = (crctab[j-1][i] >> 8) ^
+		crctab[0][crctab[j-1][i] & 0xff];
+    crctab_ready = TRUE;
+}
+
+/* slice-by-8: eight table lookups per eight input bytes */
+static uint32_t crc32_slice8(uint32_t crc, const UCHAR *p, ULONG len)
+{
+    uint32_t	lo, hi;
+
+    for(; len && ((uintptr_t)p & 7); len--)
+	crc = (crc >> 8) ^ crctab[0][(crc ^ *p++) & 0xff];
+
+    for(; len >= 8; p += 8, len -= 8) {
+	lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+	hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) |
+	    ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+	crc = crctab[7][lo & 0xff] ^ crctab[6][(lo >> 8) & 0xff] ^
+	    crctab[5][(lo >> 16) & 0xff] ^ crctab[4][lo >> 24] ^
+	    crctab[3][hi & 0xff] ^ crctab[2][(hi >> 8) & 0xff] ^
+	    crctab[1][(hi >> 16) & 0xff] ^ crctab[0][hi >> 24];
+    }
+
+    while(len--)
+	crc = (crc >> 8) ^ crctab[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+
+/* the bulk of a block is folded with PCLMULQDQ where the CPU has it
+   (see simd.c), and the rest goes through the tables */
+static uint32_t crc32_update(uint32_t crc, const UCHAR *p, ULONG len)
+{
+    unsigned int c = crc;
+    ULONG	n;
+
+    n = hex_crcfold(&c, p, len);
+    return crc32_slice8(c, p + n, len - n);
+}
+
+
+/*---------------------------------------------------------------*/
+/* SHA-256 (FIPS 180-4) */
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x,n)	(((x) >> (n)) | ((x) << (32-(n))))
+
+static void sha256_block(uint32_t *h, const UCHAR *p)
+{
+    uint32_t	w[64], a, b, c, d, e, f, g, hh, t1, t2;
+    int		i;
+
+    for(i=0; i < 16; i++, p += 4)
+	w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	    ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    for(; i < 64; i++)
+	w[i] = w[i-16] + w[i-7] +
+	    (ROR(w[i-15],7) ^ ROR(w[i-15],18) ^ (w[i-15] >> 3)) +
+	    (ROR(w[i-2],17) ^ ROR(w[i-2],19) ^ (w[i-2] >> 10));
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+    for(i=0; i < 64; i++) {
+	t1 = hh + (ROR(e,6) ^ ROR(e,11) ^ ROR(e,25)) +
+	    ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+	t2 = (ROR(a,2) ^ ROR(a,13) ^ ROR(a,22)) +
+	    ((a & b) ^ (a & c) ^ (b & c));
+	hh = g; g = f; f = e; e = d + t1;
+	d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+static void sha256_update(HEXDIGEST *d, const UCHAR *p, ULONG len)
+{
+    ULONG	n;
+
+    d->shalen += len;
+    if(d->shafill) {
+	n = MIN(len, 64 - (ULONG)d->shafill);
+	memcpy(d->shabuf + d->shafill, p, n);
+	d->shafill += n;
+	p += n;
+	len -= n;
+	if(d->shafill < 64)
+	    return;
+	sha256_block(d->sha, d->shabuf);
+	d->shafill = 0;
+    }
+    for(; len >= 64; p += 64, len -= 64)
+	sha256_block(d->sha, p);
+    memcpy(d->shabuf, p, len);
+    d->shafill = len;
+}
+
+static void sha256_final(HEXDIGEST *d)
+{
+    uint64_t	bits = (uint64_t)d->shalen << 3;
+    int		i;
+
+    d->shabuf[d->shafill++] = 0x80;
+    if(d->shafill > 56) {
+	memset(d->shabuf + d->shafill, 0, 64 - d->shafill);
+	sha256_block(d->sha, d->shabuf);
+	d->shafill = 0;
+    }
+    memset(d->shabuf + d->shafill, 0, 56 - d->shafill);
+    for(i=0; i < 8; i++)
+	d->shabuf[56 + i] = (bits >> (56 - 8*i)) & 0xff;
+    sha256_block(d->sha, d->shabuf);
+
+    for(i=0; i < 32; i++)
+	d->sha256[i] = (d->sha[i >> 2] >> (24 - 8*(i & 3))) & 0xff;
+}
+
+
+/*---------------------------------------------------------------*/
+/* digest bookkeeping */
+
+/* feed bytes that lie inside the window to every selected algorithm */
+static void dg_feed(HEXDIGEST *d, const UCHAR *p, ULONG len)
+{
+    if(d->algs & (DG_SUM8 | DG_SUM16))
+	d->sum += sum_bytes(p, len);
+    if(d->algs & DG_CRC32)
+	d->crc = crc32_update(d->crc, p, len);
+    if(d->algs & DG_SHA256)
+	sha256_update(d, p, len);
+    d->next += len;
+}
+
+/* feed fill bytes for the unused addresses up to (but not including)
+   addr, clipped to the window */
+static void dg_pad(HEXDIGEST *d, ULONG addr)
+{
+    UCHAR	fillbuf[FILLBUFLEN];
+    ULONG	n;
+
+    if(addr > d->end + 1 && d->end != (ULONG)-1)
+	addr = d->end + 1;
+    if(addr <= d->next)
+	return;
+    memset(fillbuf, d->fill, sizeof(fillbuf));
+    while(d->next < addr) {
+	n = MIN(addr - d->next, FILLBUFLEN);
+	dg_feed(d, fillbuf, n);
+    }
+}
+
+/* compute the final values and the bytes to be stamped */
+static void dg_finish(HEXDIGEST *d)
+{
+    ULONG	v;
+    int		i;
+
+    if(d->done)
+	return;
+    if(d->window)
+	dg_pad(d, d->end + 1);
+    d->done = TRUE;
+    d->sum8 = d->sum & 0xff;
+    d->sum16 = d->sum & 0xffff;
+    d->crc32 = d->crc ^ 0xffffffff;
+    if(d->algs & DG_SHA256)
+	sha256_final(d);
+
+    if(!d->stamp)
+	return;
+    switch(d->stamp) {
+      case DG_SUM8:	v = d->sum8;	break;
+      case DG_SUM16:	v = d->sum16;	break;
+      case DG_CRC32:	v = d->crc32;	break;
+      default:		v = 0;		break;
+    }
+    if(d->stamp == DG_SHA256)
+	memcpy(d->stampval, d->sha256, 32);
+    else
+	for(i=0; i < d->stamplen; i++)
+	    d->stampval[i] = d->stampbe ?
+		(v >> (8 * (d->stamplen - 1 - i))) & 0xff :
+		(v >> (8 * i)) & 0xff;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_dginit(HEXDIGEST *d, int algs)
+{
+    memset(d, 0, sizeof(*d));
+    d->algs = algs;
+    d->fill = 0xff;
+    d->end = (ULONG)-1;
+    d->crc = 0xffffffff;
+    d->sha[0] = 0x6a09e667; d->sha[1] = 0xbb67ae85;
+    d->sha[2] = 0x3c6ef372; d->sha[3] = 0xa54ff53a;
+    d->sha[4] = 0x510e527f; d->sha[5] = 0x9b05688c;
+    d->sha[6] = 0x1f83d9ab; d->sha[7] = 0x5be0cd19;
+    if(!crctab_ready)
+	crc32_init();
+}
+
+
+/*---------------------------------------------------------------*/
+int hex_dgalg(char *name)
+{
+    int		i;
+
+    for(i=0; dgnames[i].name; i++)
+	if(strcmp(dgnames[i].name, name) == 0)
+	    return dgnames[i].alg;
+    return 0;
+}
+
+
+/*---------------------------------------------------------------*/
+int hex_dgstamp(HEXDIGEST *d, int alg, ULONG addr, int bigendian)
+{
+    int		i;
+
+    for(i=0; dgnames[i].name && dgnames[i].alg != alg; i++)
+	;
+    if(!dgnames[i].name) {
+	ERR(H_ERR_DIGEST);
+    }
+
+    /* the stamp must follow the summed range, so that its value is
+       known by the time the converter reaches it. Without a window
+       the range starts at the first data, which address 0 cannot
+       follow; other addresses are checked when the data starts. */
+    if(d->window ? d->end >= addr : addr == 0) {
+	ERR(H_ERR_DIGEST);
+    }
+    d->algs |= alg;
+    d->stamp = alg;
+    d->stamplen = dgnames[i].len;
+    d->stampaddr = addr;
+    d->stampbe = bigendian;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_dgblock(HEXDIGEST *d, ULONG addr, UCHAR *data, ULONG len)
+{
+    ULONG	lo, hi, skip;
+
+    if(!len)
+	return;
+
+    if(!d->started) {
+	d->started = TRUE;
+	if(!d->window) {
+	    d->start = addr;
+	    if(d->stamp && d->stampaddr <= addr) {
+		/* the stamp would sum itself; leave it out */
+		d->stamp = 0;
+		d->stampbad = TRUE;
+	    }
+	    else if(d->stamp)
+		d->end = d->stampaddr - 1;
+	}
+	d->next = d->start;
+    }
+
+    /* digests depend on byte order, so data must arrive ascending */
+    if(addr < d->next && addr + len > d->start && d->next > d->start &&
+       !d->done) {
+	d->unordered = TRUE;
+    }
+
+    if(!d->done && !d->unordered) {
+	dg_pad(d, addr);
+	lo = MAX(addr, d->next);
+	hi = (d->end == (ULONG)-1) ? addr + len : MIN(addr + len, d->end + 1);
+	if(hi > lo)
+	    dg_feed(d, data + (lo - addr), hi - lo);
+    }
+
+    /* stamp the checksum into the block if it covers the location */
+    if(d->stamp && addr < d->stampaddr + d->stamplen &&
+       addr + len > d->stampaddr) {
+	if(!d->done)
+	    dg_finish(d);
+	lo = MAX(addr, d->stampaddr);
+	hi = MIN(addr + len, d->stampaddr + d->stamplen);
+	skip = lo - d->stampaddr;
+	memcpy(data + (lo - addr), d->stampval + skip, hi - lo);
+	d->stamped += hi - lo;
+    }
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_dgfinal(HEXDIGEST *d)
+{
+    if(!d->started) {
+	d->started = TRUE;
+	d->next = d->start;
+    }
+    if(!d->unordered)
+	dg_finish(d);
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_dgprint(HEXDIGEST *d, FILE *out)
+{
+    char	*sep = "";
+    int		i;
+
+    if(d->unordered) {
+	fprintf(out, "digest: unavailable (addresses not ascending)");
+	return;
+    }
+    if(d->algs & DG_SUM8) {
+	fprintf(out, "%ssum8: 0x%02lX", sep, d->sum8);
+	sep = " ";
+    }
+    if(d->algs & DG_SUM16) {
+	fprintf(out, "%ssum16: 0x%04lX", sep, d->sum16);
+	sep = " ";
+    }
+    if(d->algs & DG_CRC32) {
+	fprintf(out, "%scrc32: 0x%08lX", sep, d->crc32);
+	sep = " ";
+    }
+    if(d->algs & DG_SHA256) {
+	fprintf(out, "%ssha256: ", sep);
+	for(i=0; i < 32; i++)
+	    fprintf(out, "%02x", d->sha256[i]);
+    }
+}
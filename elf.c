@@ -0,0 +1,285 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * ELF input for bin2hex. The loadable (PT_LOAD) segments of an ELF32
+ * or ELF64 file of either byte order are written to a sink at their
+ * physical addresses, so firmware can be converted without going
+ * through objcopy and a padded binary. Only the bytes present in the
+ * file are written; .bss style memory (p_memsz beyond p_filesz) and
+ * the gaps between segments are left out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <elf.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "etools.h"
+#include "hex.h"
+
+#define ELFREADLEN	65536	/* read size when the file can't be mapped */
+
+typedef struct elfload {
+    ULONG	paddr;		/* physical load address */
+    ULONG	offset;		/* file offset of the data */
+    ULONG	len;		/* bytes in the file */
+} ELFLOAD;
+
+
+/*---------------------------------------------------------------*/
+/* TRUE if buf (len bytes) is the start of an ELF file */
+int hex_iself(UCHAR *buf, int len)
+{
+    return len >= EI_NIDENT && memcmp(buf, ELFMAG, SELFMAG) == 0 &&
+	(buf[EI_CLASS] == ELFCLASS32 || buf[EI_CLASS] == ELFCLASS64) &&
+	(buf[EI_DATA] == ELFDATA2LSB || buf[EI_DATA] == ELFDATA2MSB);
+}
+
+
+/*---------------------------------------------------------------*/
+/* read an n byte field in the file's byte order */
+static unsigned long long getfield(UCHAR *p, int n, int msb)
+{
+    unsigned long long	v = 0;
+    int			i;
+
+    for(i=0; i < n; i++)
+	v |= (unsigned long long)p[msb ? n - 1 - i : i] << (8 * i);
+    return v;
+}
+
+#define EHDR(f)		(is64 ? getfield(img + offsetof(Elf64_Ehdr, f), \
+				 sizeof(((Elf64_Ehdr *)0)->f), msb) : \
+			 getfield(img + offsetof(Elf32_Ehdr, f), \
+				 sizeof(((Elf32_Ehdr *)0)->f), msb))
+#define PHDR(p,f)	(is64 ? getfield((p) + offsetof(Elf64_Phdr, f), \
+				 sizeof(((Elf64_Phdr *)0)->f), msb) : \
+			 getfield((p) + offsetof(Elf32_Phdr, f), \
+				 sizeof(((Elf32_Phdr *)0)->f), msb))
+
+static int cmpload(const void *a, const void *b)
+{
+    const ELFLOAD *la = a, *lb = b;
+
+    return la->paddr < lb->paddr ? -1 : la->paddr > lb->paddr;
+}
+
+/* Find the loadable segments of the ELF image img (size bytes), sorted
+   by address. Returns the number found, or -1 with hex_errno set. */
+static int elfloads(UCHAR *img, ULONG size, ELFLOAD **loads, ULONG *entry)
+{
+    int			is64, msb, n, i;
+    unsigned long long	phoff, phentsize, phnum, paddr, off, len;
+    UCHAR		*ph;
+    ELFLOAD		*l;
+
+    if(!hex_iself(img, size)) {
+	hex_errno = H_ERR_BADHEX;
+	return -1;
+    }
+    is64 = img[EI_CLASS] == ELFCLASS64;
+    msb = img[EI_DATA] == ELFDATA2MSB;
+    if(size < (is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+	hex_errno = H_ERR_BADHEX;
+	return -1;
+    }
+
+    phoff = EHDR(e_phoff);
+    phentsize = EHDR(e_phentsize);
+    phnum = EHDR(e_phnum);
+    if(phentsize < (is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) ||
+       phoff > size || phnum * phentsize > size - phoff) {
+	hex_errno = H_ERR_BADHEX;
+	return -1;
+    }
+    if(EHDR(e_entry) > MAXADDR_INTEL32) {
+	hex_errno = H_ERR_ENTRY;
+	return -1;
+    }
+    *entry = EHDR(e_entry);
+
+    if(!(l = malloc(MAX(phnum, 1) * sizeof(ELFLOAD)))) {
+	hex_errno = H_ERR_IO;
+	return -1;
+    }
+    for(n=0, i=0; i < (int)phnum; i++) {
+	ph = img + phoff + i * phentsize;
+	if(PHDR(ph, p_type) != PT_LOAD || !(len = PHDR(ph, p_filesz)))
+	    continue;
+	paddr = PHDR(ph, p_paddr);
+	off = PHDR(ph, p_offset);
+	if(off > size || len > size - off) {
+	    free(l);
+	    hex_errno = H_ERR_BADHEX;
+	    return -1;
+	}
+	if(paddr > MAXADDR_INTEL32 || len - 1 > MAXADDR_INTEL32 - paddr) {
+	    free(l);
+	    hex_errno = H_ERR_ADDR;
+	    return -1;
+	}
+	l[n].paddr = paddr;
+	l[n].offset = off;
+	l[n].len = len;
+	n++;
+    }
+
+    qsort(l, n, sizeof(ELFLOAD), cmpload);
+    for(i=1; i < n; i++) {
+	if(l[i].paddr < l[i-1].paddr + l[i-1].len) {
+	    free(l);
+	    hex_errno = H_ERR_OVERLAP;
+	    return -1;
+	}
+    }
+    *loads = l;
+    return n;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Get the whole of in into memory: mapped if it is a regular file,
+   read otherwise. *mapped tells hex_elfclose() how to let go of it. */
+static UCHAR *elfslurp(FILE *in, ULONG *size, int *mapped)
+{
+    struct stat	st;
+    UCHAR	*buf, *nb;
+    ULONG	alloc = 0, n;
+    int		fd = fileno(in);
+
+    *mapped = FALSE;
+    if(fd >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+	/* writable, because hex_dgblock() may stamp a checksum into
+	   the data; the mapping is private, so the file is unchanged */
+	buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if(buf != MAP_FAILED) {
+	    *size = st.st_size;
+	    *mapped = TRUE;
+	    return buf;
+	}
+    }
+
+    for(buf=NULL, *size=0; ; *size += n) {
+	if(*size + ELFREADLEN > alloc) {
+	    alloc = MAX(alloc * 2, *size + ELFREADLEN);
+	    if(!(nb = realloc(buf, alloc))) {
+		free(buf);
+		hex_errno = H_ERR_IO;
+		return NULL;
+	    }
+	    buf = nb;
+	}
+	if(!(n = fread(buf + *size, 1, ELFREADLEN, in)))
+	    break;
+    }
+    if(ferror(in)) {
+	free(buf);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return buf;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Load the ELF file in (read from its start) and find its loadable
+   segments. e->maxaddr is the highest address they cover, which lets
+   the caller pick an output format before anything is written. */
+int hex_elfopen(FILE *in, HEXELF *e)
+{
+    ELFLOAD	*l;
+
+    memset(e, 0, sizeof(*e));
+    if(!(e->img = elfslurp(in, &e->size, &e->mapped)))
+	return hex_errno;
+    if((e->nload = elfloads(e->img, e->size, &l, &e->entry)) < 0) {
+	e->nload = 0;
+	hex_elfclose(e);
+	return hex_errno;
+    }
+    e->loads = l;
+    if(e->nload) {
+	e->minaddr = l[0].paddr;
+	e->maxaddr = l[e->nload-1].paddr + l[e->nload-1].len - 1;
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Write the loadable segments to s, in address order. The data is
+   passed to hex_digest on the way. s->end() is left to the caller,
+   which may want to use another entry address. */
+int hex_elfwrite(HEXELF *e, HEXSINK *s)
+{
+    ELFLOAD	*l = e->loads;
+    int		i;
+
+    for(i=0; i < e->nload; i++) {
+	if(hex_digest)
+	    hex_dgblock(hex_digest, l[i].paddr, e->img + l[i].offset,
+			l[i].len);
+	if(s->put(s, l[i].paddr, e->img + l[i].offset, l[i].len))
+	    return hex_errno;
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_elfclose(HEXELF *e)
+{
+    if(e->mapped)
+	munmap(e->img, e->size);
+    else
+	free(e->img);
+    free(e->loads);
+    memset(e, 0, sizeof(*e));
+}
+
+
+/*---------------------------------------------------------------*/
+/* Set *iself to TRUE if in is an ELF file, without using up any of
+   it. A file is checked in place; any other stream is wrapped with
+   hex_fpeek(), so the stream returned must be used instead of in.
+   Returns NULL and sets hex_errno on failure. */
+FILE *hex_elfpeek(FILE *in, int *iself)
+{
+    UCHAR	buf[SNIFFBUFLEN];
+    int		len, fd = fileno(in);
+
+    if(fd >= 0 && (len = pread(fd, buf, EI_NIDENT, 0)) >= 0) {
+	*iself = hex_iself(buf, len);
+	return in;
+    }
+    if(!(in = hex_fpeek(in, buf, &len)))
+	return NULL;
+    *iself = hex_iself(buf, len);
+    return in;
+}
@@ -0,0 +1,238 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Fan-out. hex_fanout() sets up a sink that hands everything put into
+ * it to several other sinks, each drained by a thread of its own, so
+ * that one pass over the input (reading, decompressing and decoding)
+ * feeds several outputs and the outputs are formatted and written at
+ * the same time.
+ *
+ * Data is copied into a ring of FANDEPTH blocks shared by all the
+ * writers. Contiguous puts are gathered into one block, so a stream of
+ * short segments costs one hand-over per block rather than one per
+ * segment. Each writer has its own semaphore of blocks ready for it and
+ * its own tail; a block goes back to the producer when the last writer
+ * has finished with it. A block of length 0 marks the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "etools.h"
+#include "hex.h"
+
+#define FANBLOCK	(64*1024)	/* bytes per block */
+#define FANDEPTH	8		/* blocks in the ring */
+
+typedef struct fanstate FANSTATE;
+
+typedef struct fanwriter {
+    FANSTATE	*fs;
+    HEXSINK	*s;
+    sem_t	full;		/* blocks ready for this writer */
+    int		tail;		/* next block to drain */
+    int		err;		/* hex_errno from the writer, or 0 */
+    int		ioerr;		/* errno that went with it */
+    pthread_t	thread;
+} FANWRITER;
+
+struct fanstate {
+    UCHAR	*buf[FANDEPTH];
+    ULONG	addr[FANDEPTH];
+    ULONG	len[FANDEPTH];
+    int		refs[FANDEPTH];	/* writers yet to finish with a block */
+    sem_t	free;		/* blocks ready for the producer */
+    int		head;		/* block being filled (producer only) */
+    ULONG	entry;		/* passed to end(), set before the end marker */
+    int		nout;
+    FANWRITER	w[1];		/* nout of them */
+};
+
+
+/* a writer thread: passes blocks on to its sink until the end marker.
+   After an error it keeps taking blocks, so that the producer and the
+   other writers are not held up. */
+static void *fan_writer(void *arg)
+{
+    FANWRITER	*w = arg;
+    FANSTATE	*fs = w->fs;
+    ULONG	n;
+    int		t;
+
+    do {
+	sem_wait(&w->full);
+	t = w->tail;
+	n = fs->len[t];
+	if(!w->err && (n ? w->s->put(w->s, fs->addr[t], fs->buf[t], n) :
+		       w->s->end(w->s, fs->entry))) {
+	    w->err = hex_errno;
+	    w->ioerr = errno;
+	}
+	w->tail = (t + 1) % FANDEPTH;
+	if(__atomic_sub_fetch(&fs->refs[t], 1, __ATOMIC_ACQ_REL) == 0)
+	    sem_post(&fs->free);
+    } while(n);
+    return NULL;
+}
+
+
+/* hand the block at head to the writers, and wait for the next free
+   one */
+static void fan_handover(FANSTATE *fs)
+{
+    int		i;
+
+    fs->refs[fs->head] = fs->nout;
+    for(i=0; i < fs->nout; i++)
+	sem_post(&fs->w[i].full);
+    fs->head = (fs->head + 1) % FANDEPTH;
+    sem_wait(&fs->free);
+    fs->len[fs->head] = 0;
+}
+
+
+static int fan_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    FANSTATE	*fs = s->priv;
+    ULONG	n;
+    int		h;
+
+    while(len) {
+	h = fs->head;
+	if(fs->len[h] && (addr != fs->addr[h] + fs->len[h] ||
+			  fs->len[h] == FANBLOCK))
+	    fan_handover(fs);
+	h = fs->head;
+	if(!fs->len[h])
+	    fs->addr[h] = addr;
+	n = MIN(len, FANBLOCK - fs->len[h]);
+	memcpy(fs->buf[h] + fs->len[h], data, n);
+	fs->len[h] += n;
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    return H_ERR_NONE;
+}
+
+
+static void fan_free(FANSTATE *fs)
+{
+    int		i;
+
+    for(i=0; i < FANDEPTH; i++)
+	free(fs->buf[i]);
+    free(fs);
+}
+
+
+/* flush the last block, send the end marker and wait for the writers.
+   The first writer error found is returned. */
+static int fan_end(HEXSINK *s, ULONG entry)
+{
+    FANSTATE	*fs = s->priv;
+    int		i, err = H_ERR_NONE, ioerr = 0;
+
+    if(fs->len[fs->head])
+	fan_handover(fs);
+    fs->entry = entry;
+    fs->refs[fs->head] = fs->nout;
+    for(i=0; i < fs->nout; i++)
+	sem_post(&fs->w[i].full);
+
+    for(i=0; i < fs->nout; i++) {
+	pthread_join(fs->w[i].thread, NULL);
+	sem_destroy(&fs->w[i].full);
+	if(fs->w[i].err && !err) {
+	    err = fs->w[i].err;
+	    ioerr = fs->w[i].ioerr;
+	}
+    }
+    sem_destroy(&fs->free);
+    fan_free(fs);
+    s->priv = NULL;
+
+    if(err) {
+	errno = ioerr;
+	ERR(err);
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Set up s to pass everything on to the nout sinks in outs[], each
+   written by its own thread. The threads are started here and finish
+   in s->end(), which must be called even if a put() fails. */
+int hex_fanout(HEXSINK *s, HEXSINK **outs, int nout)
+{
+    FANSTATE	*fs;
+    int		i;
+
+    if(nout < 1) {
+	ERR(H_ERR_UNSUP);
+    }
+    if(!(fs = calloc(1, sizeof(*fs) + (nout-1) * sizeof(FANWRITER)))) {
+	ERR(H_ERR_IO);
+    }
+    for(i=0; i < FANDEPTH; i++) {
+	if(!(fs->buf[i] = malloc(FANBLOCK))) {
+	    fan_free(fs);
+	    ERR(H_ERR_IO);
+	}
+    }
+    fs->nout = nout;
+    sem_init(&fs->free, 0, FANDEPTH - 1);	/* head is taken */
+
+    for(i=0; i < nout; i++) {
+	fs->w[i].fs = fs;
+	fs->w[i].s = outs[i];
+	sem_init(&fs->w[i].full, 0, 0);
+	if(pthread_create(&fs->w[i].thread, NULL, fan_writer, &fs->w[i])) {
+	    /* stop the writers already running */
+	    fs->nout = i;
+	    sem_destroy(&fs->w[i].full);
+	    if(i) {
+		s->priv = fs;
+		fan_end(s, 0);
+	    }
+	    else {
+		sem_destroy(&fs->free);
+		fan_free(fs);
+	    }
+	    ERR(H_ERR_IO);
+	}
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->put = fan_put;
+    s->end = fan_end;
+    s->format = outs[0]->format;
+    s->reclen = outs[0]->reclen;
+    s->priv = fs;
+    return H_ERR_NONE;
+}
@@ -0,0 +1,98 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Checksum repair. A hand edited hex file, or one that a tool has
+ * mangled, can have records whose data is right but whose checksums
+ * are not. Converting it to binary and back would fix them, but would
+ * also rewrite every record in our own layout. hex_fixsums() maps the
+ * file and has the format's fix_hex function rewrite just the checksum
+ * characters that are wrong, in place, so every other byte of the
+ * file stays as it was and only the pages that change are written
+ * back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "etools.h"
+#include "hex.h"
+
+
+/*---------------------------------------------------------------*/
+/* Repair the checksums in the file called name, in *format, or if
+   that is FMT_UNDEF in the format found by hex_detect() (or the
+   default format, since a file with bad checksums may not be
+   recognised); *format is set to the format used. The counts in fix
+   are added to. */
+int hex_fixsums(char *name, int *format, HEXFIX *fix)
+{
+    struct stat	st;
+    UCHAR	*buf;
+    int		fd, ret;
+
+    if((fd = open(name, O_RDWR)) < 0) {
+	ERR(H_ERR_IO);
+    }
+    if(fstat(fd, &st)) {
+	close(fd);
+	ERR(H_ERR_IO);
+    }
+    if(!S_ISREG(st.st_mode)) {
+	close(fd);
+	errno = EINVAL;		/* nowhere to write back to */
+	ERR(H_ERR_IO);
+    }
+    if(st.st_size == 0) {
+	close(fd);
+	if(*format == FMT_UNDEF)
+	    *format = FMT_DEFAULT;
+	return H_ERR_NONE;
+    }
+
+    buf = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED) {
+	ERR(H_ERR_IO);
+    }
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+    if(*format == FMT_UNDEF &&
+       (*format = hex_detect(buf, MIN(st.st_size, SNIFFBUFLEN))) ==
+       FMT_UNDEF)
+	*format = FMT_DEFAULT;
+    if(!converters[*format].fix_hex)
+	ret = hex_errno = H_ERR_UNSUP;
+    else
+	ret = converters[*format].fix_hex(buf, st.st_size, fix);
+
+    /* the changed pages are written back as the mapping goes */
+    if(munmap(buf, st.st_size) && !ret) {
+	ERR(H_ERR_IO);
+    }
+    return ret;
+}
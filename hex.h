@@ -25,10 +25,301 @@
 
 #include <stdio.h>
 
+/* sparse binary images (see image.c) */
+typedef struct hexseg {
+    ULONG	addr;		/* address of first byte */
+    ULONG	len;		/* number of data bytes */
+    ULONG	alloc;		/* bytes allocated at data */
+    UCHAR	*data;
+    int		seq;		/* order in which segments were added */
+} HEXSEG;
+
+typedef struct heximage {
+    HEXSEG	*seg;
+    int		nseg;
+    int		segalloc;
+    int		sorted;		/* segments ascending, no overlaps */
+    ULONG	entry;
+} HEXIMAGE;
+
+typedef void HEXCMPFUNC(ULONG, ULONG, void *);
+extern void hex_imginit(HEXIMAGE *);
+extern void hex_imgfree(HEXIMAGE *);
+extern int hex_imgadd(HEXIMAGE *, ULONG, UCHAR *, ULONG);
+extern int hex_imgraw(FILE *, ULONG, HEXIMAGE *);
+extern int hex_imgsort(HEXIMAGE *);
+extern int hex_imgmerge(HEXIMAGE *, int, HEXCMPFUNC *, void *);
+extern int hex_imgappend(HEXIMAGE *, HEXIMAGE *, long);
+extern void hex_imgcrop(HEXIMAGE *, ULONG, ULONG);
+extern int hex_imgwrbin(HEXIMAGE *, FILE *, ULONG, ULONG);
+
+/* overlap policies for hex_imgmerge() */
+#define IMG_LAST	0	/* data added last wins */
+#define IMG_FIRST	1	/* data added first wins */
+#define IMG_ERROR	2	/* overlaps are an error */
+extern ULONG hex_imgcmp(HEXIMAGE *, HEXIMAGE *, int, HEXCMPFUNC *, void *);
+
+/* block compare and scan kernels (see simd.c) */
+extern ULONG hex_memdiff(const UCHAR *, const UCHAR *, ULONG);
+extern ULONG hex_memsame(const UCHAR *, const UCHAR *, ULONG);
+extern ULONG hex_memnotc(const UCHAR *, int, ULONG);
+extern ULONG hex_memisc(const UCHAR *, int, ULONG);
+extern ULONG hex_memcount(const UCHAR *, int, ULONG);
+extern void hex_swap16(UCHAR *, const UCHAR *, ULONG);
+
+/* codec kernels, chosen at run time for the CPU (see simd.c) */
+extern void hex_decode(UCHAR *, const UCHAR *, ULONG);
+extern void hex_encode(UCHAR *, const UCHAR *, ULONG);
+extern ULONG hex_xspan(const UCHAR *, ULONG);
+extern UCHAR hex_sum8(const UCHAR *, ULONG);
+extern ULONG hex_crcfold(unsigned int *, const UCHAR *, ULONG);
+extern int hex_cpuset(char *);
+extern char *hex_cpuname(void);
+extern char *hex_cpulevel(int);
+
 /* prototypes for the conversion functions */
 typedef int WRHEXFUNC(FILE *, FILE *, ULONG, ULONG);
 typedef int RDHEXFUNC(FILE *, FILE *, int, ULONG *, ULONG *);
 typedef int SCANHEXFUNC(FILE *, ULONG *, ULONG *, ULONG *, ULONG *);
+typedef int SNIFFHEXFUNC(UCHAR *, int, int);
+typedef int LDHEXFUNC(FILE *, int, HEXIMAGE *);
+
+/* push parsing (see push.c). Hex data is fed to a parser in chunks of
+   any size, and rec() is called with each run of data as soon as it
+   is decoded. Nothing else is kept, so memory use does not depend on
+   the size of the image. */
+#define HEXLINEMAX	1024	/* longest line a push parser takes */
+typedef int HEXRECFUNC(void *, ULONG, UCHAR *, ULONG);
+typedef struct hexpush HEXPUSH;
+typedef int PUSHHEXFUNC(HEXPUSH *, UCHAR *, ULONG);
+struct hexpush {
+    int		format;		/* offset into converters[] */
+    int		ignoresum;
+    HEXRECFUNC	*rec;		/* takes arg, address, data, length */
+    void	*arg;
+    ULONG	entry;
+    int		done;		/* TRUE once the end record is seen */
+
+    /* state kept by the push_hex functions */
+    ULONG	state[2];	/* address state, as in HEXIXENT */
+    int		linelen;	/* bytes of a partial line in line */
+    int		skipping;	/* in the tail of an overlong line */
+    UCHAR	line[HEXLINEMAX];
+};
+extern int hex_pushinit(HEXPUSH *, int, int, HEXRECFUNC *, void *);
+extern int hex_push(HEXPUSH *, UCHAR *, ULONG);
+extern int hex_pushend(HEXPUSH *);
+
+/* extent maps (see map.c) */
+typedef struct hexextent {
+    ULONG	addr;		/* address of first byte */
+    ULONG	len;		/* number of bytes */
+} HEXEXTENT;
+
+typedef struct hexmap {
+    HEXEXTENT	*ext;
+    int		next;		/* number of extents */
+    int		extalloc;
+    int		sorted;		/* extents ascending, none touching */
+    ULONG	size;		/* data bytes seen, counting overlaps */
+    ULONG	entry;
+} HEXMAP;
+
+extern void hex_mapinit(HEXMAP *);
+extern void hex_mapfree(HEXMAP *);
+extern int hex_mapadd(HEXMAP *, ULONG, ULONG);
+extern void hex_mapsort(HEXMAP *);
+extern ULONG hex_mapused(HEXMAP *);
+extern int hex_scanmap(FILE *, int, int, HEXMAP *);
+
+/* record indexes (see index.c) */
+typedef struct hexixent {
+    ULONG	lo, hi;		/* addresses of the data (inclusive) */
+    ULONG	offset;		/* file offset of the first record */
+    ULONG	nrec;		/* number of records (of any type) */
+    ULONG	state[2];	/* format's address state at offset */
+} HEXIXENT;
+
+typedef struct hexindex {
+    HEXIXENT	*ent;		/* sorted by lo */
+    ULONG	*maxhi;		/* highest hi of ent[0] to ent[i] */
+    int		nent;
+    int		entalloc;
+    int		format;		/* format of the indexed file */
+    ULONG	size, mtime;	/* identify the indexed file */
+    int		unsaved;	/* built, but could not be saved */
+} HEXINDEX;
+
+typedef int IXHEXFUNC(FILE *, int, HEXINDEX *);
+typedef int LDIXHEXFUNC(FILE *, int, HEXIXENT *, HEXIMAGE *);
+extern void hex_ixinit(HEXINDEX *);
+extern void hex_ixfree(HEXINDEX *);
+extern int hex_ixadd(HEXINDEX *, HEXIXENT *);
+extern int hex_ixbuild(FILE *, int, int, HEXINDEX *);
+extern int hex_ixsave(HEXINDEX *, char *);
+extern int hex_ixload(HEXINDEX *, char *);
+extern int hex_ixget(FILE *, char *, char *, int, int, HEXINDEX *);
+extern int hex_ixrange(FILE *, HEXINDEX *, int, ULONG, ULONG, HEXIMAGE *);
+
+/* streaming output (see sink.c). Blocks of data are pushed into a sink
+   in any address order with put(), then end() finishes the output. The
+   put_hex functions in converters[] split the data into records and
+   write extended address records as they are needed. */
+typedef struct hexsink HEXSINK;
+typedef int PUTHEXFUNC(HEXSINK *, ULONG, UCHAR *, ULONG);
+typedef int ENDHEXFUNC(HEXSINK *, ULONG);
+struct hexsink {
+    PUTHEXFUNC	*put;		/* takes address, data and length */
+    ENDHEXFUNC	*end;		/* takes the entry address */
+    FILE	*out;
+    int		format;		/* offset into converters[] */
+    int		reclen;		/* data bytes per record (1-255) */
+    HEXSINK	*next;		/* downstream sink, for filters */
+    void	*priv;		/* filter state */
+
+    /* state kept by the put_hex functions */
+    ULONG	upper;		/* upper address bits in effect */
+    int		upperset;	/* FALSE until upper has been written */
+    ULONG	recaddr;	/* address of the pending record */
+    int		recfill;	/* bytes in the pending record */
+    UCHAR	rec[255];
+    ULONG	base;		/* first address written (binary, banks) */
+};
+#define HEXRECLEN	16	/* default data bytes per record */
+extern void hex_sinkinit(HEXSINK *, int, FILE *);
+extern int hex_imgwrite(HEXIMAGE *, HEXSINK *);
+extern int hex_wrsink(FILE *, HEXSINK *, ULONG, ULONG);
+extern int hex_skipsink(HEXSINK *, HEXSINK *, int, ULONG);
+extern void hex_binsink(HEXSINK *, FILE *, ULONG, ULONG);
+extern int hex_fanout(HEXSINK *, HEXSINK **, int);
+extern int hex_banksink(HEXSINK *, int, char *, ULONG, ULONG);
+extern int hex_xformsink(HEXSINK *, char *, HEXSINK *);
+#define XFORMMAX	16	/* most stages in a transform chain */
+#define FANMAX		8	/* most outputs bin2hex/hex2bin will fan out to */
+#define SKIPGAP		16	/* default shortest blank run skipped */
+
+/* out-of-core images (see spill.c). Data added in any address order is
+   held in a pool of fixed size, which is sorted and written to a
+   temporary file as a run whenever it fills; hex_spillwrite() merges
+   the runs into a sink in address order. Where data overlaps, the data
+   added last wins. */
+typedef struct hexspill {
+    ULONG	maxmem;		/* memory budget */
+    UCHAR	*pool;		/* data of the records held */
+    ULONG	poolsize, poolused;
+    void	*ent;		/* table of the records held */
+    int		*act;		/* work space for sorting them out */
+    int		nent, entalloc;
+    ULONG	seq;		/* records added so far */
+    FILE	*tmp;		/* the runs spilled so far */
+    ULONG	tmplen;
+    void	*runs;
+    int		nrun, runalloc;
+    ULONG	lo, hi;		/* data outside this range is dropped */
+    ULONG	entry;
+} HEXSPILL;
+#define SPILLMIN	65536	/* smallest memory budget */
+extern int hex_spillinit(HEXSPILL *, ULONG);
+extern void hex_spillfree(HEXSPILL *);
+extern int hex_spilladd(HEXSPILL *, ULONG, UCHAR *, ULONG);
+extern int hex_spillload(FILE *, int, int, HEXSPILL *);
+extern int hex_spillwrite(HEXSPILL *, HEXSINK *);
+
+/* ELF input (see elf.c) */
+typedef struct hexelf {
+    UCHAR	*img;		/* the whole file */
+    ULONG	size;
+    int		mapped;		/* img is mapped rather than allocated */
+    void	*loads;		/* loadable segments, sorted by address */
+    int		nload;
+    ULONG	entry;		/* entry address */
+    ULONG	minaddr;	/* lowest address loaded */
+    ULONG	maxaddr;	/* highest address loaded */
+} HEXELF;
+extern int hex_iself(UCHAR *, int);
+extern FILE *hex_elfpeek(FILE *, int *);
+extern int hex_elfopen(FILE *, HEXELF *);
+extern int hex_elfwrite(HEXELF *, HEXSINK *);
+extern void hex_elfclose(HEXELF *);
+
+/* checksum repair (see fixsum.c). The report function, if any, is
+   called with arg, the line number, and the checksum found and the
+   one it should be, or -1 and -1 for a record that is malformed. */
+typedef void HEXFIXFUNC(void *, ULONG, int, int);
+typedef struct hexfix {
+    ULONG	records;	/* records looked at */
+    ULONG	fixed;		/* checksums rewritten */
+    ULONG	bad;		/* malformed records, left alone */
+    HEXFIXFUNC	*report;
+    void	*arg;
+} HEXFIX;
+typedef int FIXHEXFUNC(UCHAR *, ULONG, HEXFIX *);
+extern int hex_fixsums(char *, int *, HEXFIX *);
+
+/* record tables (see table.c). Each field of the records is kept in
+   an array of its own, so that sorting, merging and searching by
+   address only touch the addresses and lengths. The data of all rows
+   is in one arena, at off[i]. */
+#define TAB_DATA	0	/* data record */
+#define TAB_ADDR	1	/* sets the upper bits of the address */
+#define TAB_START	2	/* start (entry) address */
+#define TAB_END		3	/* end of file */
+typedef struct hextable {
+    ULONG	n, alloc;	/* rows used, and allocated */
+    ULONG	*addr;		/* address of the first byte, or the
+				   address an address or start record sets */
+    ULONG	*len;		/* bytes of data */
+    UCHAR	*type;		/* TAB_DATA ... TAB_END */
+    ULONG	*src;		/* file offset of the record, or -1 */
+    ULONG	*off;		/* offset of the data in arena */
+    UCHAR	*arena;
+    ULONG	arenalen, arenaalloc;
+    ULONG	maxlen;		/* longest data row */
+    int		sorted;		/* data rows only, ascending */
+    ULONG	entry;
+} HEXTABLE;
+typedef void HEXTABFUNC(void *, ULONG, ULONG);
+typedef int TABHEXFUNC(FILE *, int, HEXTABLE *);
+extern void hex_tabinit(HEXTABLE *);
+extern void hex_tabfree(HEXTABLE *);
+extern int hex_tabadd(HEXTABLE *, int, ULONG, UCHAR *, ULONG, ULONG);
+extern int hex_tabload(FILE *, int, int, HEXTABLE *);
+extern int hex_tabmerge(HEXTABLE *, HEXTABLE *);
+extern int hex_tabsort(HEXTABLE *);
+extern ULONG hex_taboverlap(HEXTABLE *, HEXTABFUNC *, void *);
+extern int hex_tabrange(HEXTABLE *, ULONG, ULONG, ULONG *, ULONG *);
+extern int hex_tabblock(HEXTABLE *, HEXTABLE *, ULONG);
+extern int hex_tabwrite(HEXTABLE *, HEXSINK *);
+
+/* conversion planning (see plan.c). hex_planinit() fills in what is
+   known about the files and the machine; hex_plan() picks the
+   strategy. */
+#define PLAN_DENSE	0	/* rd_hex(), two passes into one buffer */
+#define PLAN_SPILL	1	/* push parse into a HEXSPILL */
+#define PLAN_STREAM	2	/* push parse straight to the output */
+typedef struct hexplan {
+    /* what the plan is made from */
+    int		format;
+    ULONG	insize;		/* bytes of input, 0 if not known */
+    int		inseek;		/* input can be rewound */
+    int		outseek;	/* output is a regular file */
+    int		ncpu;
+    ULONG	budget;		/* memory the conversion may use */
+    int		ratio;		/* percent of the first block that is data */
+    int		density;	/* percent of its address span with data */
+    ULONG	estdata;	/* estimated bytes of data, 0 if not known */
+    int		stream;		/* streaming was asked for */
+
+    /* the plan */
+    int		how;		/* PLAN_DENSE, PLAN_SPILL or PLAN_STREAM */
+    ULONG	maxmem;		/* spill budget (for a stream, if it
+				   falls back) */
+    int		pipelined;	/* use the I/O threads */
+    int		spool;		/* copy the input to a file first */
+} HEXPLAN;
+extern void hex_planinit(HEXPLAN *, int, int, int);
+extern void hex_plan(HEXPLAN *, int, UCHAR *, int);
+extern void hex_planprint(HEXPLAN *, FILE *);
 
 /* array of structures that point to conversion functions */
 typedef struct convstruct {
@@ -41,6 +332,15 @@ typedef struct convstruct {
     char	*magic;
     int		magic_len;
     int		magic_offset;
+    SNIFFHEXFUNC *sniff_hex;
+    LDHEXFUNC	*ld_hex;
+    PUTHEXFUNC	*put_hex;
+    ENDHEXFUNC	*end_hex;
+    IXHEXFUNC	*ix_hex;
+    LDIXHEXFUNC	*ldix_hex;
+    PUSHHEXFUNC	*push_hex;
+    FIXHEXFUNC	*fix_hex;
+    TABHEXFUNC	*tab_hex;
 } CONVSTRUCT;
 extern CONVSTRUCT converters[];
 
@@ -50,7 +350,7 @@ extern CONVSTRUCT converters[];
 #define MAXADDR_INTEL32		0xffffffff
 
 /* error codes */
-extern int hex_errno;
+extern __thread int hex_errno;
 extern const int hex_nerr;
 extern const char *hex_errlist[];
 extern void hex_perror(char *);
@@ -61,6 +361,12 @@ extern void hex_perror(char *);
 #define H_ERR_RECTYPE	4	/* unknown record type */
 #define H_ERR_BADSUM	5	/* bad checksum */
 #define H_ERR_ENTRY	6	/* entry address too large for field */
+#define H_ERR_DIGEST	7	/* invalid digest or stamp request */
+#define H_ERR_OVERLAP	8	/* overlapping data */
+#define H_ERR_NOINDEX	9	/* bad index, or format can't be indexed */
+#define H_ERR_UNSUP	10	/* not supported by the format */
+#define H_ERR_ORDER	11	/* addresses out of order */
+#define H_ERR_XFORM	12	/* invalid transform */
 #define ERR(a) hex_errno=(a); return hex_errno
 
 /* hex conversion macros */
@@ -75,11 +381,114 @@ extern char _nybble2hex_[];	/* lookup table used by macros */
 /* misc prototypes */
 extern int fcat(FILE *, FILE *);
 
+/* format detection from the first block of a file */
+#define SNIFFBUFLEN	4096	/* bytes looked at by hex_detect() */
+extern int hex_detect(UCHAR *, int);
+extern FILE *hex_fpeek(FILE *, UCHAR *, int *);
+extern FILE *hex_fopen(char *, int *);
+extern FILE *hex_memfopen(UCHAR *, ULONG, int *);
+
+/* compressed streams (see hexio.c) */
+extern int hex_zmethod(char *, int);
+extern FILE *hex_zfopen(FILE *);
+extern FILE *hex_zfwrite(FILE *, int, int);
+
+/* batched reads of many files, through io_uring where the kernel has
+   it (see uring.c). The callback takes arg, the file's index, and its
+   data and length (NULL, with errno set, on failure). */
+#define HEXRDDEPTH	32	/* default files in flight */
+typedef int HEXFILEFUNC(void *, int, UCHAR *, ULONG);
+extern int hex_readfiles(char **, int, int, HEXFILEFUNC *, void *);
+extern int hex_uringok(void);
+
+/* pipelined streams, read or written by another thread (see pipe.c) */
+extern FILE *hex_pipein(FILE *);
+extern FILE *hex_pipeout(FILE *);
+
+/* sealed shared memory output, handed to another process (see
+   memfd.c) */
+extern FILE *hex_shmopen(char *, int *);
+extern int hex_shmseal(int, ULONG *);
+extern int hex_shmsend(int, char *, char *);
+extern int hex_shmshow(int, FILE *, char *);
+extern int hex_shmpipe(FILE *);
+
+/* fill value for unused addresses in binary images */
+extern int hex_fill;
+
+/* image digests, computed while converting (see digest.c) */
+#define DG_SUM8		0x01	/* 8 bit sum of bytes */
+#define DG_SUM16	0x02	/* 16 bit sum of bytes */
+#define DG_CRC32	0x04	/* IEEE 802.3 CRC-32 */
+#define DG_SHA256	0x08	/* SHA-256 */
+#define DG_ALL		(DG_SUM16 | DG_CRC32 | DG_SHA256)
+
+typedef struct hexdigest {
+    int		algs;		/* DG_* flags of digests to compute */
+    int		window;		/* TRUE if start and end were given */
+    ULONG	start, end;	/* summed address range (inclusive) */
+    int		fill;		/* value of unused addresses in window */
+    int		stamp;		/* DG_* flag of stamped value, or 0 */
+    int		stamplen;	/* bytes in stamped value */
+    ULONG	stampaddr;	/* where to stamp it */
+    int		stampbe;	/* stamp big endian */
+    ULONG	stamped;	/* number of stamp bytes written */
+    int		stampbad;	/* the data started at or above the stamp,
+				   so it was not written */
+
+    /* results, valid after hex_dgfinal() */
+    ULONG	sum8, sum16, crc32;
+    UCHAR	sha256[32];
+
+    /* private state */
+    int		started, done, unordered;
+    ULONG	next;
+    ULONG	sum;
+    unsigned int crc;
+    unsigned int sha[8];
+    UCHAR	shabuf[64];
+    int		shafill;
+    ULONG	shalen;
+    UCHAR	stampval[32];
+} HEXDIGEST;
+extern HEXDIGEST *hex_digest;	/* if set, converters update it */
+extern void hex_dginit(HEXDIGEST *, int);
+extern int hex_dgalg(char *);
+extern int hex_dgstamp(HEXDIGEST *, int, ULONG, int);
+extern void hex_dgblock(HEXDIGEST *, ULONG, UCHAR *, ULONG);
+extern void hex_dgfinal(HEXDIGEST *);
+extern void hex_dgprint(HEXDIGEST *, FILE *);
+
+/* streaming decode (see stream.c). Binary is written as each record
+   is decoded, for as long as the addresses ascend; a record that goes
+   back is an error if strict is set, and otherwise the output is taken
+   back into a HEXSPILL and written again at the end, if it is a file
+   that can be read back. */
+typedef struct hexstream {
+    FILE	*out;
+    int		fd;		/* out, if it can be read back, or -1 */
+    ULONG	start;		/* offset in fd where the output starts */
+    int		strict;		/* fail rather than fall back */
+    ULONG	maxmem;		/* memory budget for the spill */
+    HEXSINK	sink;		/* raw binary, while addresses ascend */
+    HEXDIGEST	dgsave;		/* hex_digest as it was at the start */
+    int		started;
+    ULONG	next;		/* address after the last data written */
+    ULONG	backaddr;	/* first address that went back */
+    int		spilled;	/* TRUE once it has fallen back */
+    HEXSPILL	spill;
+    ULONG	base, entry;
+} HEXSTREAM;
+extern void hex_streaminit(HEXSTREAM *, FILE *, int, ULONG);
+extern void hex_streamfree(HEXSTREAM *);
+extern int hex_streamload(FILE *, int, int, HEXSTREAM *);
+
 /* Offsets into converters[] for supported formats */
 #define FMT_INTEL	0
 #define FMT_INTEL86	1
 #define FMT_INTEL32	2
 #define FMT_UNDEF	3	/* undefined! */
+#define FMT_BINARY	(-1)	/* raw binary, where a sink takes a format */
 #define FMT_DEFAULT	FMT_INTEL
 
 /* external refs for function converters */
@@ -88,5 +497,14 @@ extern WRHEXFUNC	wr_intel86;
 extern WRHEXFUNC	wr_intel32;
 extern RDHEXFUNC	rd_intel;
 extern SCANHEXFUNC	scan_intel;
+extern SNIFFHEXFUNC	sniff_intel;
+extern LDHEXFUNC	ld_intel;
+extern PUTHEXFUNC	put_intel;
+extern ENDHEXFUNC	end_intel;
+extern IXHEXFUNC	ix_intel;
+extern LDIXHEXFUNC	ldix_intel;
+extern PUSHHEXFUNC	push_intel;
+extern FIXHEXFUNC	fix_intel;
+extern TABHEXFUNC	tab_intel;
 
 #endif /* __hex_h */
@@ -0,0 +1,407 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* hexbench: time the inner loops of the converters on their own, on
+   warm data, for a range of record lengths and buffer sizes. Built and
+   run by "make bench"; not installed.
+
+   Each kernel is run over a buffer in pieces of one record's worth of
+   data, as the converters call it, until at least the minimum time has
+   passed, and the best of several such runs is reported as ns/byte of
+   binary data. Where perf_event_open() is allowed, cycles,
+   instructions and cache misses over all the runs are reported too.
+   Each implementation of a kernel gets its own line, so that they can
+   be compared: the loops as the converters had them inline, and the
+   library's kernels at each level of hex_cpuset() this CPU can run. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include "etools.h"
+#include "hex.h"
+
+#define RUNS		5		/* timed runs, best one reported */
+#define MINTIME		20000000.0	/* ns per timed run, at least */
+
+typedef void BENCHFUNC(UCHAR *, UCHAR *, ULONG);
+
+typedef struct bench {
+    char	*kernel;
+    char	*impl;
+    BENCHFUNC	*func;
+    int		perrec;		/* called per record, not per buffer */
+    int		hexin;		/* takes hex characters as input */
+    int		levels;		/* run at each level of hex_cpuset() */
+} BENCH;
+
+static int	reclens[] = {16, 32, 64, 255, 0};
+static ULONG	bufsizes[] = {4096, 65536, 1048576, 16777216, 0};
+
+
+/*---------------------------------------------------------------*/
+/* the kernels, written as the converters have them */
+
+/* hex pairs to bytes, as decrec_intel() */
+static void dec_table(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len; i++)
+	dst[i] = H2C(&src[i << 1]);
+}
+
+/* bytes to hex pairs, as wrrec_intel() */
+static void enc_table(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len; i++) {
+	dst[i << 1]       = C2H_H(src[i]);
+	dst[(i << 1) + 1] = C2H_L(src[i]);
+    }
+}
+
+/* 8 bit record checksum */
+static void sum_scalar(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    UCHAR	sum = 0;
+    ULONG	i;
+
+    for(i=0; i < len; i++)
+	sum += src[i];
+    dst[0] = sum;
+}
+
+/* decode and checksum in one loop, as sniff_intel() */
+static void decsum_table(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    UCHAR	sum = 0;
+    ULONG	i;
+
+    for(i=0; i < len; i++)
+	sum += (dst[i] = H2C(&src[i << 1]));
+    dst[len] = sum;
+}
+
+/* check a record's characters are hex digits, as fix_intel() */
+static void xspan_ctype(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len << 1 && isxdigit(src[i]); i++)
+	;
+    memcpy(dst, &i, sizeof(i));
+}
+
+/* length of a run of blank bytes, as the -k filter looks for */
+static void blank_scalar(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len && src[i] == 0xff; i++)
+	;
+    memcpy(dst, &i, sizeof(i));
+}
+
+/* bytes that are blank, as blankcheck counts them */
+static void count_scalar(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i, n = 0;
+
+    for(i=0; i < len; i++)
+	n += src[i] == 0xff;
+    memcpy(dst, &n, sizeof(n));
+}
+
+/* the library's kernels */
+static void dec_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    hex_decode(dst, src, len);
+}
+
+static void enc_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    hex_encode(dst, src, len);
+}
+
+static void sum_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    dst[0] = hex_sum8(src, len);
+}
+
+static void decsum_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    hex_decode(dst, src, len);
+    dst[len] = hex_sum8(dst, len);
+}
+
+static void xspan_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i = hex_xspan(src, len << 1);
+
+    memcpy(dst, &i, sizeof(i));
+}
+
+static void blank_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	i = hex_memnotc(src, 0xff, len);
+
+    memcpy(dst, &i, sizeof(i));
+}
+
+static void count_lib(UCHAR *dst, UCHAR *src, ULONG len)
+{
+    ULONG	n = hex_memcount(src, 0xff, len);
+
+    memcpy(dst, &n, sizeof(n));
+}
+
+static BENCH benches[] = {
+    {"decode",	"inline",	dec_table,	TRUE,	TRUE,	FALSE},
+    {"decode",	NULL,		dec_lib,	TRUE,	TRUE,	TRUE},
+    {"encode",	"inline",	enc_table,	TRUE,	FALSE,	FALSE},
+    {"encode",	NULL,		enc_lib,	TRUE,	FALSE,	TRUE},
+    {"sum8",	"inline",	sum_scalar,	TRUE,	FALSE,	FALSE},
+    {"sum8",	NULL,		sum_lib,	TRUE,	FALSE,	TRUE},
+    {"decsum",	"inline",	decsum_table,	TRUE,	TRUE,	FALSE},
+    {"decsum",	NULL,		decsum_lib,	TRUE,	TRUE,	TRUE},
+    {"xspan",	"inline",	xspan_ctype,	TRUE,	TRUE,	FALSE},
+    {"xspan",	NULL,		xspan_lib,	TRUE,	TRUE,	TRUE},
+    {"blank",	"inline",	blank_scalar,	FALSE,	FALSE,	FALSE},
+    {"blank",	NULL,		blank_lib,	FALSE,	FALSE,	TRUE},
+    {"count",	"inline",	count_scalar,	FALSE,	FALSE,	FALSE},
+    {"count",	NULL,		count_lib,	FALSE,	FALSE,	TRUE},
+    {NULL,	NULL,		NULL,		FALSE,	FALSE,	FALSE}
+};
+
+
+/*---------------------------------------------------------------*/
+/* hardware counters, as one group so they cover the same time */
+
+#define NCOUNTERS	3
+
+static int	perffd[NCOUNTERS] = {-1, -1, -1};
+static struct {
+    unsigned long long	nr;
+    unsigned long long	val[NCOUNTERS];
+} perfbuf;
+
+static int perf_open(unsigned long long config, int group)
+{
+    struct perf_event_attr	a;
+
+    memset(&a, 0, sizeof(a));
+    a.type = PERF_TYPE_HARDWARE;
+    a.size = sizeof(a);
+    a.config = config;
+    a.disabled = (group < 0);
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &a, 0, -1, group, 0);
+}
+
+/* TRUE if the counters could be opened */
+static int perf_init(void)
+{
+    static unsigned long long config[NCOUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES
+    };
+    int		i;
+
+    for(i=0; i < NCOUNTERS; i++) {
+	if((perffd[i] = perf_open(config[i], perffd[0])) < 0) {
+	    while(i--)
+		close(perffd[i]);
+	    perffd[0] = -1;
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+static void perf_start(void)
+{
+    if(perffd[0] < 0)
+	return;
+    ioctl(perffd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perffd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* FALSE if there are no counts */
+static int perf_stop(void)
+{
+    if(perffd[0] < 0)
+	return FALSE;
+    ioctl(perffd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    return read(perffd[0], &perfbuf, sizeof(perfbuf)) == sizeof(perfbuf) &&
+	perfbuf.nr == NCOUNTERS;
+}
+
+
+/*---------------------------------------------------------------*/
+static double now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* one pass of b over size bytes of data in reclen pieces */
+static void pass(BENCH *b, UCHAR *dst, UCHAR *src, ULONG size, int reclen)
+{
+    ULONG	i, n;
+
+    if(!b->perrec) {
+	b->func(dst, src, size);
+	return;
+    }
+    for(i=0; i < size; i += n) {
+	n = MIN((ULONG)reclen, size - i);
+	/* hex input and output take two characters per byte */
+	b->func(b->hexin ? dst + i : dst + (i << 1),
+		b->hexin ? src + (i << 1) : src + i, n);
+    }
+}
+
+static void run(BENCH *b, char *impl, UCHAR *dst, UCHAR *src, ULONG size,
+		int reclen)
+{
+    double	t, best = 0, bytes = 0;
+    long	reps, r;
+    int		i, counted;
+
+    /* warm up, and find how many passes fill the minimum time */
+    pass(b, dst, src, size, reclen);
+    for(reps = 1; ; reps <<= 1) {
+	t = now();
+	for(r=0; r < reps; r++)
+	    pass(b, dst, src, size, reclen);
+	if(now() - t >= MINTIME / 4)
+	    break;
+    }
+    reps = MAX(1, (long)(reps * MINTIME / (now() - t + 1)));
+
+    perf_start();
+    for(i=0; i < RUNS; i++) {
+	t = now();
+	for(r=0; r < reps; r++)
+	    pass(b, dst, src, size, reclen);
+	t = (now() - t) / ((double)reps * size);
+	if(!i || t < best)
+	    best = t;
+	bytes += (double)reps * size;
+    }
+    counted = perf_stop();
+
+    printf("%-8s %-8s ", b->kernel, impl);
+    if(b->perrec)
+	printf("%6d ", reclen);
+    else
+	printf("%6s ", "-");
+    printf("%9lu %9.3f", size, best);
+    if(counted)
+	printf(" %9.3f %9.3f %9.3f\n", perfbuf.val[0] / bytes,
+	       perfbuf.val[1] / bytes, perfbuf.val[2] * 1024.0 / bytes);
+    else
+	printf(" %9s %9s %9s\n", "-", "-", "-");
+    fflush(stdout);
+}
+
+
+/*---------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    UCHAR	*src, *dst;
+    char	*only = NULL;
+    ULONG	maxsize = 0, i;
+    int		j, k;
+    BENCH	*b;
+    char	*impl;
+    int		l;
+
+    if(argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+	fprintf(stderr,"Usage:  hexbench [{kernel}]\n\n    kernels:");
+	for(b = benches; b->kernel; b++)
+	    if(b == benches || strcmp(b->kernel, b[-1].kernel))
+		fprintf(stderr," %s", b->kernel);
+	fprintf(stderr,"\n");
+	exit(1);
+    }
+    if(argc == 2)
+	only = argv[1];
+
+    for(j=0; bufsizes[j]; j++)
+	maxsize = MAX(maxsize, bufsizes[j]);
+
+    /* hex characters in, or random bytes; the blank scan runs over
+       an all-blank buffer so that it reads the whole of it */
+    if(!(src = malloc(2 * maxsize + 256)) || !(dst = malloc(2 * maxsize + 256))) {
+	perror("hexbench");
+	exit(1);
+    }
+    srand(1);
+    for(i=0; i < 2 * maxsize; i++)
+	src[i] = "0123456789ABCDEF"[rand() & 0xf];
+
+    if(!perf_init())
+	fprintf(stderr,"(no hardware counters: perf_event_open() "
+		"is not allowed here)\n");
+
+    printf("%-8s %-8s %6s %9s %9s %9s %9s %9s\n", "kernel", "impl",
+	   "reclen", "bufsize", "ns/byte", "cyc/byte", "ins/byte",
+	   "miss/KB");
+    for(b = benches; b->kernel; b++) {
+	if(only && strcmp(only, b->kernel))
+	    continue;
+	if(!strcmp(b->kernel, "blank"))
+	    memset(src, 0xff, maxsize);
+	for(l=0; b->levels ? !!(impl = hex_cpulevel(l)) : !l; l++) {
+	    if(!b->levels)
+		impl = b->impl;
+	    else if(!hex_cpuset(impl) || strcmp(hex_cpuname(), impl))
+		continue;	/* this CPU can't run it */
+	    for(j=0; bufsizes[j]; j++) {
+		for(k=0; reclens[k]; k++) {
+		    run(b, impl, dst, src, bufsizes[j], reclens[k]);
+		    if(!b->perrec)
+			break;
+		}
+	    }
+	}
+	if(!strcmp(b->kernel, "blank"))
+	    for(i=0; i < maxsize; i++)
+		src[i] = "0123456789ABCDEF"[rand() & 0xf];
+    }
+    exit(0);
+}
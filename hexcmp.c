@@ -0,0 +1,259 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* hexcmp: compare a hex file against another hex file or against a
+   raw binary dump (such as an EPROM programmer's readback), without
+   converting either of them to binary first. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+#include "tools.h"
+
+static void cmpusage(void)
+{
+    int i;
+
+    fprintf(stderr,"hexcmp %s\n", VERSION);
+    fprintf(stderr,"\nUsage:  hexcmp [-f{format}] [-i] [-r] [-b{base}] "\
+	    "[-F{fill}] [-q] [-] {file1} {file2}\n");
+    fprintf(stderr,"        hexcmp -help\n");
+    fprintf(stderr,"        hexcmp -?\n");
+    fprintf(stderr,"        hexcmp -version\n");
+    fprintf(stderr,"\n    file1 is a hex file. file2 is a hex file, or a "\
+	    "raw binary dump\n    that starts at {base} (-r forces "\
+	    "file2 to be read as raw binary;\n    -f applies to file2 only if "\
+	    "it is found to be hex). Addresses\n    present in "\
+	    "only one file are ignored, unless -F is given,\n    in "\
+	    "which case they are compared against {fill}.\n");
+    fprintf(stderr,"\n    formats supported:\n");
+    for(i=0; converters[i].name; i++) {
+	fprintf(stderr,"        %-16s %s\n", converters[i].name,
+		converters[i].desc);
+    }
+}
+
+
+/* print one range of differing addresses */
+static void cmpreport(ULONG addr, ULONG len, void *arg)
+{
+    printf("0x%08lX-0x%08lX (%lu byte%s)\n", addr, addr + len - 1,
+	   len, len == 1 ? "" : "s");
+    (*(ULONG *)arg)++;
+}
+
+
+/* load a hex file, or a raw file if raw is set or it is not a hex
+   file and rawok is set. Where a raw file is allowed, the file is
+   sniffed even if a format was given, and the format only applies if
+   it turns out to be hex. A file with no data in it is an error, so
+   that it cannot match anything. */
+static int cmpload(char *name, int format, int raw, int rawok,
+		   int ignoresum, ULONG base, int quiet, HEXIMAGE *img)
+{
+    FILE	*in;
+    int		ret, given = format;
+
+    if (raw)
+	format = FMT_DEFAULT;	/* don't sniff */
+    else if (rawok)
+	format = FMT_UNDEF;
+
+    if (!(in = hex_fopen(name, &format))) {
+	perror(name);
+	return -1;
+    }
+
+    if (format != FMT_UNDEF && !raw && given != FMT_UNDEF)
+	format = given;
+
+    if (format == FMT_UNDEF && !rawok) {
+	format = FMT_DEFAULT;
+	if (!quiet)
+	    fprintf(stderr,"(%s: unknown format, assuming %s)\n", name,
+		    converters[format].name);
+    }
+
+    if (raw || format == FMT_UNDEF) {
+	if (!quiet)
+	    fprintf(stderr,"(%s: raw binary at 0x%08lX)\n", name, base);
+	ret = hex_imgraw(in, base, img);
+    }
+    else {
+	if (!quiet)
+	    fprintf(stderr,"(%s: %s)\n", name, converters[format].name);
+	ret = converters[format].ld_hex(in, ignoresum, img);
+    }
+    fclose(in);
+
+    if (ret) {
+	hex_perror(name);
+	return -1;
+    }
+    if (!img->nseg) {
+	fprintf(stderr,"%s: no data\n", name);
+	return -1;
+    }
+    return 0;
+}
+
+
+/* exits with 0 if the files match, 1 if they differ, 2 on trouble */
+int hexcmp_main(int argc, char **argv)
+{
+    int		format = FMT_UNDEF;
+    int		i, fill = -1;
+    int		ignoresum = FALSE, argsdone = FALSE, quiet = FALSE;
+    int		raw = FALSE;
+    ULONG	base = 0, diffs, ranges = 0;
+    char	*name[2] = {NULL, NULL};
+    char	*c;
+    HEXIMAGE	img[2];
+
+    for(i=1; i<argc; i++) {
+
+	if ((argv[i][0] == '-') && !argsdone) {
+
+	    if (strlen(argv[i]) > 1) {
+
+		switch(argv[i][1]) {
+
+		  case 'i':
+		    ignoresum = TRUE;
+		    break;
+
+		  case 'r':
+		    raw = TRUE;
+		    break;
+
+		  case 'f':
+		    if ((format = getformat(argv[i]+2)) == FMT_UNDEF) {
+			fprintf(stderr,
+				"Error: Unknown format \"%s\"\n",argv[i]);
+			cmpusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'b':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			base=(ULONG)strtoul(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0') {
+			fprintf(stderr,"Error: invalid base address\n");
+			cmpusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'F':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			fill=(int)strtol(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0' || fill < 0 || fill > 0xff) {
+			fprintf(stderr,"Error: invalid fill value\n");
+			cmpusage();
+			return 2;
+		    }
+		    break;
+
+		  case 'h':
+		  case '?':
+		    cmpusage();
+		    return 0;
+
+		  case 'v':
+		    fprintf(stderr,"hexcmp %s\n", VERSION);
+		    return 0;
+
+		  case 'q':
+		    quiet = TRUE;
+		    break;
+
+		  default:
+		    fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+		    cmpusage();
+		    return 2;
+		}
+	    }
+
+	    else {
+		/* "-" ends the flags */
+		argsdone = TRUE;
+	    }
+	}
+
+	else if (!name[0])
+	    name[0] = argv[i];
+
+	else if (!name[1])
+	    name[1] = argv[i];
+
+	else {
+	    fprintf(stderr,"Error: too many arguments\n");
+	    cmpusage();
+	    return 2;
+	}
+    }
+
+    if (!name[1]) {
+	fprintf(stderr,"Error: two files are needed\n");
+	cmpusage();
+	return 2;
+    }
+
+    hex_imginit(&img[0]);
+    hex_imginit(&img[1]);
+    if (cmpload(name[0], format, FALSE, FALSE, ignoresum, base, quiet,
+		&img[0]) ||
+	cmpload(name[1], format, raw, TRUE, ignoresum, base, quiet,
+		&img[1]))
+	return 2;
+
+    diffs = hex_imgcmp(&img[0], &img[1], fill, cmpreport, &ranges);
+    if (diffs == (ULONG)-1) {
+	hex_perror("Error comparing images");
+	return 2;
+    }
+
+    fflush(stdout);
+    if (!quiet) {
+	if (diffs)
+	    fprintf(stderr,"%s %s differ: %lu byte%s in %lu range%s\n",
+		    name[0], name[1], diffs, diffs == 1 ? "" : "s",
+		    ranges, ranges == 1 ? "" : "s");
+	else
+	    fprintf(stderr,"%s %s match\n", name[0], name[1]);
+    }
+
+    hex_imgfree(&img[0]);
+    hex_imgfree(&img[1]);
+    return diffs ? 1 : 0;
+}
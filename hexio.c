@@ -0,0 +1,543 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Stream helpers. These wrap a FILE in another FILE (using the GNU
+ * fopencookie() interface), so that the converters in converters[]
+ * can keep reading and writing plain stdio streams.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "etools.h"
+#include "hex.h"
+
+
+/*---------------------------------------------------------------*/
+/* peek stream: replays a block that was already read from the
+   underlying stream, then continues reading from it */
+
+typedef struct peekcookie {
+    FILE	*in;
+    UCHAR	buf[SNIFFBUFLEN];
+    int		len;		/* bytes in buf */
+    off_t	pos;		/* current position in the stream */
+} PEEKCOOKIE;
+
+static ssize_t peek_read(void *cookie, char *buf, size_t size)
+{
+    PEEKCOOKIE	*pc = cookie;
+    size_t	n;
+
+    if(pc->pos < pc->len) {
+	n = MIN(size, (size_t)(pc->len - pc->pos));
+	memcpy(buf, pc->buf + pc->pos, n);
+    }
+    else {
+	n = fread(buf, 1, size, pc->in);
+	if(n == 0 && ferror(pc->in))
+	    return -1;
+    }
+    pc->pos += n;
+    return n;
+}
+
+static int peek_seek(void *cookie, off64_t *offset, int whence)
+{
+    PEEKCOOKIE	*pc = cookie;
+    off_t	target;
+
+    switch(whence) {
+      case SEEK_SET:	target = *offset;		break;
+      case SEEK_CUR:	target = pc->pos + *offset;	break;
+      default:
+	/* SEEK_END needs a seekable underlying stream */
+	if(fseeko(pc->in, *offset, SEEK_END))
+	    return -1;
+	target = ftello(pc->in);
+	break;
+    }
+    if(target < 0)
+	return -1;
+
+    /* the underlying stream sits at MAX(pos, len); move it to
+       MAX(target, len), which fails if it is not seekable */
+    if(MAX(target, pc->len) != MAX(pc->pos, pc->len) &&
+       fseeko(pc->in, MAX(target, pc->len), SEEK_SET))
+	return -1;
+    pc->pos = target;
+    *offset = target;
+    return 0;
+}
+
+static int peek_close(void *cookie)
+{
+    PEEKCOOKIE	*pc = cookie;
+    int		ret;
+
+    ret = fclose(pc->in);
+    free(pc);
+    return ret;
+}
+
+/* Read the first block of in into buf (at most SNIFFBUFLEN bytes,
+   *len is set to the number read), and return a stream that delivers
+   the whole of in, starting with that block. This lets the caller
+   look at the start of a pipe without spooling it. Closing the
+   returned stream closes in. Returns NULL and sets hex_errno on
+   failure. */
+FILE *hex_fpeek(FILE *in, UCHAR *buf, int *len)
+{
+    static cookie_io_functions_t peekfuncs = {
+	peek_read, NULL, peek_seek, peek_close
+    };
+    PEEKCOOKIE	*pc;
+    FILE	*f;
+
+    if(!(pc = malloc(sizeof(*pc)))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    pc->in = in;
+    pc->pos = 0;
+    pc->len = fread(pc->buf, 1, SNIFFBUFLEN, in);
+    if(ferror(in) || !(f = fopencookie(pc, "r", peekfuncs))) {
+	free(pc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    memcpy(buf, pc->buf, pc->len);
+    *len = pc->len;
+    return f;
+}
+
+
+/*---------------------------------------------------------------*/
+/* decompress in if need be and identify its format, as below */
+static FILE *zdetect(FILE *in, int *format, int closeit)
+{
+    UCHAR	buf[SNIFFBUFLEN];
+    FILE	*f;
+    int		len;
+
+    if(!(in = hex_zfopen(in)))
+	return NULL;
+    if(*format != FMT_UNDEF)
+	return in;
+    if(!(f = hex_fpeek(in, buf, &len))) {
+	if(closeit)
+	    fclose(in);
+	return NULL;
+    }
+    *format = hex_detect(buf, len);
+    return f;
+}
+
+/* Open a file for reading (stdin if name is NULL), decompressing it
+   if necessary, and, if *format is FMT_UNDEF, identify its format from
+   the first block. *format stays FMT_UNDEF if the file is not in any
+   format in converters[]. Returns NULL with errno or hex_errno set on
+   failure. */
+FILE *hex_fopen(char *name, int *format)
+{
+    FILE	*in;
+
+    if(!(in = name ? fopen(name, "r") : stdin))
+	return NULL;
+    return zdetect(in, format, name != NULL);
+}
+
+/* The same, for a file that has already been read into memory (see
+   hex_readfiles()). The data must stay put until the stream is
+   closed. */
+FILE *hex_memfopen(UCHAR *data, ULONG len, int *format)
+{
+    static UCHAR empty[1];
+    FILE	*in;
+
+    if(!(in = fmemopen(len ? data : empty, len, "r"))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return zdetect(in, format, TRUE);
+}
+
+
+/*---------------------------------------------------------------*/
+/* compressed streams: the compressor or decompressor is an external
+   program running in a child process and connected through a pipe,
+   so compressed files never pass through a temporary file */
+
+#define ZMAXARGS	8	/* arguments in a (de)compressor command */
+
+typedef struct zformat {
+    char	*name;
+    char	*suffix;
+    UCHAR	magic[6];
+    int		magic_len;
+    char	*dec[3];	/* decompressors, tried in order */
+    char	*enc[3];	/* compressors; %t is the thread count */
+} ZFORMAT;
+
+static const ZFORMAT zformats[] = {
+    {"gzip", ".gz", {0x1f, 0x8b}, 2,
+	 {"gzip -dc", NULL}, {"pigz -c -p %t", "gzip -c", NULL}},
+    {"zstd", ".zst", {0x28, 0xb5, 0x2f, 0xfd}, 4,
+	 {"zstd -dcq", NULL}, {"zstd -cq -T%t", NULL}},
+    {"xz", ".xz", {0xfd, '7', 'z', 'X', 'Z', 0}, 6,
+	 {"xz -dc", NULL}, {"xz -c -T%t", NULL}},
+    {"bzip2", ".bz2", {'B', 'Z', 'h'}, 3,
+	 {"bzip2 -dc", NULL}, {"lbzip2 -c -n %t", "bzip2 -c", NULL}},
+    {NULL, NULL, {0}, 0, {NULL}, {NULL}}
+};
+
+typedef struct zcookie {
+    const ZFORMAT *z;
+    FILE	*src;		/* compressed input that must be fed */
+    int		srcfd;		/* seekable compressed input, or -1 */
+    int		fd;		/* our end of the pipe */
+    pid_t	pid;		/* the (de)compressor */
+    pid_t	feeder;		/* process copying src to the pipe */
+    off_t	pos;		/* uncompressed position */
+} ZCOOKIE;
+
+/* Run the first command in cmds that can be executed, with its stdin
+   and stdout connected to infd and outfd. */
+static pid_t zspawn(char * const *cmds, int threads, int infd, int outfd)
+{
+    char	cmd[64], nthreads[16], *argv[ZMAXARGS+1];
+    pid_t	pid;
+    int		i, j;
+
+    if((pid = fork()) != 0)
+	return pid;
+
+    /* child */
+    if((infd != 0 && dup2(infd, 0) < 0) || (outfd != 1 && dup2(outfd, 1) < 0))
+	_exit(127);
+    sprintf(nthreads, "%d", threads);
+    for(i=0; cmds[i]; i++) {
+	strncpy(cmd, cmds[i], sizeof(cmd)-1);
+	cmd[sizeof(cmd)-1] = '\0';
+	for(j=0, argv[0]=strtok(cmd," "); argv[j] && j < ZMAXARGS; )
+	    argv[++j] = strtok(NULL," ");
+	argv[j] = NULL;
+	for(j=0; argv[j]; j++) {
+	    if(strstr(argv[j], "%t")) {
+		/* "-T%t" style arguments: replace the %t */
+		static char targ[32];
+		snprintf(targ, sizeof(targ), "%.*s%s",
+			 (int)(strstr(argv[j], "%t") - argv[j]), argv[j],
+			 nthreads);
+		argv[j] = targ;
+	    }
+	}
+	execvp(argv[0], argv);
+    }
+    fprintf(stderr, "Error: cannot run %s\n", cmds[0]);
+    _exit(127);
+}
+
+/* wait for the child processes, returns 0 if they all succeeded */
+static int zreap(ZCOOKIE *zc)
+{
+    int		status, ret = 0;
+
+    if(zc->feeder > 0) {
+	waitpid(zc->feeder, &status, 0);
+	zc->feeder = 0;
+    }
+    if(zc->pid > 0) {
+	if(waitpid(zc->pid, &status, 0) < 0 ||
+	   !WIFEXITED(status) || WEXITSTATUS(status))
+	    ret = -1;
+	zc->pid = 0;
+    }
+    return ret;
+}
+
+/* start the decompressor, fed from srcfd or (through a feeder
+   process) from src */
+static int zstart(ZCOOKIE *zc)
+{
+    UCHAR	buf[SNIFFBUFLEN];
+    size_t	n;
+    int		p[2], q[2];
+
+    if(pipe2(p, O_CLOEXEC))
+	return -1;
+
+    if(zc->srcfd >= 0) {
+	if(lseek(zc->srcfd, 0, SEEK_SET) < 0) {
+	    close(p[0]);
+	    close(p[1]);
+	    return -1;
+	}
+	zc->pid = zspawn(zc->z->dec, 1, zc->srcfd, p[1]);
+    }
+    else {
+	if(pipe2(q, O_CLOEXEC)) {
+	    close(p[0]);
+	    close(p[1]);
+	    return -1;
+	}
+	if((zc->feeder = fork()) == 0) {
+	    close(p[0]);
+	    close(p[1]);
+	    close(q[0]);
+	    while((n = fread(buf, 1, sizeof(buf), zc->src)) > 0)
+		if(write(q[1], buf, n) != (ssize_t)n)
+		    _exit(1);
+	    _exit(ferror(zc->src) ? 1 : 0);
+	}
+	zc->pid = zspawn(zc->z->dec, 1, q[0], p[1]);
+	close(q[0]);
+	close(q[1]);
+    }
+    close(p[1]);
+    if(zc->pid < 0 || zc->feeder < 0) {
+	close(p[0]);
+	zreap(zc);
+	return -1;
+    }
+    zc->fd = p[0];
+    zc->pos = 0;
+    return 0;
+}
+
+static ssize_t zread(void *cookie, char *buf, size_t size)
+{
+    ZCOOKIE	*zc = cookie;
+    ssize_t	n;
+
+    while((n = read(zc->fd, buf, size)) < 0 && errno == EINTR)
+	;
+    if(n == 0 && zc->pid > 0 && zreap(zc)) {
+	errno = EIO;		/* decompressor failed */
+	return -1;
+    }
+    if(n > 0)
+	zc->pos += n;
+    return n;
+}
+
+static ssize_t zwrite(void *cookie, const char *buf, size_t size)
+{
+    ZCOOKIE	*zc = cookie;
+    size_t	done = 0;
+    ssize_t	n;
+
+    while(done < size) {
+	if((n = write(zc->fd, buf + done, size - done)) < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	done += n;
+    }
+    zc->pos += size;
+    return size;
+}
+
+/* Decompressed streams can only be read forwards, so seeking
+   backwards restarts the decompressor (if the compressed input is
+   seekable) and skips to the target. rd_hex functions only ever
+   rewind, so this costs one extra decompression, not a spool file. */
+static int zseek(void *cookie, off64_t *offset, int whence)
+{
+    ZCOOKIE	*zc = cookie;
+    char	buf[SNIFFBUFLEN];
+    off_t	target;
+    ssize_t	n;
+
+    switch(whence) {
+      case SEEK_SET:	target = *offset;		break;
+      case SEEK_CUR:	target = zc->pos + *offset;	break;
+      default:		errno = ESPIPE;			return -1;
+    }
+    if(target != zc->pos && zc->src == NULL && zc->srcfd < 0) {
+	errno = ESPIPE;		/* output stream */
+	return -1;
+    }
+    if(target < zc->pos) {
+	if(zc->srcfd < 0) {
+	    errno = ESPIPE;
+	    return -1;
+	}
+	close(zc->fd);
+	zreap(zc);
+	if(zstart(zc))
+	    return -1;
+    }
+    while(zc->pos < target) {
+	n = zread(zc, buf, MIN((off_t)sizeof(buf), target - zc->pos));
+	if(n <= 0)
+	    break;
+    }
+    *offset = zc->pos;
+    return 0;
+}
+
+static int zclose(void *cookie)
+{
+    ZCOOKIE	*zc = cookie;
+    int		ret;
+
+    /* a decompressor that is stopped early dies of SIGPIPE, which is
+       not an error; a compressor must finish cleanly */
+    close(zc->fd);
+    ret = zreap(zc);
+    if(zc->src || zc->srcfd >= 0)
+	ret = 0;
+    if(zc->srcfd >= 0)
+	close(zc->srcfd);
+    if(zc->src)
+	fclose(zc->src);
+    free(zc);
+    return ret ? EOF : 0;
+}
+
+static cookie_io_functions_t zfuncs = {
+    zread, zwrite, zseek, zclose
+};
+
+
+/*---------------------------------------------------------------*/
+/* look up a compression method by name ("gzip") or by the suffix of
+   a file name ("image.hex.gz"), returns -1 if there is none */
+int hex_zmethod(char *name, int bysuffix)
+{
+    size_t	len = strlen(name), slen;
+    int		i;
+
+    for(i=0; zformats[i].name; i++) {
+	slen = strlen(zformats[i].suffix);
+	if(bysuffix ? (len > slen &&
+		       strcmp(name + len - slen, zformats[i].suffix) == 0) :
+	   strcmp(name, zformats[i].name) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+
+/*---------------------------------------------------------------*/
+/* If in is compressed, return a stream that delivers its contents
+   uncompressed; otherwise return a stream that delivers in as it is.
+   The compression method is identified by the magic number at the
+   start of in. Returns NULL with hex_errno set on failure. */
+FILE *hex_zfopen(FILE *in)
+{
+    UCHAR	buf[SNIFFBUFLEN];
+    ZCOOKIE	*zc;
+    FILE	*peek = NULL, *f;
+    int		fd = fileno(in), len, i;
+
+    /* look at the magic number without consuming anything if the
+       input can be read at an offset, otherwise peek at it */
+    if(fd >= 0 && lseek(fd, 0, SEEK_CUR) >= 0) {
+	if((len = pread(fd, buf, sizeof(buf), 0)) < 0) {
+	    hex_errno = H_ERR_IO;
+	    return NULL;
+	}
+    }
+    else {
+	if(!(peek = hex_fpeek(in, buf, &len)))
+	    return NULL;
+	fd = -1;
+    }
+
+    for(i=0; zformats[i].name; i++)
+	if(len >= zformats[i].magic_len &&
+	   memcmp(buf, zformats[i].magic, zformats[i].magic_len) == 0)
+	    break;
+    if(!zformats[i].name)
+	return peek ? peek : in;
+
+    if(!(zc = calloc(1, sizeof(*zc)))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    zc->z = &zformats[i];
+    zc->srcfd = -1;
+    if(fd >= 0) {
+	zc->srcfd = dup(fd);
+	fclose(in);
+    }
+    else
+	zc->src = peek;
+
+    fflush(stdout);		/* don't let the children repeat output */
+    fflush(stderr);
+    if(zstart(zc) || !(f = fopencookie(zc, "r", zfuncs))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return f;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Return a stream that compresses everything written to it with the
+   given method (see hex_zmethod()) into out, using up to threads
+   threads if the compressor supports them (0 means one per CPU).
+   fclose() on the stream waits for the compressor to finish. */
+FILE *hex_zfwrite(FILE *out, int method, int threads)
+{
+    ZCOOKIE	*zc;
+    FILE	*f;
+    int		p[2], outfd;
+
+    if(threads <= 0)
+	threads = MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    fflush(out);
+    fflush(stderr);
+    if(!(zc = calloc(1, sizeof(*zc))) || pipe2(p, O_CLOEXEC)) {
+	free(zc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    zc->z = &zformats[method];
+    zc->srcfd = -1;
+    outfd = fileno(out);
+    zc->pid = zspawn(zc->z->enc, threads, p[0], outfd);
+    close(p[0]);
+    if(zc->pid < 0 || !(f = fopencookie(zc, "w", zfuncs))) {
+	close(p[1]);
+	zreap(zc);
+	free(zc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    zc->fd = p[1];
+    fclose(out);		/* the compressor has its own descriptor */
+    return f;
+}
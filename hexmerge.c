@@ -0,0 +1,345 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* hexmerge: merge several hex files, each optionally moved to another
+   address, into one hex file. Overlapping data is reported, and either
+   rejected or resolved in favour of the first or last file given. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+#include "tools.h"
+
+static char *policies[] = {"last", "first", "error", NULL};
+
+
+static void mrgusage(void)
+{
+    int i;
+
+    fprintf(stderr,"hexmerge %s\n", VERSION);
+    fprintf(stderr,"\nUsage:  hexmerge [-f{format}] [-i] [-c{policy}] "\
+	    "[-o{outfile}] [-a[{depth}]] [-q] [-]\n"\
+	    "                [-R{offset}] {file} [[-R{offset}] {file} ...]\n");
+    fprintf(stderr,"        hexmerge -help\n");
+    fprintf(stderr,"        hexmerge -?\n");
+    fprintf(stderr,"        hexmerge -version\n");
+    fprintf(stderr,"\n    Each file's format is detected. -R moves the data "\
+	    "of the files that\n    follow it by {offset}, which may be "\
+	    "negative. The output goes to\n    {outfile} or stdout, in "\
+	    "{format}, or else in the widest input format, widened if\n    "\
+	    "need be to the narrowest one that reaches the merged data.\n");
+    fprintf(stderr,"\n    -a reads up to {depth} (default %d) files at once, "\
+	    "through io_uring\n    if the kernel allows it (%s here).\n",
+	    HEXRDDEPTH, hex_uringok() ? "it does" : "it does not");
+    fprintf(stderr,"\n    overlap policies (-c):\n"\
+	    "        error            overlapping data is an error (default)\n"\
+	    "        first            data from the earlier file wins\n"\
+	    "        last             data from the later file wins\n");
+    fprintf(stderr,"\n    formats supported:\n");
+    for(i=0; converters[i].name; i++) {
+	fprintf(stderr,"        %-16s %s\n", converters[i].name,
+		converters[i].desc);
+    }
+}
+
+
+/* print one range of overlapping addresses */
+static void mrgreport(ULONG addr, ULONG len, void *arg)
+{
+    fprintf(stderr,"%s: 0x%08lX-0x%08lX (%lu byte%s)\n", (char *)arg,
+	    addr, addr + len - 1, len, len == 1 ? "" : "s");
+}
+
+
+/* the input files, and what is being built from them */
+typedef struct mrgstate {
+    char	**names;
+    long	*offsets;
+    int		ignoresum, quiet;
+    int		widest;		/* widest input format so far */
+    HEXIMAGE	img;
+} MRGSTATE;
+
+
+/* load the open hex file in, as identified by hex_fopen(), and append
+   it to the image at its offset. Returns the format of the file, or
+   FMT_UNDEF on failure. */
+static int mrgparse(FILE *in, int format, int i, MRGSTATE *ms)
+{
+    char	*name = ms->names[i];
+    int		quiet = ms->quiet;
+    HEXIMAGE	part;
+
+    if (format == FMT_UNDEF) {
+	format = FMT_DEFAULT;
+	if (!quiet)
+	    fprintf(stderr,"(%s: unknown format, assuming %s)\n", name,
+		    converters[format].name);
+    }
+    else if (!quiet)
+	fprintf(stderr,"(%s: %s)\n", name, converters[format].name);
+
+    hex_imginit(&part);
+    if (converters[format].ld_hex(in, ms->ignoresum, &part) ||
+	hex_imgappend(&ms->img, &part, ms->offsets[i])) {
+	fclose(in);
+	hex_imgfree(&part);
+	hex_perror(name);
+	return FMT_UNDEF;
+    }
+    fclose(in);
+    if (ms->widest == FMT_UNDEF ||
+	converters[format].maxaddr > converters[ms->widest].maxaddr)
+	ms->widest = format;
+    return format;
+}
+
+
+/* load input file i */
+static int mrgload(int i, MRGSTATE *ms)
+{
+    FILE	*in;
+    int		format = FMT_UNDEF;
+
+    if (!(in = hex_fopen(ms->names[i], &format))) {
+	perror(ms->names[i]);
+	return FMT_UNDEF;
+    }
+    return mrgparse(in, format, i, ms);
+}
+
+
+/* load input file i once hex_readfiles() has read it. Stops the reads
+   on failure. */
+static int mrgread(void *arg, int i, UCHAR *data, ULONG len)
+{
+    MRGSTATE	*ms = arg;
+    FILE	*in;
+    int		format = FMT_UNDEF;
+
+    if (!data || !(in = hex_memfopen(data, len, &format))) {
+	perror(ms->names[i]);
+	return 1;
+    }
+    return mrgparse(in, format, i, ms) == FMT_UNDEF;
+}
+
+
+/* exits with 0 on success, 1 on trouble */
+int hexmerge_main(int argc, char **argv)
+{
+    int		format = FMT_UNDEF;
+    int		i, policy = IMG_ERROR, zmethod;
+    int		argsdone = FALSE, depth = 0;
+    int		nfiles = 0;
+    long	offset = 0;
+    ULONG	top;
+    char	*outname = NULL;
+    char	*c;
+    FILE	*out = stdout;
+    MRGSTATE	ms;
+    HEXSINK	sink;
+
+    memset(&ms, 0, sizeof(ms));
+    ms.widest = FMT_UNDEF;
+    hex_imginit(&ms.img);
+    if (!(ms.names = malloc(argc * sizeof(char *))) ||
+	!(ms.offsets = malloc(argc * sizeof(long)))) {
+	perror("Error");
+	return 1;
+    }
+
+    for(i=1; i<argc; i++) {
+
+	if ((argv[i][0] == '-') && !argsdone) {
+
+	    if (strlen(argv[i]) > 1) {
+
+		switch(argv[i][1]) {
+
+		  case 'i':
+		    ms.ignoresum = TRUE;
+		    break;
+
+		  case 'f':
+		    if ((format = getformat(argv[i]+2)) == FMT_UNDEF) {
+			fprintf(stderr,
+				"Error: Unknown format \"%s\"\n",argv[i]);
+			mrgusage();
+			return 1;
+		    }
+		    break;
+
+		  case 'c':
+		    for(policy=0; policies[policy]; policy++)
+			if (strcmp(policies[policy],argv[i]+2) == 0)
+			    break;
+		    if (!policies[policy]) {
+			fprintf(stderr,
+				"Error: Unknown overlap policy \"%s\"\n",
+				argv[i]);
+			mrgusage();
+			return 1;
+		    }
+		    break;
+
+		  case 'R':
+		    c="M";	/* arbitrary non-NUL character */
+
+		    if (strlen(argv[i]) > 2) {
+			offset=strtol(argv[i]+2,&c,0);
+		    }
+
+		    if (c[0] != '\0') {
+			fprintf(stderr,"Error: invalid offset\n");
+			mrgusage();
+			return 1;
+		    }
+		    break;
+
+		  case 'o':
+		    if (strlen(argv[i]) < 3) {
+			fprintf(stderr,"Error: output file name expected\n");
+			mrgusage();
+			return 1;
+		    }
+		    outname = argv[i]+2;
+		    break;
+
+		  case 'h':
+		  case '?':
+		    mrgusage();
+		    return 0;
+
+		  case 'v':
+		    fprintf(stderr,"hexmerge %s\n", VERSION);
+		    return 0;
+
+		  case 'q':
+		    ms.quiet = TRUE;
+		    break;
+
+		  case 'a':
+		    c="";
+		    depth = HEXRDDEPTH;
+
+		    if (strlen(argv[i]) > 2)
+			depth=(int)strtol(argv[i]+2,&c,0);
+
+		    if (c[0] != '\0' || depth < 1) {
+			fprintf(stderr,"Error: invalid depth\n");
+			mrgusage();
+			return 1;
+		    }
+		    break;
+
+		  default:
+		    fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+		    mrgusage();
+		    return 1;
+		}
+	    }
+
+	    else {
+		/* "-" ends the flags */
+		argsdone = TRUE;
+	    }
+	}
+
+	else {
+	    /* each file takes the offset in effect where it is named */
+	    ms.names[nfiles] = argv[i];
+	    ms.offsets[nfiles++] = offset;
+	}
+    }
+
+    if (!nfiles) {
+	fprintf(stderr,"Error: no input files\n");
+	mrgusage();
+	return 1;
+    }
+
+    /* with -a the files are read ahead, several at once; either way
+       they are added to the image in the order given */
+    if (depth) {
+	if (hex_readfiles(ms.names, nfiles, depth, mrgread, &ms))
+	    return 1;
+    }
+    else {
+	for (i=0; i < nfiles; i++)
+	    if (mrgload(i, &ms) == FMT_UNDEF)
+		return 1;
+    }
+
+    if (hex_imgmerge(&ms.img, policy, ms.quiet && policy != IMG_ERROR ?
+		     NULL : mrgreport, "overlap")) {
+	hex_perror("Error merging files");
+	return 1;
+    }
+
+    /* without -f, the widest input format, unless the merged (and
+       perhaps moved) data reaches beyond it; then the narrowest
+       format that reaches it all, as bin2hex does for ELF files */
+    if (format == FMT_UNDEF) {
+	format = ms.widest;
+	top = MAX(ms.img.entry, ms.img.nseg ? ms.img.seg[ms.img.nseg-1].addr +
+		  (ms.img.seg[ms.img.nseg-1].len - 1) : 0);
+	if (top > converters[format].maxaddr) {
+	    for (i=0; converters[i].name; i++) {
+		if (converters[i].put_hex && converters[i].maxaddr >= top) {
+		    format = i;
+		    break;
+		}
+	    }
+	}
+    }
+
+    if (outname) {
+	if (!(out = fopen(outname,"w"))) {
+	    perror(outname);
+	    return 1;
+	}
+	if ((zmethod = hex_zmethod(outname, TRUE)) >= 0 &&
+	    !(out = hex_zfwrite(out, zmethod, 0))) {
+	    hex_perror("Error starting compressor");
+	    return 1;
+	}
+    }
+
+    hex_sinkinit(&sink, format, out);
+    if (hex_imgwrite(&ms.img, &sink)) {
+	hex_perror("Error writing merged file");
+	return 1;
+    }
+    hex_imgfree(&ms.img);
+    free(ms.names);
+    free(ms.offsets);
+
+    if (fclose(out)) {
+	perror("Error writing output");
+	return 1;
+    }
+    return 0;
+}
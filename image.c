@@ -0,0 +1,433 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Sparse binary images. A HEXIMAGE is a list of segments, each holding
+ * a run of contiguous data. The ld_hex functions in converters[] decode
+ * hex files into images without allocating the whole address range.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+#define SEGMINALLOC	256	/* smallest data allocation for a segment */
+#define RAWBUFLEN	65536	/* read size for raw binary files */
+
+
+/*---------------------------------------------------------------*/
+void hex_imginit(HEXIMAGE *img)
+{
+    memset(img, 0, sizeof(*img));
+    img->sorted = TRUE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_imgfree(HEXIMAGE *img)
+{
+    int		i;
+
+    for(i=0; i < img->nseg; i++)
+	free(img->seg[i].data);
+    free(img->seg);
+    hex_imginit(img);
+}
+
+
+/*---------------------------------------------------------------*/
+int hex_imgadd(HEXIMAGE *img, ULONG addr, UCHAR *data, ULONG len)
+{
+    HEXSEG	*s, *ns;
+    UCHAR	*nd;
+    ULONG	n;
+
+    if(!len)
+	return H_ERR_NONE;
+
+    /* records usually follow each other, so try to extend the last
+       segment before starting a new one */
+    s = img->nseg ? &img->seg[img->nseg-1] : NULL;
+    if(!s || s->addr + s->len != addr) {
+	if(s && addr < s->addr + s->len)
+	    img->sorted = FALSE;
+	if(img->nseg == img->segalloc) {
+	    n = img->segalloc ? img->segalloc * 2 : 16;
+	    if(!(ns = realloc(img->seg, n * sizeof(HEXSEG)))) {
+		ERR(H_ERR_IO);
+	    }
+	    img->seg = ns;
+	    img->segalloc = n;
+	}
+	s = &img->seg[img->nseg++];
+	s->addr = addr;
+	s->len = s->alloc = 0;
+	s->data = NULL;
+	s->seq = img->nseg - 1;
+    }
+
+    if(s->len + len > s->alloc) {
+	n = MAX(MAX(s->alloc * 2, s->len + len), SEGMINALLOC);
+	if(!(nd = realloc(s->data, n))) {
+	    ERR(H_ERR_IO);
+	}
+	s->data = nd;
+	s->alloc = n;
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+int hex_imgraw(FILE *in, ULONG base, HEXIMAGE *img)
+{
+    UCHAR	buf[RAWBUFLEN];
+    size_t	n;
+
+    while((n = fread(buf, 1, RAWBUFLEN, in)) > 0) {
+	if(hex_imgadd(img, base, buf, n))
+	    return hex_errno;
+	base += n;
+    }
+    if(ferror(in)) {
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int cmpaddr(const void *a, const void *b)
+{
+    const HEXSEG *sa = a, *sb = b;
+
+    if(sa->addr != sb->addr)
+	return sa->addr < sb->addr ? -1 : 1;
+    return sa->seq - sb->seq;
+}
+
+static int cmpseq(const void *a, const void *b)
+{
+    return ((const HEXSEG *)a)->seq - ((const HEXSEG *)b)->seq;
+}
+
+/* Sort the segments by address and coalesce segments that touch or
+   overlap. Overlapping data is resolved according to policy: IMG_LAST
+   lets the segment that was added last win, which is what rd_hex does
+   when it fills its buffer, and IMG_FIRST the one added first. With
+   IMG_ERROR the image is left unmerged and H_ERR_OVERLAP is returned
+   if any segments overlap. If report is not NULL it is called for
+   every range of addresses where segments overlap.
+
+   A single sweep over the sorted list finds each cluster of segments
+   that touch or overlap, so the cost is O(n log n) in the number of
+   segments plus one copy of the clustered data. */
+int hex_imgmerge(HEXIMAGE *img, int policy, HEXCMPFUNC *report, void *arg)
+{
+    HEXSEG	*s = img->seg;
+    HEXSEG	m;
+    ULONG	end, lo, hi, olo = 0, ohi = 0;
+    int		i, j, k, n, overlaps = FALSE;
+
+    if(img->sorted)
+	return H_ERR_NONE;
+
+    qsort(s, img->nseg, sizeof(HEXSEG), cmpaddr);
+
+    /* find the overlapping ranges first. Segments are in address order,
+       so each overlap starts at or after the one before it and
+       adjacent overlaps can be joined as they are found. */
+    if(report || policy == IMG_ERROR) {
+	for(end=0, i=0; i < img->nseg; i++) {
+	    if(i && s[i].addr < end) {
+		lo = s[i].addr;
+		hi = MIN(end, s[i].addr + s[i].len);
+		if(overlaps && lo <= ohi)
+		    ohi = MAX(ohi, hi);
+		else {
+		    if(overlaps && report)
+			report(olo, ohi - olo, arg);
+		    olo = lo;
+		    ohi = hi;
+		    overlaps = TRUE;
+		}
+	    }
+	    end = i ? MAX(end, s[i].addr + s[i].len) : s[i].addr + s[i].len;
+	}
+	if(overlaps && report)
+	    report(olo, ohi - olo, arg);
+	if(overlaps && policy == IMG_ERROR) {
+	    ERR(H_ERR_OVERLAP);
+	}
+    }
+
+    for(n=0, i=0; i < img->nseg; i = j) {
+	end = s[i].addr + s[i].len;
+	for(j=i+1; j < img->nseg && s[j].addr <= end; j++)
+	    end = MAX(end, s[j].addr + s[j].len);
+
+	if(j - i == 1) {
+	    s[n++] = s[i];
+	    continue;
+	}
+
+	/* copy the cluster into one buffer in the order the segments
+	   were added (or the reverse), so the right data wins */
+	m.addr = s[i].addr;
+	m.len = m.alloc = end - s[i].addr;
+	m.seq = s[i].seq;
+	if(!(m.data = malloc(m.len))) {
+	    ERR(H_ERR_IO);
+	}
+	qsort(&s[i], j - i, sizeof(HEXSEG), cmpseq);
+	for(k=0; k < j - i; k++) {
+	    HEXSEG *t = &s[policy == IMG_FIRST ? j - 1 - k : i + k];
+
+	    memcpy(m.data + (t->addr - m.addr), t->data, t->len);
+	    free(t->data);
+	    m.seq = MIN(m.seq, t->seq);
+	}
+	s[n++] = m;
+    }
+    img->nseg = n;
+    img->sorted = TRUE;
+    return H_ERR_NONE;
+}
+
+int hex_imgsort(HEXIMAGE *img)
+{
+    return hex_imgmerge(img, IMG_LAST, NULL, NULL);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Move all the segments of src to the end of dst, adding offset to
+   their addresses, and leave src empty. The moved segments count as
+   added after those already in dst. Fails with H_ERR_ADDR if any of
+   the data would be moved outside the 32 bit address space. */
+int hex_imgappend(HEXIMAGE *dst, HEXIMAGE *src, long offset)
+{
+    HEXSEG	*s, *ns;
+    ULONG	addr;
+    int		i, n;
+
+    for(i=0; i < src->nseg; i++) {
+	s = &src->seg[i];
+	addr = s->addr + offset;
+	if((offset < 0 && s->addr < (ULONG)-offset) ||
+	   (offset > 0 && (ULONG)offset > MAXADDR_INTEL32 - s->addr) ||
+	   s->len - 1 > MAXADDR_INTEL32 - addr) {
+	    ERR(H_ERR_ADDR);
+	}
+    }
+
+    if(dst->nseg + src->nseg > dst->segalloc) {
+	n = MAX(dst->segalloc * 2, dst->nseg + src->nseg);
+	if(!(ns = realloc(dst->seg, n * sizeof(HEXSEG)))) {
+	    ERR(H_ERR_IO);
+	}
+	dst->seg = ns;
+	dst->segalloc = n;
+    }
+
+    for(i=0; i < src->nseg; i++) {
+	s = &dst->seg[dst->nseg];
+	*s = src->seg[i];
+	s->addr += offset;
+	s->seq = dst->nseg++;
+	if(dst->sorted && dst->nseg > 1 && s->addr <= s[-1].addr + s[-1].len)
+	    dst->sorted = FALSE;
+    }
+    if(!dst->entry)
+	dst->entry = src->entry;
+
+    src->nseg = 0;
+    hex_imgfree(src);
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Drop the data outside addresses lo to hi (inclusive) */
+void hex_imgcrop(HEXIMAGE *img, ULONG lo, ULONG hi)
+{
+    HEXSEG	*s;
+    ULONG	cut;
+    int		i, n;
+
+    for(n=0, i=0; i < img->nseg; i++) {
+	s = &img->seg[i];
+	if(s->addr > hi || s->addr + (s->len - 1) < lo) {
+	    free(s->data);
+	    continue;
+	}
+	if(s->addr < lo) {
+	    cut = lo - s->addr;
+	    memmove(s->data, s->data + cut, s->len - cut);
+	    s->addr = lo;
+	    s->len -= cut;
+	}
+	if(s->addr + (s->len - 1) > hi)
+	    s->len = hi - s->addr + 1;
+	img->seg[n++] = *s;
+    }
+    img->nseg = n;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Write addresses lo to hi (inclusive) of img to out as binary, with
+   hex_fill at addresses that hold no data. The blocks written are
+   passed to hex_digest, as rd_hex does. */
+int hex_imgwrbin(HEXIMAGE *img, FILE *out, ULONG lo, ULONG hi)
+{
+    UCHAR	fill[RAWBUFLEN];
+    HEXSEG	*s;
+    ULONG	addr, n;
+    int		i;
+
+    if(hex_imgsort(img))
+	return hex_errno;
+    if(!hex_digest)
+	memset(fill, hex_fill, RAWBUFLEN);
+
+    for(addr=lo, i=0; ; ) {
+	/* skip segments that end before addr */
+	while(i < img->nseg && img->seg[i].addr + (img->seg[i].len - 1) < addr)
+	    i++;
+	s = i < img->nseg && img->seg[i].addr <= hi ? &img->seg[i] : NULL;
+
+	if(s && s->addr <= addr) {
+	    n = MIN(s->len - (addr - s->addr), hi - addr + 1);
+	    if(hex_digest)
+		hex_dgblock(hex_digest, addr, s->data + (addr - s->addr), n);
+	    if(fwrite(s->data + (addr - s->addr), 1, n, out) != n) {
+		ERR(H_ERR_IO);
+	    }
+	}
+	else {
+	    n = s ? s->addr - addr : MIN(hi - addr, RAWBUFLEN - 1) + 1;
+	    n = MIN(n, RAWBUFLEN);
+	    if(hex_digest) {
+		/* a checksum stamp may be patched into the fill */
+		memset(fill, hex_fill, n);
+		hex_dgblock(hex_digest, addr, fill, n);
+	    }
+	    if(fwrite(fill, 1, n, out) != n) {
+		ERR(H_ERR_IO);
+	    }
+	}
+	if(addr + (n - 1) == hi)
+	    break;
+	addr += n;
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Compare two images, calling report() for every range of addresses
+   whose contents differ. Addresses that are present in only one image
+   are skipped if fill is negative, and otherwise compared against
+   fill. Returns the number of differing bytes, or (ULONG)-1 with
+   hex_errno set. */
+ULONG hex_imgcmp(HEXIMAGE *a, HEXIMAGE *b, int fill,
+		 HEXCMPFUNC *report, void *arg)
+{
+    HEXSEG	*sa, *sb, *ea, *eb;
+    ULONG	addr, stop, n, i, diffs = 0;
+    ULONG	runstart = 0, runend = 0;
+    int		inrun = FALSE;
+    const UCHAR	*pa, *pb;
+
+    if(hex_imgsort(a) || hex_imgsort(b))
+	return (ULONG)-1;
+
+    sa = a->seg; ea = a->seg + a->nseg;
+    sb = b->seg; eb = b->seg + b->nseg;
+    addr = 0;
+    if(sa < ea)
+	addr = sa->addr;
+    if(sb < eb && (sa == ea || sb->addr < addr))
+	addr = sb->addr;
+
+    while(sa < ea || sb < eb) {
+	/* drop segments that lie behind addr */
+	if(sa < ea && sa->addr + sa->len <= addr) {
+	    sa++;
+	    continue;
+	}
+	if(sb < eb && sb->addr + sb->len <= addr) {
+	    sb++;
+	    continue;
+	}
+
+	/* find how far the current situation (data in a, in b, or in
+	   both) lasts */
+	pa = (sa < ea && sa->addr <= addr) ? sa->data + (addr - sa->addr) : NULL;
+	pb = (sb < eb && sb->addr <= addr) ? sb->data + (addr - sb->addr) : NULL;
+	stop = (ULONG)-1;
+	if(sa < ea)
+	    stop = MIN(stop, pa ? sa->addr + sa->len : sa->addr);
+	if(sb < eb)
+	    stop = MIN(stop, pb ? sb->addr + sb->len : sb->addr);
+
+	if(!pa && !pb) {
+	    addr = stop;
+	    continue;
+	}
+	if((!pa || !pb) && fill < 0) {
+	    addr = stop;
+	    continue;
+	}
+
+	/* alternate between runs of equal and differing bytes */
+	for(i=0, n=stop-addr; i < n; ) {
+	    if(pa && pb)
+		i += hex_memdiff(pa + i, pb + i, n - i);
+	    else
+		i += hex_memnotc(pa ? pa + i : pb + i, fill, n - i);
+	    if(i == n)
+		break;
+	    if(!inrun || runend != addr + i) {
+		if(inrun)
+		    report(runstart, runend - runstart, arg);
+		runstart = addr + i;
+		inrun = TRUE;
+	    }
+	    if(pa && pb)
+		i += hex_memsame(pa + i, pb + i, n - i);
+	    else
+		i += hex_memisc(pa ? pa + i : pb + i, fill, n - i);
+	    diffs += (addr + i) - MAX(runstart, runend);
+	    runend = addr + i;
+	}
+	addr = stop;
+    }
+    if(inrun)
+	report(runstart, runend - runstart, arg);
+    return diffs;
+}
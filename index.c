@@ -0,0 +1,299 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Record indexes. An index divides a hex file into chunks of records
+ * whose data is one contiguous run of addresses, and remembers where
+ * each chunk starts in the file along with the format's address state
+ * (extended address bases) at that point. An address range can then be
+ * extracted by seeking to and decoding only the chunks that cover it.
+ * Indexes can be saved to a sidecar file, which is reused as long as
+ * the hex file's size and modification time have not changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "etools.h"
+#include "hex.h"
+
+#define IXMAGIC		"HEXIX001"	/* first bytes of an index file */
+#define IXMAGICLEN	8
+#define IXFIELDS	6		/* ULONG fields per entry */
+
+
+/*---------------------------------------------------------------*/
+void hex_ixinit(HEXINDEX *ix)
+{
+    memset(ix, 0, sizeof(*ix));
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_ixfree(HEXINDEX *ix)
+{
+    free(ix->ent);
+    free(ix->maxhi);
+    hex_ixinit(ix);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Called by the ix_hex functions for every chunk they find */
+int hex_ixadd(HEXINDEX *ix, HEXIXENT *e)
+{
+    HEXIXENT	*ne;
+    int		n;
+
+    if(ix->nent == ix->entalloc) {
+	n = ix->entalloc ? ix->entalloc * 2 : 256;
+	if(!(ne = realloc(ix->ent, n * sizeof(HEXIXENT)))) {
+	    ERR(H_ERR_IO);
+	}
+	ix->ent = ne;
+	ix->entalloc = n;
+    }
+    ix->ent[ix->nent++] = *e;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int cmplo(const void *a, const void *b)
+{
+    const HEXIXENT *ea = a, *eb = b;
+
+    if(ea->lo != eb->lo)
+	return ea->lo < eb->lo ? -1 : 1;
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+static int cmpoffset(const void *a, const void *b)
+{
+    const HEXIXENT *ea = *(HEXIXENT * const *)a, *eb = *(HEXIXENT * const *)b;
+
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+/* sort the entries by address and note the highest address covered by
+   each prefix of the list, so that lookups can stop early */
+static int ixsort(HEXINDEX *ix)
+{
+    int		i;
+
+    qsort(ix->ent, ix->nent, sizeof(HEXIXENT), cmplo);
+    free(ix->maxhi);
+    if(!(ix->maxhi = malloc(MAX(ix->nent, 1) * sizeof(ULONG)))) {
+	ERR(H_ERR_IO);
+    }
+    for(i=0; i < ix->nent; i++)
+	ix->maxhi[i] = i ? MAX(ix->maxhi[i-1], ix->ent[i].hi) : ix->ent[i].hi;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Build an index of in, which is in the given format */
+int hex_ixbuild(FILE *in, int format, int ignoresum, HEXINDEX *ix)
+{
+    hex_ixfree(ix);
+    ix->format = format;
+    if(!converters[format].ix_hex) {
+	ERR(H_ERR_NOINDEX);
+    }
+    if(converters[format].ix_hex(in, ignoresum, ix))
+	return hex_errno;
+    return ixsort(ix);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Index files hold IXMAGIC, then the format, size and mtime fields and
+   the number of entries, then the entries. Every field is written as
+   8 bytes, least significant first, so index files can be moved
+   between machines along with the hex files. */
+static int putfield(FILE *f, ULONG v)
+{
+    UCHAR	b[8];
+    int		i;
+
+    for(i=0; i < 8; i++, v >>= 8)
+	b[i] = v & 0xff;
+    return fwrite(b, 1, 8, f) == 8 ? 0 : -1;
+}
+
+static int getfield(FILE *f, ULONG *v)
+{
+    UCHAR	b[8];
+    int		i;
+
+    if(fread(b, 1, 8, f) != 8)
+	return -1;
+    for(*v=0, i=7; i >= 0; i--)
+	*v = (*v << 8) | b[i];
+    return 0;
+}
+
+int hex_ixsave(HEXINDEX *ix, char *name)
+{
+    FILE	*f;
+    HEXIXENT	*e;
+    int		i, bad;
+
+    if(!(f = fopen(name, "wb"))) {
+	ERR(H_ERR_IO);
+    }
+    bad = fwrite(IXMAGIC, 1, IXMAGICLEN, f) != IXMAGICLEN ||
+	putfield(f, ix->format) || putfield(f, ix->size) ||
+	putfield(f, ix->mtime) || putfield(f, ix->nent);
+    for(i=0; i < ix->nent && !bad; i++) {
+	e = &ix->ent[i];
+	bad = putfield(f, e->lo) || putfield(f, e->hi) ||
+	    putfield(f, e->offset) || putfield(f, e->nrec) ||
+	    putfield(f, e->state[0]) || putfield(f, e->state[1]);
+    }
+    if(fclose(f) || bad) {
+	remove(name);		/* don't leave half an index behind */
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
+
+int hex_ixload(HEXINDEX *ix, char *name)
+{
+    FILE	*f;
+    HEXIXENT	e;
+    UCHAR	magic[IXMAGICLEN];
+    ULONG	format, n;
+
+    hex_ixfree(ix);
+    if(!(f = fopen(name, "rb"))) {
+	ERR(H_ERR_IO);
+    }
+    if(fread(magic, 1, IXMAGICLEN, f) != IXMAGICLEN ||
+       memcmp(magic, IXMAGIC, IXMAGICLEN) ||
+       getfield(f, &format) || getfield(f, &ix->size) ||
+       getfield(f, &ix->mtime) || getfield(f, &n))
+	goto bad;
+    ix->format = format;
+
+    while(n--) {
+	if(getfield(f, &e.lo) || getfield(f, &e.hi) ||
+	   getfield(f, &e.offset) || getfield(f, &e.nrec) ||
+	   getfield(f, &e.state[0]) || getfield(f, &e.state[1]))
+	    goto bad;
+	if(hex_ixadd(ix, &e)) {
+	    fclose(f);
+	    return hex_errno;
+	}
+    }
+    fclose(f);
+    return ixsort(ix);
+
+  bad:
+    fclose(f);
+    hex_ixfree(ix);
+    ERR(H_ERR_NOINDEX);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Get an index for the hex file hexname, open as in. The index saved
+   in ixname is used if it was made for the same format and the hex
+   file's size and modification time still match; otherwise in is
+   indexed from the start and the index is saved in ixname. If it
+   cannot be saved, the index is still good to use, and ix->unsaved
+   is set with hex_errno saying why. */
+int hex_ixget(FILE *in, char *hexname, char *ixname, int format,
+	      int ignoresum, HEXINDEX *ix)
+{
+    struct stat	st;
+
+    if(stat(hexname, &st)) {
+	ERR(H_ERR_IO);
+    }
+    if(!hex_ixload(ix, ixname) && ix->format == format &&
+       ix->size == (ULONG)st.st_size && ix->mtime == (ULONG)st.st_mtime)
+	return H_ERR_NONE;
+
+    if(fseek(in, 0L, SEEK_SET)) {
+	ERR(H_ERR_IO);
+    }
+    if(hex_ixbuild(in, format, ignoresum, ix))
+	return hex_errno;
+    ix->size = st.st_size;
+    ix->mtime = st.st_mtime;
+    ix->unsaved = hex_ixsave(ix, ixname) != H_ERR_NONE;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Decode the data at addresses lo to hi (inclusive) of in into img,
+   using the index ix. Only the chunks covering the range are read,
+   in file order so that overlapping data resolves the same way as a
+   full decode does. Data outside the range is cropped off. */
+int hex_ixrange(FILE *in, HEXINDEX *ix, int ignoresum, ULONG lo, ULONG hi,
+		HEXIMAGE *img)
+{
+    HEXIXENT	**hit;
+    int		i, j, n;
+
+    if(!converters[ix->format].ldix_hex) {
+	ERR(H_ERR_NOINDEX);
+    }
+
+    /* entries are sorted by lo; the last one that could cover the
+       range is the last one that starts at or before hi, and the walk
+       back stops once no earlier entry reaches up to lo */
+    for(i=0, j=ix->nent; i < j; ) {
+	n = (i + j) / 2;
+	if(ix->ent[n].lo <= hi)
+	    i = n + 1;
+	else
+	    j = n;
+    }
+    for(n=0, j=i-1; j >= 0 && ix->maxhi[j] >= lo; j--)
+	if(ix->ent[j].hi >= lo)
+	    n++;
+
+    if(!(hit = malloc(MAX(n, 1) * sizeof(HEXIXENT *)))) {
+	ERR(H_ERR_IO);
+    }
+    for(n=0, j=i-1; j >= 0 && ix->maxhi[j] >= lo; j--)
+	if(ix->ent[j].hi >= lo)
+	    hit[n++] = &ix->ent[j];
+    qsort(hit, n, sizeof(HEXIXENT *), cmpoffset);
+
+    for(i=0; i < n; i++) {
+	if(converters[ix->format].ldix_hex(in, ignoresum, hit[i], img)) {
+	    free(hit);
+	    return hex_errno;
+	}
+    }
+    free(hit);
+    hex_imgcrop(img, lo, hi);
+    return H_ERR_NONE;
+}
@@ -30,10 +30,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "etools.h"
 #include "hex.h"
 
-#define CPL 16			/* data chars per line when writing */
+#define IXCHUNK		256	/* most data records in an index chunk */
 
 /* byte offsets of record fields (raw binary form) */
 #define B_BCOUNT	0
@@ -46,7 +47,8 @@
 #define H_ADDR		3
 #define H_RTYPE		7
 #define H_DATA		9
-#define LINEBUFLEN	512	/* length of read buffers */
+#define LINEBUFLEN	1024	/* length of read buffers (a 255 byte record
+				   is 523 characters with CR/LF) */
 #define ADDRMASK	0xffff	/* address mask for intel86 and intel32 */
 
 /* record types */
@@ -56,22 +58,131 @@
 #define REC_START	3
 #define REC_EXTLIN	4
 #define REC_STARTLIN	5
+#define REC_NONE	(-1)	/* returned by getrec_intel() at end of input */
+#define REC_ERR		(-2)	/* returned by getrec_intel() on error */
 
 #define RDERR(a) free(buf); ERR((a))
 
 
 /*---------------------------------------------------------------*/
-int rd_intel(FILE *in, FILE *out, int ignoresum, ULONG *minaddr, ULONG *entry)
+/* Decode one line of linelen characters into binbuf, checking its
+   length and (unless ignoresum is set) its checksum. Extended address
+   records update *base and *linaddr; for data records, *addr is set
+   to the absolute address of the first data byte. Returns the record
+   type, REC_NONE if the line is not a record, or REC_ERR with
+   hex_errno set. */
+static int decrec_intel(UCHAR *linebuf, int linelen, UCHAR *binbuf,
+			int ignoresum, ULONG *base, ULONG *linaddr, ULONG *addr)
+{
+    UCHAR	checksum;
+
+    /* ignore short lines */
+    if(linelen < H_DATA)
+	return REC_NONE;
+
+    /* ignore lines without leading colon */
+    if(linebuf[0] != ':')
+	return REC_NONE;
+
+    /* convert hex to chars */
+    hex_decode(binbuf, linebuf + 1, (linelen-1) >> 1);
+
+    /* check line length:
+       line length should be at least (H_DATA bytes for header)
+       + (2 * number of bytes specified in byte count field)
+       + (2 bytes for checksum) + (1 byte for newline) */
+    if (linelen < (H_DATA + 3 + binbuf[B_BCOUNT])) {
+	hex_errno = H_ERR_BADHEX;
+	return REC_ERR;
+    }
+
+    /* compute checksum */
+    if (!ignoresum) {
+	checksum = hex_sum8(binbuf, B_DATA + binbuf[B_BCOUNT] + 1);
+	if(checksum) {
+	    hex_errno = H_ERR_BADSUM;
+	    return REC_ERR;
+	}
+    }
+
+    /* process the line */
+    switch(binbuf[B_RTYPE]) {
+
+      case REC_DATA:	/* data record */
+	*addr = ((binbuf[B_ADDR] << 8) | binbuf[B_ADDR + 1]) \
+	    + *base + *linaddr;
+	break;
+
+      case REC_EOF:		/* end of file record */
+	break;
+
+      case REC_EXT:		/* extended address record */
+	*base = (binbuf[B_DATA] << 12) | (binbuf[B_DATA+1] << 4);
+	break;
+
+      case REC_START:	/* start record */
+	/* not documented in Data I/O manual... just
+	   ignore this record until proper spec is found */
+	break;
+
+      case REC_EXTLIN:	/* extended linear address record */
+	*linaddr = ((ULONG)binbuf[B_DATA] << 24) |
+	    ((ULONG)binbuf[B_DATA+1] << 16);
+	break;
+
+      case REC_STARTLIN:	/* start linear address record */
+	/* not documented in Data I/O manual... just
+	   ignore this record until proper spec is found */
+	break;
+
+      default:		/* error */
+	hex_errno = H_ERR_RECTYPE;
+	return REC_ERR;
+    }
+    return binbuf[B_RTYPE];
+}
+
+
+/*---------------------------------------------------------------*/
+/* Read the next record from in into binbuf, skipping lines that are
+   not records; see decrec_intel(). If pos is not NULL, the length of
+   every line read is added to it. Returns the record type, REC_NONE
+   at end of input, or REC_ERR with hex_errno set. */
+static int getrec_intel(FILE *in, UCHAR *binbuf, int ignoresum,
+			ULONG *base, ULONG *linaddr, ULONG *addr, ULONG *pos)
 {
     UCHAR	linebuf[LINEBUFLEN];
+    int		linelen, rtype;
+
+    while(fgets((char *)linebuf, LINEBUFLEN-1, in))
+    {
+	linelen = strlen((char *)linebuf);
+	if(pos)
+	    *pos += linelen;
+	rtype = decrec_intel(linebuf, linelen, binbuf, ignoresum,
+			     base, linaddr, addr);
+	if(rtype != REC_NONE)
+	    return rtype;
+    }
+
+    if(ferror(in)) {
+	hex_errno = H_ERR_IO;
+	return REC_ERR;
+    }
+    return REC_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+int rd_intel(FILE *in, FILE *out, int ignoresum, ULONG *minaddr, ULONG *entry)
+{
     UCHAR	binbuf[LINEBUFLEN/2];
     UCHAR	*buf;
-    UCHAR	checksum;
     ULONG	Lminaddr, Lmaxaddr, Lentry;
     ULONG	addr, base, linaddr, bufsize;
-    int		linelen, i;
+    int		rtype;
     
-    linaddr = 0;
+    base = linaddr = 0;
 
     /* determine size and address range of data */
     if(scan_intel(in, NULL, &Lminaddr, &Lmaxaddr, &Lentry))
@@ -86,78 +197,17 @@ int rd_intel(FILE *in, FILE *out, int ignoresum, ULONG *minaddr, ULONG *entry)
     if(!buf) {
 	ERR(H_ERR_IO);
     }
+    memset(buf, hex_fill, bufsize);
 
-    while(fgets((char *)linebuf, LINEBUFLEN-1, in))
-    {
-	/* ignore short lines */
-	linelen = strlen((char *)linebuf);
-	if(linelen < H_DATA)
-	    continue;
-	
-	/* ignore lines without leading colon */
-	if(linebuf[0] != ':')
-	    continue;
-
-	/* convert hex to chars */
-	for(i=0; i < (linelen-1) >> 1; i++) {
-	    binbuf[i] = H2C(&linebuf[(i << 1) + 1]);
-	}
-
-	/* check line length:
-	   line length should be at least (H_DATA bytes for header)
-	   + (2 * number of bytes specified in byte count field)
-	   + (2 bytes for checksum) + (1 byte for newline) */
-	if (linelen < (H_DATA + 3 + binbuf[B_BCOUNT])) {
-	    RDERR(H_ERR_BADHEX);
-	}
-
-	/* compute checksum */
-	if (!ignoresum) {
-	    for(checksum=0, i=0; i < (B_DATA + binbuf[B_BCOUNT] + 1); i++)
-		checksum += binbuf[i];
-	    if(checksum) {
-		RDERR(H_ERR_BADSUM);
-	    }
+    /* read records up to the end of file record */
+    while((rtype = getrec_intel(in, binbuf, ignoresum,
+				&base, &linaddr, &addr, NULL)) != REC_NONE) {
+	if(rtype == REC_ERR) {
+	    RDERR(hex_errno);
 	}
-	
-	/* process the line */
-	switch(binbuf[B_RTYPE]) {
-
-	  case REC_DATA:	/* data record */
-	    addr = ((binbuf[B_ADDR] << 8) | binbuf[B_ADDR + 1]) \
-		+ base + linaddr;
-	    for(i=0; i < binbuf[B_BCOUNT]; i++)
-		buf[(addr-Lminaddr) + i] = binbuf[B_DATA + i];
-	    break;
-
-	  case REC_EOF:		/* end of file record */
-	    break;
-
-	  case REC_EXT:		/* extended address record */
-	    base = (binbuf[B_DATA] << 12) | (binbuf[B_DATA+1] << 4);
-	    break;
-
-	  case REC_START:	/* start record */
-	    /* not documented in Data I/O manual... just
-	       ignore this record until proper spec is found */
-	    break;
-
-	  case REC_EXTLIN:	/* extended linear address record */
-	    linaddr = (binbuf[B_DATA] << 24) | (binbuf[B_DATA+1] << 16);
-	    break;
-
-	  case REC_STARTLIN:	/* start linear address record */
-	    /* not documented in Data I/O manual... just
-	       ignore this record until proper spec is found */
-	    break;
-
-	  default:		/* error */
-	    RDERR(H_ERR_RECTYPE);
-	    break;
-	}
-
-	/* if record was an end of file record, stop reading */
-	if(binbuf[B_RTYPE] == REC_EOF)
+	if(rtype == REC_DATA)
+	    memcpy(&buf[addr-Lminaddr], &binbuf[B_DATA], binbuf[B_BCOUNT]);
+	if(rtype == REC_EOF)
 	    break;
     }
 
@@ -166,6 +216,9 @@ int rd_intel(FILE *in, FILE *out, int ignoresum, ULONG *minaddr, ULONG *entry)
 	RDERR(H_ERR_IO);
     }
 
+    if(hex_digest)
+	hex_dgblock(hex_digest, Lminaddr, buf, bufsize);
+
     if(fwrite(buf, 1, bufsize, out) != bufsize) {
 	RDERR(H_ERR_IO);
     }
@@ -185,366 +238,401 @@ int rd_intel(FILE *in, FILE *out, int ignoresum, ULONG *minaddr, ULONG *entry)
 
 
 /*---------------------------------------------------------------*/
-int wr_intel(FILE *in, FILE *out, ULONG base, ULONG entry)
+int ld_intel(FILE *in, int ignoresum, HEXIMAGE *img)
 {
-    UCHAR	inbuf[CPL+5];
-    UCHAR	outbuf[(2*CPL)+12];
-    ULONG	addr;
-    int		linelen, i;
-
-    if(entry > MAXADDR_INTEL) {
-	/* entry won't fit into its field */
-	ERR(H_ERR_ENTRY);
+    UCHAR	binbuf[LINEBUFLEN/2];
+    ULONG	addr, base, linaddr;
+    int		rtype;
+
+    /* decode straight into the segments of img; no scan is needed
+       because nothing is allocated up front */
+    base = linaddr = 0;
+    img->entry = 0;
+
+    while((rtype = getrec_intel(in, binbuf, ignoresum,
+				&base, &linaddr, &addr, NULL)) != REC_NONE) {
+	if(rtype == REC_ERR)
+	    return hex_errno;
+	if(rtype == REC_DATA &&
+	   hex_imgadd(img, addr, &binbuf[B_DATA], binbuf[B_BCOUNT]))
+	    return hex_errno;
+	if(rtype == REC_EOF)
+	    break;
     }
+    return H_ERR_NONE;
+}
 
-    addr = base;
-    outbuf[0] = ':';
-    inbuf[B_RTYPE] = REC_DATA;
-
-    while(!feof(in)) {
-
-	if((linelen = fread(&inbuf[B_DATA],1,CPL,in)) > 0) {
-
-	    if(addr > (MAXADDR_INTEL - (ULONG)(linelen-1))) {
-		/* address of some byte is too large */
-		ERR(H_ERR_ADDR);
-	    }
-
-	    /* byte count */
-	    inbuf[B_BCOUNT] = (char)linelen;
-
-	    /* address */
-	    inbuf[B_ADDR]   = (addr>>8) & 0xff;
-	    inbuf[B_ADDR+1] = addr & 0xff;
-
-	    /* calc checksum and convert to hex */
-	    for(inbuf[B_DATA+linelen]=0, i=0; i < B_DATA + linelen; i++) {
-		inbuf[B_DATA+linelen] += inbuf[i];
-		outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-		outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-	    }
-	    inbuf[B_DATA+linelen] = ~inbuf[B_DATA+linelen] + 1; /* 2's compl */
-	    outbuf[H_DATA + (linelen<<1)]     = C2H_H(inbuf[B_DATA+linelen]);
-	    outbuf[H_DATA + (linelen<<1) + 1] = C2H_L(inbuf[B_DATA+linelen]);
+/*---------------------------------------------------------------*/
+/* Decode every record of in into a row of a table, with its offset in
+   the file. Start records are kept as rows but, as elsewhere, do not
+   set the entry address. */
+int tab_intel(FILE *in, int ignoresum, HEXTABLE *t)
+{
+    UCHAR	binbuf[LINEBUFLEN/2];
+    ULONG	addr, base, linaddr, pos, recpos;
+    int		rtype, type;
+
+    base = linaddr = pos = 0;
+    t->entry = 0;
+
+    for(;;) {
+	recpos = pos;
+	rtype = getrec_intel(in, binbuf, ignoresum, &base, &linaddr, &addr,
+			     &pos);
+	if(rtype == REC_ERR)
+	    return hex_errno;
+	if(rtype == REC_NONE)
+	    break;
+	switch(rtype) {
+	  case REC_DATA:
+	    type = TAB_DATA;
+	    break;
+	  case REC_EXT:
+	    type = TAB_ADDR;
+	    addr = base;
+	    break;
+	  case REC_EXTLIN:
+	    type = TAB_ADDR;
+	    addr = linaddr;
+	    break;
+	  case REC_EOF:
+	    type = TAB_END;
+	    addr = 0;
+	    break;
+	  default:
+	    type = TAB_START;
+	    addr = 0;
+	    break;
+	}
+	if(hex_tabadd(t, type, addr, &binbuf[B_DATA], binbuf[B_BCOUNT],
+		      recpos))
+	    return hex_errno;
+	if(rtype == REC_EOF)
+	    break;
+    }
+    return H_ERR_NONE;
+}
 
-	    /* terminate with newline */
-	    outbuf[H_DATA + (linelen<<1) + 2] = '\n';
+/*---------------------------------------------------------------*/
+/* Index the records of in. A chunk ends after IXCHUNK data records,
+   or where the data stops being one contiguous run of addresses. */
+int ix_intel(FILE *in, int ignoresum, HEXINDEX *ix)
+{
+    UCHAR	binbuf[LINEBUFLEN/2];
+    ULONG	addr, base, linaddr, pos, recpos, recbase, reclin;
+    HEXIXENT	e;
+    int		rtype, ndata = 0;
+
+    base = linaddr = pos = 0;
+    e.nrec = 0;
+
+    for(;;) {
+	/* where the next record starts, and the state before it */
+	recpos = pos;
+	recbase = base;
+	reclin = linaddr;
+
+	rtype = getrec_intel(in, binbuf, ignoresum, &base, &linaddr, &addr,
+			     &pos);
+	if(rtype == REC_ERR)
+	    return hex_errno;
+	if(rtype == REC_NONE || rtype == REC_EOF)
+	    break;
+	if(rtype != REC_DATA || !binbuf[B_BCOUNT]) {
+	    if(ndata)
+		e.nrec++;
+	    continue;
+	}
 
-	    /* write the line */
-	    if(fwrite(outbuf,1,H_DATA + (linelen<<1) + 3,out) == 0) {
-		ERR(H_ERR_IO);
-	    }
-	    addr += linelen;
+	if(ndata && (ndata == IXCHUNK || addr != e.hi + 1)) {
+	    if(hex_ixadd(ix, &e))
+		return hex_errno;
+	    ndata = 0;
 	}
-	else if(ferror(in)) {
-	    /* error while reading */
-	    ERR(H_ERR_IO);
+	if(!ndata) {
+	    e.lo = addr;
+	    e.offset = recpos;
+	    e.nrec = 0;
+	    e.state[0] = recbase;
+	    e.state[1] = reclin;
 	}
+	e.hi = addr + binbuf[B_BCOUNT] - 1;
+	e.nrec++;
+	ndata++;
     }
+    if(ndata && hex_ixadd(ix, &e))
+	return hex_errno;
+    return H_ERR_NONE;
+}
 
-    /* write end record */
-
-    /* byte count */
-    inbuf[B_BCOUNT] = 0;
-
-    /* address */
-    inbuf[B_ADDR]   = 0;
-    inbuf[B_ADDR+1] = 0;
-
-    /* record type */
-    inbuf[B_RTYPE] = REC_EOF;
-
-    /* calc checksum and convert to hex */
-    for(inbuf[B_DATA]=0, i=0; i < B_DATA; i++) {
-	inbuf[B_DATA] += inbuf[i];
-	outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-	outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-    }
-    inbuf[B_DATA] = ~inbuf[B_DATA] + 1; /* 2's compl */
-    outbuf[H_DATA]     = C2H_H(inbuf[B_DATA]);
-    outbuf[H_DATA + 1] = C2H_L(inbuf[B_DATA]);
 
-    /* terminate with newline */
-    outbuf[H_DATA + 2] = '\n';
+/*---------------------------------------------------------------*/
+/* Decode the chunk of records described by e */
+int ldix_intel(FILE *in, int ignoresum, HEXIXENT *e, HEXIMAGE *img)
+{
+    UCHAR	binbuf[LINEBUFLEN/2];
+    ULONG	addr, base, linaddr, n;
+    int		rtype;
 
-    /* write the line */
-    if(fwrite(outbuf,1,H_DATA + 3,out) == 0) {
+    if(fseek(in, (long)e->offset, SEEK_SET)) {
 	ERR(H_ERR_IO);
     }
-
+    base = e->state[0];
+    linaddr = e->state[1];
+
+    for(n=0; n < e->nrec; n++) {
+	rtype = getrec_intel(in, binbuf, ignoresum, &base, &linaddr, &addr,
+			     NULL);
+	if(rtype == REC_ERR)
+	    return hex_errno;
+	if(rtype == REC_NONE || rtype == REC_EOF) {
+	    /* the file is shorter than the index says */
+	    ERR(H_ERR_NOINDEX);
+	}
+	if(rtype == REC_DATA &&
+	   hex_imgadd(img, addr, &binbuf[B_DATA], binbuf[B_BCOUNT]))
+	    return hex_errno;
+    }
     return H_ERR_NONE;
 }
 
 
 /*---------------------------------------------------------------*/
-int wr_intel86(FILE *in, FILE *out, ULONG base, ULONG entry)
+/* Decode one complete line for push_intel() */
+static int pushline_intel(HEXPUSH *p, UCHAR *line, int linelen)
 {
-    UCHAR	inbuf[CPL+5];
-    UCHAR	outbuf[(2*CPL)+12];
-    ULONG	addr, rdlen;
-    int		linelen, i;
-    int		initsegment=TRUE;
-    
-    /* base and entry are absolute addresses. addr is the absolute
-       address of a given byte, and must be masked for various fields */
-    if(entry > MAXADDR_INTEL86) {
-	/* entry won't fit into its field */
-	ERR(H_ERR_ENTRY);
-    }
-    addr = base;
-    outbuf[0] = ':';
-
-    while(!feof(in)) {
-
-	/* compute # of bytes left in this segment, and read
-	   min(bytes left, CPL) bytes for current data record */
-	rdlen = (ADDRMASK + 1) - (addr & ADDRMASK);
-
-	if((rdlen == ADDRMASK + 1) || initsegment) {
-	    /* time for a new extended address record... */
-
-	    /* segment address specifies bits 4-19 of the address,
-	       but only bits 16-19 are printed here by this code because
-	       the data record address fields can specify the other bits */
-	    initsegment = FALSE;
-	    linelen = 2;
-	    inbuf[B_BCOUNT] = linelen;
-	    inbuf[B_ADDR] = 0;
-	    inbuf[B_ADDR+1] = 0;
-	    inbuf[B_RTYPE] = REC_EXT;
-	    inbuf[B_DATA] = ((addr & ~ADDRMASK) >> 12) & 0xff;
-	    inbuf[B_DATA+1] = 0;
-
-	    /* calc checksum and convert to hex */
-	    for(inbuf[B_DATA+linelen]=0, i=0; i < B_DATA + linelen; i++) {
-		inbuf[B_DATA+linelen] += inbuf[i];
-		outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-		outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-	    }
-	    inbuf[B_DATA+linelen] = ~inbuf[B_DATA+linelen] + 1; /* 2's compl */
-	    outbuf[H_DATA + (linelen<<1)]     = C2H_H(inbuf[B_DATA+linelen]);
-	    outbuf[H_DATA + (linelen<<1) + 1] = C2H_L(inbuf[B_DATA+linelen]);
+    UCHAR	binbuf[LINEBUFLEN/2];
+    ULONG	addr;
+    int		rtype, ret;
 
-	    /* terminate with newline */
-	    outbuf[H_DATA + (linelen<<1) + 2] = '\n';
+    rtype = decrec_intel(line, linelen, binbuf, p->ignoresum,
+			 &p->state[0], &p->state[1], &addr);
+    if(rtype == REC_ERR)
+	return hex_errno;
+    if(rtype == REC_DATA && binbuf[B_BCOUNT] &&
+       (ret = p->rec(p->arg, addr, &binbuf[B_DATA], binbuf[B_BCOUNT]))) {
+	ERR(ret);
+    }
+    if(rtype == REC_EOF)
+	p->done = TRUE;
+    return H_ERR_NONE;
+}
 
-	    /* write the line */
-	    if(fwrite(outbuf,1,H_DATA + (linelen<<1) + 3,out) == 0) {
-		ERR(H_ERR_IO);
-	    }
-	}
+/* Push parser. Complete lines are decoded where they lie in buf; only
+   a line that is split between chunks is copied, into p->line. buf is
+   NULL at the end of the input, which completes a last line that has
+   no newline. */
+int push_intel(HEXPUSH *p, UCHAR *buf, ULONG len)
+{
+    UCHAR	*nl;
+    ULONG	n;
 
-	rdlen = MIN(CPL,rdlen);
+    if(!buf) {
+	n = p->linelen;
+	p->linelen = 0;
+	if(!n || p->done || p->skipping)
+	    return H_ERR_NONE;
+	p->line[n++] = '\n';	/* there is room; see below */
+	return pushline_intel(p, p->line, n);
+    }
 
-	if((linelen = fread(&inbuf[B_DATA],1,rdlen,in)) > 0) {
+    while(len && !p->done) {
+	nl = memchr(buf, '\n', len);
+	n = nl ? (ULONG)(nl - buf) + 1 : len;
 
-	    if(addr > (MAXADDR_INTEL86 - (ULONG)(linelen-1))) {
-		/* address of some byte is too large */
-		ERR(H_ERR_ADDR);
+	if(p->skipping) {
+	    /* the rest of an overlong line, up to its newline */
+	    p->skipping = !nl;
+	}
+	else if(p->linelen + n > HEXLINEMAX - 1) {
+	    /* too long for a record, which may still be followed by
+	       blanks: like fgets() in rd_intel(), decode what fits and
+	       pass over the rest of the line */
+	    memcpy(p->line + p->linelen, buf, HEXLINEMAX - 1 - p->linelen);
+	    p->linelen = 0;
+	    if(pushline_intel(p, p->line, HEXLINEMAX - 1))
+		return hex_errno;
+	    p->skipping = !nl;
+	}
+	else if(nl && !p->linelen) {
+	    if(pushline_intel(p, buf, n))
+		return hex_errno;
+	}
+	else {
+	    memcpy(p->line + p->linelen, buf, n);
+	    p->linelen += n;
+	    if(nl) {
+		n = p->linelen;
+		p->linelen = 0;
+		if(pushline_intel(p, p->line, n))
+		    return hex_errno;
+		n = nl - buf + 1;
 	    }
+	}
+	buf += n;
+	len -= n;
+    }
+    return H_ERR_NONE;
+}
 
-	    inbuf[B_RTYPE] = REC_DATA;
 
-	    /* byte count */
-	    inbuf[B_BCOUNT] = (char)linelen;
+/*---------------------------------------------------------------*/
+/* Write one record to out. addr is the 16 bit record address. */
+static int wrrec_intel(FILE *out, int rtype, ULONG addr, UCHAR *data, int len)
+{
+    UCHAR	line[H_DATA + 2*255 + 3];
+    UCHAR	sum;
+
+    line[0] = ':';
+    line[H_BCOUNT]     = C2H_H(len);
+    line[H_BCOUNT + 1] = C2H_L(len);
+    line[H_ADDR]       = C2H_H(addr >> 8);
+    line[H_ADDR + 1]   = C2H_L(addr >> 8);
+    line[H_ADDR + 2]   = C2H_H(addr);
+    line[H_ADDR + 3]   = C2H_L(addr);
+    line[H_RTYPE]      = C2H_H(rtype);
+    line[H_RTYPE + 1]  = C2H_L(rtype);
+    sum = len + (addr >> 8) + addr + rtype;
+
+    sum += hex_sum8(data, len);
+    hex_encode(line + H_DATA, data, len);
+    sum = ~sum + 1;		/* 2's compl */
+    line[H_DATA + (len<<1)]     = C2H_H(sum);
+    line[H_DATA + (len<<1) + 1] = C2H_L(sum);
 
-	    /* address */
-	    inbuf[B_ADDR]   = (addr>>8) & 0xff;
-	    inbuf[B_ADDR+1] = addr & 0xff;
+    /* terminate with newline */
+    line[H_DATA + (len<<1) + 2] = '\n';
 
-	    /* calc checksum and convert to hex */
-	    for(inbuf[B_DATA+linelen]=0, i=0; i < B_DATA + linelen; i++) {
-		inbuf[B_DATA+linelen] += inbuf[i];
-		outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-		outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-	    }
-	    inbuf[B_DATA+linelen] = ~inbuf[B_DATA+linelen] + 1; /* 2's compl */
-	    outbuf[H_DATA + (linelen<<1)]     = C2H_H(inbuf[B_DATA+linelen]);
-	    outbuf[H_DATA + (linelen<<1) + 1] = C2H_L(inbuf[B_DATA+linelen]);
+    if(fwrite(line,1,H_DATA + (len<<1) + 3,out) == 0) {
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
 
-	    /* terminate with newline */
-	    outbuf[H_DATA + (linelen<<1) + 2] = '\n';
 
-	    /* write the line */
-	    if(fwrite(outbuf,1,H_DATA + (linelen<<1) + 3,out) == 0) {
-		ERR(H_ERR_IO);
-	    }
-	    addr += linelen;
+/* Write out the data collected by put_intel(), preceded by an
+   extended address record if the upper address bits have changed
+   since the last one. intel86 segment records specify bits 4-19 of
+   the address, but only bits 16-19 are used here because the data
+   record address fields can specify the other bits. intel32 output
+   uses extended linear address records only. */
+static int flush_intel(HEXSINK *s)
+{
+    UCHAR	ext[2];
+    ULONG	upper = s->recaddr & ~ADDRMASK;
+
+    if(!s->recfill)
+	return H_ERR_NONE;
+
+    if(s->format != FMT_INTEL && (!s->upperset || upper != s->upper)) {
+	if(s->format == FMT_INTEL86) {
+	    ext[0] = (upper >> 12) & 0xff;
+	    ext[1] = 0;
+	    if(wrrec_intel(s->out, REC_EXT, 0, ext, 2))
+		return hex_errno;
 	}
-	else if(ferror(in)) {
-	    /* error while reading */
-	    ERR(H_ERR_IO);
+	else {
+	    ext[0] = (upper >> 24) & 0xff;
+	    ext[1] = (upper >> 16) & 0xff;
+	    if(wrrec_intel(s->out, REC_EXTLIN, 0, ext, 2))
+		return hex_errno;
 	}
+	s->upper = upper;
+	s->upperset = TRUE;
     }
 
-    /* write end record */
-
-    /* byte count */
-    inbuf[B_BCOUNT] = 0;
-
-    /* address */
-    inbuf[B_ADDR]   = 0;
-    inbuf[B_ADDR+1] = 0;
+    if(wrrec_intel(s->out, REC_DATA, s->recaddr & ADDRMASK, s->rec,
+		   s->recfill))
+	return hex_errno;
+    s->recfill = 0;
+    return H_ERR_NONE;
+}
 
-    /* record type */
-    inbuf[B_RTYPE] = REC_EOF;
 
-    /* calc checksum and convert to hex */
-    for(inbuf[B_DATA]=0, i=0; i < B_DATA; i++) {
-	inbuf[B_DATA] += inbuf[i];
-	outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-	outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
+/*---------------------------------------------------------------*/
+/* Sink function for all three intel formats. Data is collected into
+   records of s->reclen bytes, which never cross a 64K boundary, so
+   the records written do not depend on how the data is split up
+   between calls. */
+int put_intel(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    ULONG	maxaddr = converters[s->format].maxaddr;
+    ULONG	n;
+
+    if(!len)
+	return H_ERR_NONE;
+    if(addr > maxaddr || len - 1 > maxaddr - addr) {
+	/* address of some byte is too large */
+	ERR(H_ERR_ADDR);
     }
-    inbuf[B_DATA] = ~inbuf[B_DATA] + 1; /* 2's compl */
-    outbuf[H_DATA]     = C2H_H(inbuf[B_DATA]);
-    outbuf[H_DATA + 1] = C2H_L(inbuf[B_DATA]);
-
-    /* terminate with newline */
-    outbuf[H_DATA + 2] = '\n';
 
-    /* write the line */
-    if(fwrite(outbuf,1,H_DATA + 3,out) == 0) {
-	ERR(H_ERR_IO);
+    while(len) {
+	/* a jump in address ends the pending record */
+	if(s->recfill && s->recaddr + s->recfill != addr)
+	    if(flush_intel(s))
+		return hex_errno;
+	if(!s->recfill)
+	    s->recaddr = addr;
+
+	n = MIN(len, (ULONG)(s->reclen - s->recfill));
+	n = MIN(n, (ADDRMASK + 1) - (addr & ADDRMASK));
+	memcpy(s->rec + s->recfill, data, n);
+	s->recfill += n;
+	addr += n;
+	data += n;
+	len -= n;
+
+	if(s->recfill == s->reclen || (addr & ADDRMASK) == 0)
+	    if(flush_intel(s))
+		return hex_errno;
     }
-
     return H_ERR_NONE;
 }
 
 
 /*---------------------------------------------------------------*/
-int wr_intel32(FILE *in, FILE *out, ULONG base, ULONG entry)
+int end_intel(HEXSINK *s, ULONG entry)
 {
-    UCHAR	inbuf[CPL+5];
-    UCHAR	outbuf[(2*CPL)+12];
-    ULONG	addr, rdlen;
-    int		linelen, i;
-    int		initsegment=TRUE;
-    
-    /* base and entry are absolute addresses. addr is the absolute
-       address of a given byte, and must be masked for various fields */
-    if(entry > MAXADDR_INTEL32) {
+    if(entry > converters[s->format].maxaddr) {
 	/* entry won't fit into its field */
 	ERR(H_ERR_ENTRY);
     }
-    addr = base;
-    outbuf[0] = ':';
-
-    while(!feof(in)) {
-
-	/* compute # of bytes left in this segment, and read
-	   min(bytes left, CPL) bytes for current data record */
-	rdlen = (ADDRMASK + 1) - (addr & ADDRMASK);
-
-	if((rdlen == ADDRMASK + 1) || initsegment) {
-	    /* time for a new extended linear address record */
-
-	    /* some programmers output an extended address segment
-	       record and an extended linear address record, but this
-	       code just uses an extended linear address record for
-	       bits 16-31, and does not output extended segment records */
-	    initsegment = FALSE;
-	    linelen = 2;
-	    inbuf[B_BCOUNT] = linelen;
-	    inbuf[B_ADDR] = 0;
-	    inbuf[B_ADDR+1] = 0;
-	    inbuf[B_RTYPE] = REC_EXTLIN;
-	    inbuf[B_DATA] = ((addr & ~ADDRMASK) >> 24) & 0xff;
-	    inbuf[B_DATA+1] = ((addr & ~ADDRMASK) >> 16) & 0xff;
-
-	    /* calc checksum and convert to hex */
-	    for(inbuf[B_DATA+linelen]=0, i=0; i < B_DATA + linelen; i++) {
-		inbuf[B_DATA+linelen] += inbuf[i];
-		outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-		outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-	    }
-	    inbuf[B_DATA+linelen] = ~inbuf[B_DATA+linelen] + 1; /* 2's compl */
-	    outbuf[H_DATA + (linelen<<1)]     = C2H_H(inbuf[B_DATA+linelen]);
-	    outbuf[H_DATA + (linelen<<1) + 1] = C2H_L(inbuf[B_DATA+linelen]);
-
-	    /* terminate with newline */
-	    outbuf[H_DATA + (linelen<<1) + 2] = '\n';
-
-	    /* write the line */
-	    if(fwrite(outbuf,1,H_DATA + (linelen<<1) + 3,out) == 0) {
-		ERR(H_ERR_IO);
-	    }
-	}
-
-	rdlen = MIN(CPL,rdlen);
-
-	if((linelen = fread(&inbuf[B_DATA],1,rdlen,in)) > 0) {
-
-	    if(addr > (MAXADDR_INTEL32 - (ULONG)(linelen-1))) {
-		/* address of some byte is too large */
-		ERR(H_ERR_ADDR);
-	    }
-
-	    inbuf[B_RTYPE] = REC_DATA;
-
-	    /* byte count */
-	    inbuf[B_BCOUNT] = (char)linelen;
-
-	    /* address */
-	    inbuf[B_ADDR]   = (addr>>8) & 0xff;
-	    inbuf[B_ADDR+1] = addr & 0xff;
-
-	    /* calc checksum and convert to hex */
-	    for(inbuf[B_DATA+linelen]=0, i=0; i < B_DATA + linelen; i++) {
-		inbuf[B_DATA+linelen] += inbuf[i];
-		outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-		outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
-	    }
-	    inbuf[B_DATA+linelen] = ~inbuf[B_DATA+linelen] + 1; /* 2's compl */
-	    outbuf[H_DATA + (linelen<<1)]     = C2H_H(inbuf[B_DATA+linelen]);
-	    outbuf[H_DATA + (linelen<<1) + 1] = C2H_L(inbuf[B_DATA+linelen]);
-
-	    /* terminate with newline */
-	    outbuf[H_DATA + (linelen<<1) + 2] = '\n';
-
-	    /* write the line */
-	    if(fwrite(outbuf,1,H_DATA + (linelen<<1) + 3,out) == 0) {
-		ERR(H_ERR_IO);
-	    }
-	    addr += linelen;
-	}
-
-	else if(ferror(in)) {
-	    /* error while reading */
-	    ERR(H_ERR_IO);
-	}
-    }
+    if(flush_intel(s))
+	return hex_errno;
 
     /* write end record */
+    return wrrec_intel(s->out, REC_EOF, 0, NULL, 0);
+}
 
-    /* byte count */
-    inbuf[B_BCOUNT] = 0;
-
-    /* address */
-    inbuf[B_ADDR]   = 0;
-    inbuf[B_ADDR+1] = 0;
 
-    /* record type */
-    inbuf[B_RTYPE] = REC_EOF;
+/*---------------------------------------------------------------*/
+/* Copy binary data from in to a sink for the given format. base and
+   entry are absolute addresses. */
+static int wr_any(FILE *in, FILE *out, ULONG base, ULONG entry, int format)
+{
+    HEXSINK	s;
 
-    /* calc checksum and convert to hex */
-    for(inbuf[B_DATA]=0, i=0; i < B_DATA; i++) {
-	inbuf[B_DATA] += inbuf[i];
-	outbuf[(i<<1)+1] = C2H_H(inbuf[i]);
-	outbuf[(i<<1)+2] = C2H_L(inbuf[i]);
+    if(entry > converters[format].maxaddr) {
+	/* entry won't fit into its field */
+	ERR(H_ERR_ENTRY);
     }
-    inbuf[B_DATA] = ~inbuf[B_DATA] + 1; /* 2's compl */
-    outbuf[H_DATA]     = C2H_H(inbuf[B_DATA]);
-    outbuf[H_DATA + 1] = C2H_L(inbuf[B_DATA]);
+    hex_sinkinit(&s, format, out);
+    return hex_wrsink(in, &s, base, entry);
+}
 
-    /* terminate with newline */
-    outbuf[H_DATA + 2] = '\n';
+int wr_intel(FILE *in, FILE *out, ULONG base, ULONG entry)
+{
+    return wr_any(in, out, base, entry, FMT_INTEL);
+}
 
-    /* write the line */
-    if(fwrite(outbuf,1,H_DATA + 3,out) == 0) {
-	ERR(H_ERR_IO);
-    }
+int wr_intel86(FILE *in, FILE *out, ULONG base, ULONG entry)
+{
+    return wr_any(in, out, base, entry, FMT_INTEL86);
+}
 
-    return H_ERR_NONE;
+int wr_intel32(FILE *in, FILE *out, ULONG base, ULONG entry)
+{
+    return wr_any(in, out, base, entry, FMT_INTEL32);
 }
 
 
@@ -556,7 +644,7 @@ int scan_intel(FILE *in, ULONG *size, ULONG *minaddr, ULONG *maxaddr,
     UCHAR	binbuf[LINEBUFLEN/2];
     ULONG	addr, base, linaddr;
     ULONG	Lsize, Lminaddr, Lmaxaddr, Lentry;
-    int		linelen, i;
+    int		linelen;
 
     /* This function does not check for bad hex data checksums or
        incorrect byte count fields.
@@ -581,9 +669,7 @@ int scan_intel(FILE *in, ULONG *size, ULONG *minaddr, ULONG *maxaddr,
 	    continue;
 
 	/* convert hex to chars */
-	for(i=0; i < (linelen-1) >> 1; i++) {
-	    binbuf[i] = H2C(&linebuf[(i << 1) + 1]);
-	}
+	hex_decode(binbuf, linebuf + 1, (linelen-1) >> 1);
 
 	/* process the line */
 	switch(binbuf[B_RTYPE]) {
@@ -609,7 +695,8 @@ int scan_intel(FILE *in, ULONG *size, ULONG *minaddr, ULONG *maxaddr,
 	    break;
 
 	  case REC_EXTLIN:	/* extended linear address record */
-	    linaddr = (binbuf[B_DATA] << 24) | (binbuf[B_DATA+1] << 16);
+	    linaddr = ((ULONG)binbuf[B_DATA] << 24) |
+		((ULONG)binbuf[B_DATA+1] << 16);
 	    break;
 
 	  case REC_STARTLIN:	/* start linear address record */
@@ -648,3 +735,128 @@ int scan_intel(FILE *in, ULONG *size, ULONG *minaddr, ULONG *maxaddr,
     
     return H_ERR_NONE;
 }
+
+
+/*---------------------------------------------------------------*/
+int sniff_intel(UCHAR *buf, int len, int format)
+{
+    UCHAR	binbuf[LINEBUFLEN/2];
+    UCHAR	checksum;
+    int		seen = 0, records = 0;
+    int		i, n, linelen;
+    UCHAR	*line, *end;
+
+    /* Look at the complete lines in the buffer only. Every line that
+       starts with a colon must be a well formed record with a good
+       checksum; the record types seen decide which of the intel
+       variants fits best. */
+    for(line = buf; line < buf + len; line = end + 1) {
+	for(end = line; end < buf + len && *end != '\n'; end++)
+	    ;
+	if(end == buf + len)
+	    break;			/* partial last line */
+
+	linelen = end - line;
+	if(linelen && line[linelen-1] == '\r')
+	    linelen--;
+	if(linelen == 0)
+	    continue;
+	if(line[0] != ':' || linelen < H_DATA + 2 || !(linelen & 1) ||
+	   linelen > LINEBUFLEN - 2)
+	    return 0;
+
+	for(i=1; i < linelen; i++)
+	    if(!isxdigit(line[i]))
+		return 0;
+	n = (linelen-1) >> 1;
+	hex_decode(binbuf, line + 1, n);
+	checksum = hex_sum8(binbuf, n);
+	if(checksum || n != B_DATA + binbuf[B_BCOUNT] + 1 ||
+	   binbuf[B_RTYPE] > REC_STARTLIN)
+	    return 0;
+
+	seen |= 1 << binbuf[B_RTYPE];
+	records++;
+	if(binbuf[B_RTYPE] == REC_EOF)
+	    break;
+    }
+
+    if(!records)
+	return 0;
+
+    switch(format) {
+      case FMT_INTEL:
+	return (seen & ~((1 << REC_DATA) | (1 << REC_EOF))) ? 0 : 3;
+
+      case FMT_INTEL86:
+	if(seen & ((1 << REC_EXTLIN) | (1 << REC_STARTLIN)))
+	    return 0;
+	return (seen & ((1 << REC_EXT) | (1 << REC_START))) ? 3 : 1;
+
+      case FMT_INTEL32:
+	return (seen & ((1 << REC_EXTLIN) | (1 << REC_STARTLIN))) ? 3 : 1;
+    }
+    return 1;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Repair the checksums of the records in buf (a whole file, mapped
+   writable), changing nothing but the two checksum characters of each
+   record whose checksum is wrong. Lines that are not records are left
+   alone, as rd_intel() would skip them; records too short for their
+   byte count or with characters that are not hex digits are counted
+   in fix->bad and also left alone. Stops after the end of file
+   record. */
+int fix_intel(UCHAR *buf, ULONG len, HEXFIX *fix)
+{
+    UCHAR	binbuf[B_DATA + 256 + 1];	/* longest record */
+    UCHAR	sum, *line, *end, *c;
+    ULONG	lineno;
+    int		i, n, linelen;
+
+    for(line = buf, lineno = 1; line < buf + len; line = end + 1, lineno++) {
+	if(!(end = memchr(line, '\n', buf + len - line)))
+	    end = buf + len;
+	linelen = end - line;
+	if(linelen && line[linelen-1] == '\r')
+	    linelen--;
+	if(linelen < H_DATA || line[0] != ':')
+	    continue;
+	fix->records++;
+
+	/* the byte count says how much of the line is the record */
+	n = 0;
+	if(hex_xspan(line + H_BCOUNT, 2) == 2) {
+	    hex_decode(binbuf, line + H_BCOUNT, 1);
+	    n = B_DATA + binbuf[B_BCOUNT] + 1;
+	}
+	if(!n || linelen < 1 + 2 * n ||
+	   hex_xspan(line + 1, 2 * n) != (ULONG)(2 * n)) {
+	    fix->bad++;
+	    if(fix->report)
+		fix->report(fix->arg, lineno, -1, -1);
+	    continue;
+	}
+
+	hex_decode(binbuf, line + 1, n);
+	sum = -hex_sum8(binbuf, n - 1);
+	if(binbuf[n-1] != sum) {
+	    if(fix->report)
+		fix->report(fix->arg, lineno, binbuf[n-1], sum);
+	    c = line + 1 + 2 * (n - 1);
+	    hex_encode(c, &sum, 1);
+	    /* keep to the case the record is written in */
+	    for(i=1; i < 1 + 2 * n && !islower(line[i]); i++)
+		;
+	    if(i < 1 + 2 * n) {
+		c[0] = tolower(c[0]);
+		c[1] = tolower(c[1]);
+	    }
+	    fix->fixed++;
+	}
+	if(binbuf[B_RTYPE] == REC_EOF)
+	    break;
+    }
+    return H_ERR_NONE;
+}
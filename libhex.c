@@ -69,8 +69,9 @@ char _nybble2hex_[] = {
     '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
 };
 
-int hex_errno=0;
-const int hex_nerr = 8;
+__thread int hex_errno=0;
+int hex_fill=0xff;
+const int hex_nerr = 13;
 const char *hex_errlist[] = {
     "No error",
     "Address too large for field",
@@ -78,7 +79,13 @@ const char *hex_errlist[] = {
     "Invalid hex data",
     "Unknown record type",
     "Bad checksum",
-    "Entry address too large for field"
+    "Entry address too large for field",
+    "Invalid digest or checksum stamp",
+    "Overlapping data",
+    "Invalid index, or format cannot be indexed",
+    "Not supported for this format",
+    "Addresses out of order",
+    "Invalid transform"
 };
 
 void hex_perror(char *s)
@@ -118,12 +125,47 @@ int fcat(FILE *in, FILE *out)
 }
 
 
+int hex_detect(UCHAR *buf, int len)
+{
+    int		i, score, best = 0, format = FMT_UNDEF;
+
+    /* check the magic number of each format, then let the format's
+       sniff function judge how well the rest of the block fits. The
+       best score wins; ties go to the earlier entry in converters[] */
+    for(i=0; converters[i].name; i++) {
+	if(!converters[i].magic_len && !converters[i].sniff_hex)
+	    continue;
+	if(converters[i].magic_len) {
+	    if(len < converters[i].magic_offset + converters[i].magic_len)
+		continue;
+	    if(memcmp(buf + converters[i].magic_offset, converters[i].magic,
+		      converters[i].magic_len))
+		continue;
+	}
+	score = converters[i].sniff_hex ?
+	    converters[i].sniff_hex(buf, len, i) : 1;
+	if(score > best) {
+	    best = score;
+	    format = i;
+	}
+    }
+    return format;
+}
+
+
 CONVSTRUCT converters[] = {
     {"intel","Intel Intellec 8/MDS",
-	 MAXADDR_INTEL,rd_intel,wr_intel,scan_intel,"",0,0},
+	 MAXADDR_INTEL,rd_intel,wr_intel,scan_intel,":",1,0,sniff_intel,
+	 ld_intel,put_intel,end_intel,ix_intel,ldix_intel,
+	 push_intel,fix_intel,tab_intel},
     {"intel86","Intel MCS-86 Hexadecimal Object",
-	 MAXADDR_INTEL86,rd_intel,wr_intel86,scan_intel,":",1,0},
+	 MAXADDR_INTEL86,rd_intel,wr_intel86,scan_intel,":",1,0,sniff_intel,
+	 ld_intel,put_intel,end_intel,ix_intel,ldix_intel,
+	 push_intel,fix_intel,tab_intel},
     {"intel32","Intel Hex-32",
-	 MAXADDR_INTEL32,rd_intel,wr_intel32,scan_intel,":",1,0},
-    {NULL,NULL,0,NULL,NULL,NULL,NULL,0,0}
+	 MAXADDR_INTEL32,rd_intel,wr_intel32,scan_intel,":",1,0,sniff_intel,
+	 ld_intel,put_intel,end_intel,ix_intel,ldix_intel,
+	 push_intel,fix_intel,tab_intel},
+    {NULL,NULL,0,NULL,NULL,NULL,NULL,0,0,NULL,NULL,NULL,NULL,NULL,NULL,NULL,
+	 NULL,NULL}
 };
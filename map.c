@@ -0,0 +1,164 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Extent maps. A HEXMAP lists the runs of contiguous addresses that
+ * hold data, without the data itself, so the layout of a hex file can
+ * be found in one pass and used to size images, split up work or pick
+ * output files before anything is decoded into memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+#define MAPBUFLEN	65536	/* read size when scanning */
+
+
+/*---------------------------------------------------------------*/
+void hex_mapinit(HEXMAP *map)
+{
+    memset(map, 0, sizeof(*map));
+    map->sorted = TRUE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_mapfree(HEXMAP *map)
+{
+    free(map->ext);
+    hex_mapinit(map);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Note that addresses addr to addr+len-1 hold data */
+int hex_mapadd(HEXMAP *map, ULONG addr, ULONG len)
+{
+    HEXEXTENT	*e, *ne;
+    int		n;
+
+    if(!len)
+	return H_ERR_NONE;
+    map->size += len;
+
+    /* data usually follows on from the record before it */
+    e = map->next ? &map->ext[map->next-1] : NULL;
+    if(e && e->addr + e->len == addr) {
+	e->len += len;
+	return H_ERR_NONE;
+    }
+
+    if(e && addr < e->addr + e->len)
+	map->sorted = FALSE;
+    if(map->next == map->extalloc) {
+	n = map->extalloc ? map->extalloc * 2 : 64;
+	if(!(ne = realloc(map->ext, n * sizeof(HEXEXTENT)))) {
+	    ERR(H_ERR_IO);
+	}
+	map->ext = ne;
+	map->extalloc = n;
+    }
+    e = &map->ext[map->next++];
+    e->addr = addr;
+    e->len = len;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int cmpext(const void *a, const void *b)
+{
+    const HEXEXTENT *ea = a, *eb = b;
+
+    return ea->addr < eb->addr ? -1 : ea->addr > eb->addr;
+}
+
+/* Sort the extents and merge those that touch or overlap */
+void hex_mapsort(HEXMAP *map)
+{
+    HEXEXTENT	*e = map->ext;
+    ULONG	end;
+    int		i, n;
+
+    if(map->sorted)
+	return;
+    qsort(e, map->next, sizeof(HEXEXTENT), cmpext);
+
+    for(n=0, i=0; i < map->next; i++) {
+	if(n && e[i].addr <= e[n-1].addr + e[n-1].len) {
+	    end = MAX(e[n-1].addr + e[n-1].len, e[i].addr + e[i].len);
+	    e[n-1].len = end - e[n-1].addr;
+	}
+	else
+	    e[n++] = e[i];
+    }
+    map->next = n;
+    map->sorted = TRUE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Bytes of address space covered by the (sorted) map */
+ULONG hex_mapused(HEXMAP *map)
+{
+    ULONG	used = 0;
+    int		i;
+
+    hex_mapsort(map);
+    for(i=0; i < map->next; i++)
+	used += map->ext[i].len;
+    return used;
+}
+
+
+/*---------------------------------------------------------------*/
+static int mapadd(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    return hex_mapadd(arg, addr, len);
+}
+
+/* Map the data in the hex file in, which is in the given format, in
+   one pass with the format's push parser. The result is sorted. */
+int hex_scanmap(FILE *in, int format, int ignoresum, HEXMAP *map)
+{
+    HEXPUSH	p;
+    UCHAR	buf[MAPBUFLEN];
+    size_t	n;
+
+    if(hex_pushinit(&p, format, ignoresum, mapadd, map))
+	return hex_errno;
+    while(!p.done && (n = fread(buf, 1, MAPBUFLEN, in)) > 0)
+	if(hex_push(&p, buf, n))
+	    return hex_errno;
+    if(ferror(in)) {
+	ERR(H_ERR_IO);
+    }
+    if(hex_pushend(&p))
+	return hex_errno;
+    map->entry = p.entry;
+    hex_mapsort(map);
+    return H_ERR_NONE;
+}
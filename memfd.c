@@ -0,0 +1,211 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Shared memory output. An image that another process (such as a
+ * programmer driver) is going to read need not go through a file:
+ * hex_shmopen() gives a stream that writes into an anonymous memfd,
+ * hex_shmseal() seals it once the conversion is done, so the reader
+ * can map it knowing it will never change, and hex_shmsend() or
+ * hex_shmshow() hand the descriptor over, either passed down a unix
+ * socket or named by its /proc path. Nothing touches a filesystem,
+ * and the reader maps the same pages the image was written to.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "etools.h"
+#include "hex.h"
+
+/* memfd_create() and sealing came with Linux 3.17 and glibc 2.27 */
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define HAVE_MEMFD
+#define SHMSEALS	(F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL)
+#endif
+
+
+/*---------------------------------------------------------------*/
+/* Open a stream that writes to a new memfd called name. *fd is set to
+   the memfd itself, which stays open when the stream is closed. */
+FILE *hex_shmopen(char *name, int *fd)
+{
+#ifdef HAVE_MEMFD
+    FILE	*f;
+    int		wfd;
+
+    if((*fd = memfd_create(name, MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    if((wfd = dup(*fd)) < 0 || !(f = fdopen(wfd, "w"))) {
+	if(wfd >= 0)
+	    close(wfd);
+	close(*fd);
+	*fd = -1;
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return f;
+#else
+    *fd = -1;
+    errno = ENOSYS;
+    hex_errno = H_ERR_IO;
+    return NULL;
+#endif
+}
+
+
+/*---------------------------------------------------------------*/
+/* Seal the memfd against any further change, once the stream that
+   writes it has been closed. *size is set to its size. */
+int hex_shmseal(int fd, ULONG *size)
+{
+#ifdef HAVE_MEMFD
+    struct stat	st;
+
+    if(fcntl(fd, F_ADD_SEALS, SHMSEALS) || fstat(fd, &st)) {
+	ERR(H_ERR_IO);
+    }
+    *size = st.st_size;
+    return H_ERR_NONE;
+#else
+    errno = ENOSYS;
+    ERR(H_ERR_IO);
+#endif
+}
+
+
+/*---------------------------------------------------------------*/
+/* Pass the memfd to the process listening on the unix socket sockname
+   (a name starting with @ is in the abstract namespace), with msg as
+   the data that goes with it. */
+int hex_shmsend(int fd, char *sockname, char *msg)
+{
+    struct sockaddr_un	sun;
+    struct msghdr	mh;
+    struct iovec	iov;
+    struct cmsghdr	*cm;
+    union {
+	char		buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr	align;
+    } ctl;
+    socklen_t		sunlen;
+    int			s, ret;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if(strlen(sockname) >= sizeof(sun.sun_path)) {
+	errno = ENAMETOOLONG;
+	ERR(H_ERR_IO);
+    }
+    strcpy(sun.sun_path, sockname);
+    sunlen = offsetof(struct sockaddr_un, sun_path) + strlen(sockname);
+    if(sockname[0] == '@')
+	sun.sun_path[0] = '\0';
+    else
+	sunlen++;
+
+    if((s = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0) {
+	ERR(H_ERR_IO);
+    }
+    if(connect(s, (struct sockaddr *)&sun, sunlen)) {
+	close(s);
+	ERR(H_ERR_IO);
+    }
+
+    /* the descriptor goes with the first byte of msg */
+    memset(&mh, 0, sizeof(mh));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base = msg;
+    iov.iov_len = strlen(msg);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    ret = sendmsg(s, &mh, MSG_NOSIGNAL) == (ssize_t)iov.iov_len;
+    if(close(s) || !ret) {
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* TRUE if out is a pipe or a socket, so that hex_shmshow() can tell
+   when its reader goes away. */
+int hex_shmpipe(FILE *out)
+{
+    struct stat		st;
+
+    if(fstat(fileno(out), &st))
+	return FALSE;
+    return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Print the /proc path of the memfd and msg on out, then hold the
+   memfd open until the reader of out goes away, so that it has time
+   to open the path. out must be a pipe or a socket to the reader;
+   on anything else nothing would end the wait, so that is an
+   error. */
+int hex_shmshow(int fd, FILE *out, char *msg)
+{
+    struct pollfd	pfd;
+
+    if(!hex_shmpipe(out)) {
+	errno = ESPIPE;
+	ERR(H_ERR_IO);
+    }
+    fprintf(out, "/proc/%ld/fd/%d %s", (long)getpid(), fd, msg);
+    if(fflush(out)) {
+	ERR(H_ERR_IO);
+    }
+
+    /* the write end of a pipe reports an error once the read end is
+       closed */
+    pfd.fd = fileno(out);
+    pfd.events = 0;
+    while(poll(&pfd, 1, -1) < 0) {
+	if(errno != EINTR) {
+	    ERR(H_ERR_IO);
+	}
+    }
+    return H_ERR_NONE;
+}
@@ -0,0 +1,373 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Pipelined streams. hex_pipein() and hex_pipeout() wrap a FILE in
+ * another FILE whose reading or writing is done by a separate thread,
+ * so that I/O waits overlap with the conversion running on the calling
+ * thread. Since the converters only see stdio streams, this works for
+ * every entry in converters[]: with both ends wrapped, a conversion
+ * runs as a reader thread, the converter, and a writer thread.
+ *
+ * Each side is a ring of PIPEDEPTH blocks of PIPEBLOCK bytes with one
+ * producer and one consumer. The ring itself takes no locks; each
+ * index is only moved by its own side, and a pair of counting
+ * semaphores hands over the slots, which also gives back-pressure
+ * when the consumer falls behind. A block of length 0 marks the end
+ * of the stream.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include "etools.h"
+#include "hex.h"
+
+#define PIPEBLOCK	(256*1024)	/* bytes per block */
+#define PIPEDEPTH	8		/* blocks per ring */
+
+typedef struct pipecookie {
+    FILE	*f;		/* underlying stream */
+    UCHAR	*buf[PIPEDEPTH];
+    size_t	len[PIPEDEPTH];
+    sem_t	full;		/* blocks ready for the consumer */
+    sem_t	free;		/* blocks ready for the producer */
+    int		head;		/* next block to fill (producer only) */
+    int		tail;		/* next block to drain (consumer only) */
+    size_t	used;		/* bytes of the current block done */
+    int		running;	/* thread is running */
+    int		stop;		/* asks the reader thread to stop */
+    int		err;		/* errno from the thread, or 0 */
+    off_t	pos;		/* position in the stream */
+    pthread_t	thread;
+} PIPECOOKIE;
+
+
+/* allocate a cookie and its blocks */
+static PIPECOOKIE *pipe_alloc(FILE *f)
+{
+    PIPECOOKIE	*pc;
+    int		i;
+
+    if(!(pc = calloc(1, sizeof(*pc))))
+	return NULL;
+    for(i=0; i < PIPEDEPTH; i++) {
+	if(!(pc->buf[i] = malloc(PIPEBLOCK))) {
+	    while(i--)
+		free(pc->buf[i]);
+	    free(pc);
+	    return NULL;
+	}
+    }
+    pc->f = f;
+    return pc;
+}
+
+static void pipe_free(PIPECOOKIE *pc)
+{
+    int		i;
+
+    for(i=0; i < PIPEDEPTH; i++)
+	free(pc->buf[i]);
+    free(pc);
+}
+
+
+/*---------------------------------------------------------------*/
+/* read side: the thread fills blocks from the underlying stream */
+
+static void *pipe_reader(void *arg)
+{
+    PIPECOOKIE	*pc = arg;
+    size_t	n;
+
+    do {
+	sem_wait(&pc->free);
+	n = 0;
+	if(!__atomic_load_n(&pc->stop, __ATOMIC_ACQUIRE)) {
+	    n = fread(pc->buf[pc->head], 1, PIPEBLOCK, pc->f);
+	    if(n < PIPEBLOCK && ferror(pc->f))
+		pc->err = errno ? errno : EIO;
+	}
+	pc->len[pc->head] = n;
+	pc->head = (pc->head + 1) % PIPEDEPTH;
+	sem_post(&pc->full);
+    } while(n);
+    return NULL;
+}
+
+static int pipe_start(PIPECOOKIE *pc)
+{
+    sem_init(&pc->full, 0, 0);
+    sem_init(&pc->free, 0, PIPEDEPTH);
+    pc->head = pc->tail = 0;
+    pc->used = 0;
+    pc->stop = FALSE;
+    if(pthread_create(&pc->thread, NULL, pipe_reader, pc))
+	return -1;
+    pc->running = TRUE;
+    return 0;
+}
+
+/* stop the reader thread, throwing away what it has read ahead. The
+   thread may be blocked waiting for a free block, so the blocks are
+   drained until its end marker turns up. */
+static void pipe_stop(PIPECOOKIE *pc)
+{
+    size_t	n;
+
+    if(!pc->running)
+	return;
+    __atomic_store_n(&pc->stop, TRUE, __ATOMIC_RELEASE);
+    do {
+	sem_wait(&pc->full);
+	n = pc->len[pc->tail];
+	pc->tail = (pc->tail + 1) % PIPEDEPTH;
+	sem_post(&pc->free);
+    } while(n);
+    pthread_join(pc->thread, NULL);
+    sem_destroy(&pc->full);
+    sem_destroy(&pc->free);
+    pc->running = FALSE;
+}
+
+static ssize_t pipe_read(void *cookie, char *buf, size_t size)
+{
+    PIPECOOKIE	*pc = cookie;
+    size_t	n, done = 0;
+
+    while(done < size && pc->running) {
+	/* the block at tail is only ours once full has been taken */
+	if(!pc->used)
+	    sem_wait(&pc->full);
+	n = pc->len[pc->tail];
+	if(!n) {
+	    /* end of stream; leave the marker for the next read */
+	    sem_post(&pc->full);
+	    if(pc->err && !done) {
+		errno = pc->err;
+		return -1;
+	    }
+	    break;
+	}
+	n = MIN(n - pc->used, size - done);
+	memcpy(buf + done, pc->buf[pc->tail] + pc->used, n);
+	done += n;
+	pc->used += n;
+	if(pc->used == pc->len[pc->tail]) {
+	    pc->used = 0;
+	    pc->tail = (pc->tail + 1) % PIPEDEPTH;
+	    sem_post(&pc->free);
+	}
+    }
+    pc->pos += done;
+    return done;
+}
+
+/* seeking stops the reader, moves the underlying stream and starts
+   reading ahead again from there */
+static int pipe_seek(void *cookie, off64_t *offset, int whence)
+{
+    PIPECOOKIE	*pc = cookie;
+    off_t	target;
+
+    target = *offset;
+    if(whence == SEEK_CUR) {
+	target += pc->pos;
+	whence = SEEK_SET;
+    }
+    if(whence == SEEK_SET && target == pc->pos) {
+	/* ftell() lands here; don't throw the read-ahead away */
+	*offset = target;
+	return 0;
+    }
+
+    if(pc->used)
+	sem_post(&pc->full);	/* give back the block we were reading */
+    pipe_stop(pc);
+
+    clearerr(pc->f);
+    if(fseeko(pc->f, target, whence) || (target = ftello(pc->f)) < 0 ||
+       pipe_start(pc))
+	return -1;
+    pc->pos = target;
+    *offset = target;
+    return 0;
+}
+
+static int pipe_rclose(void *cookie)
+{
+    PIPECOOKIE	*pc = cookie;
+    int		ret;
+
+    if(pc->used)
+	sem_post(&pc->full);
+    pipe_stop(pc);
+    ret = fclose(pc->f);
+    pipe_free(pc);
+    return ret;
+}
+
+/* Return a stream that delivers in, read ahead by a separate thread.
+   Seeking is passed on to in. Closing the returned stream closes in.
+   Returns NULL and sets hex_errno on failure. */
+FILE *hex_pipein(FILE *in)
+{
+    static cookie_io_functions_t rdfuncs = {
+	pipe_read, NULL, pipe_seek, pipe_rclose
+    };
+    PIPECOOKIE	*pc;
+    FILE	*f;
+
+    if(!(pc = pipe_alloc(in))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    if((pc->pos = ftello(in)) < 0)
+	pc->pos = 0;
+    if(pipe_start(pc)) {
+	pipe_free(pc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    if(!(f = fopencookie(pc, "r", rdfuncs))) {
+	pipe_rclose(pc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return f;
+}
+
+
+/*---------------------------------------------------------------*/
+/* write side: the thread drains blocks into the underlying stream */
+
+static void *pipe_writer(void *arg)
+{
+    PIPECOOKIE	*pc = arg;
+    size_t	n;
+
+    do {
+	sem_wait(&pc->full);
+	n = pc->len[pc->tail];
+	if(n && !pc->err && fwrite(pc->buf[pc->tail], 1, n, pc->f) != n)
+	    pc->err = errno ? errno : EIO;
+	pc->tail = (pc->tail + 1) % PIPEDEPTH;
+	sem_post(&pc->free);
+    } while(n);
+    if(!pc->err && fflush(pc->f))
+	pc->err = errno ? errno : EIO;
+    return NULL;
+}
+
+/* hand the block at head to the writer thread, and wait for the next
+   free one */
+static void pipe_put(PIPECOOKIE *pc, size_t n)
+{
+    pc->len[pc->head] = n;
+    pc->head = (pc->head + 1) % PIPEDEPTH;
+    sem_post(&pc->full);
+    if(n)
+	sem_wait(&pc->free);
+}
+
+static ssize_t pipe_write(void *cookie, const char *buf, size_t size)
+{
+    PIPECOOKIE	*pc = cookie;
+    size_t	n, done = 0;
+
+    if(pc->err) {
+	errno = pc->err;
+	return -1;
+    }
+    while(done < size) {
+	n = MIN(PIPEBLOCK - pc->used, size - done);
+	memcpy(pc->buf[pc->head] + pc->used, buf + done, n);
+	pc->used += n;
+	done += n;
+	if(pc->used == PIPEBLOCK) {
+	    pipe_put(pc, PIPEBLOCK);
+	    pc->used = 0;
+	}
+    }
+    pc->pos += done;
+    return done;
+}
+
+static int pipe_wclose(void *cookie)
+{
+    PIPECOOKIE	*pc = cookie;
+    int		ret;
+
+    if(pc->used)
+	pipe_put(pc, pc->used);
+    pipe_put(pc, 0);		/* end marker */
+    pthread_join(pc->thread, NULL);
+    sem_destroy(&pc->full);
+    sem_destroy(&pc->free);
+
+    ret = fclose(pc->f);
+    if(pc->err) {
+	errno = pc->err;
+	ret = EOF;
+    }
+    pipe_free(pc);
+    return ret;
+}
+
+/* Return a stream whose data is written to out by a separate thread.
+   Write errors are reported by a later write or by fclose(). Closing
+   the returned stream flushes and closes out. Returns NULL and sets
+   hex_errno on failure. */
+FILE *hex_pipeout(FILE *out)
+{
+    static cookie_io_functions_t wrfuncs = {
+	NULL, pipe_write, NULL, pipe_wclose
+    };
+    PIPECOOKIE	*pc;
+    FILE	*f;
+
+    if(!(pc = pipe_alloc(out))) {
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    sem_init(&pc->full, 0, 0);
+    sem_init(&pc->free, 0, PIPEDEPTH - 1);	/* head is ours already */
+    if(pthread_create(&pc->thread, NULL, pipe_writer, pc)) {
+	pipe_free(pc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    pc->running = TRUE;
+    if(!(f = fopencookie(pc, "w", wrfuncs))) {
+	pipe_wclose(pc);
+	hex_errno = H_ERR_IO;
+	return NULL;
+    }
+    return f;
+}
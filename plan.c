@@ -0,0 +1,218 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Conversion planning. hex2bin can decode a file in more than one way,
+ * and which is quickest, or which fits at all, depends on the file and
+ * the machine. hex_plan() looks at the size of the input, whether it
+ * can be rewound, the layout of the records in its first block, the
+ * number of CPUs and the memory budget, and picks the strategy and the
+ * settings for it. The choice can be printed with hex_planprint().
+ *
+ * The strategies:
+ *
+ *   dense	rd_hex(): scan the file for its address range, then
+ *		decode it into one buffer the size of that range. Two
+ *		passes, and the input must be rewound between them.
+ *   spill	push parse into a HEXSPILL (see spill.c). One pass with
+ *		the faster push parser, at most the budget in memory,
+ *		and records beyond it spilled to a temporary file.
+ *   stream	push parse straight to the output (see stream.c), only
+ *		when asked for. Output starts at once and memory use
+ *		is small, while the addresses ascend; the budget is
+ *		for the spill it falls back to if they do not.
+ *
+ * and the pipelined streams (see pipe.c) on top of either, which only
+ * pay where a second CPU can run the I/O thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "etools.h"
+#include "hex.h"
+
+#define PLANPIPEMIN	(4UL*1024*1024)	/* smallest input worth pipelining */
+#define PLANMEMDIV	4		/* default budget: memory / this */
+
+
+/*---------------------------------------------------------------*/
+/* Fill in what can be found out about the input (infd, decompressed
+   on the fly if compressed is set), the output and the machine. */
+void hex_planinit(HEXPLAN *p, int infd, int compressed, int outfd)
+{
+    struct stat	st;
+    long	pages, pagesize;
+
+    memset(p, 0, sizeof(*p));
+    if(infd >= 0 && !fstat(infd, &st) && S_ISREG(st.st_mode)) {
+	/* a compressed file's size says little about the data in it */
+	p->insize = compressed ? 0 : st.st_size;
+	p->inseek = !compressed;
+    }
+    p->outseek = outfd >= 0 && !fstat(outfd, &st) && S_ISREG(st.st_mode);
+
+    p->ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(p->ncpu < 1)
+	p->ncpu = 1;
+    pages = sysconf(_SC_PHYS_PAGES);
+    pagesize = sysconf(_SC_PAGESIZE);
+    if(pages > 0 && pagesize > 0)
+	p->budget = (ULONG)MIN((double)pages * pagesize / PLANMEMDIV,
+			       (double)(ULONG)-1 / 2);
+    p->budget = MAX(p->budget, SPILLMIN);
+}
+
+
+/*---------------------------------------------------------------*/
+/* the data bytes and address span of the records in the sample */
+typedef struct plansample {
+    ULONG	data;
+    ULONG	lo, hi;
+} PLANSAMPLE;
+
+static int planrec(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    PLANSAMPLE	*s = arg;
+
+    if(!s->data || addr < s->lo)
+	s->lo = addr;
+    if(!s->data || addr + len - 1 > s->hi)
+	s->hi = addr + len - 1;
+    s->data += len;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Make the plan for a file in format, of which sample holds the first
+   len bytes. Set maxmem or pipelined first to keep them as given, and
+   stream to ask for a stream. */
+void hex_plan(HEXPLAN *p, int format, UCHAR *sample, int len)
+{
+    HEXPUSH	push;
+    PLANSAMPLE	s;
+
+    /* how much of the input is data, going by the first block (a
+       partial line at its end is never decoded, which the estimate
+       can stand) */
+    memset(&s, 0, sizeof(s));
+    p->format = format;
+    if(converters[format].push_hex && len > 0 &&
+       !hex_pushinit(&push, format, TRUE, planrec, &s) &&
+       !hex_push(&push, sample, len) && s.data) {
+	p->ratio = (int)(s.data * 100 / len);
+	p->density = (int)MIN(s.data * 100 / (s.hi - s.lo + 1), 100);
+	if(p->insize)
+	    p->estdata = (ULONG)((double)p->insize * s.data / len);
+    }
+
+    /* One pass beats two wherever it can be had. Without a push parser
+       the dense path is left, which needs a file it can rewind. */
+    if(converters[format].push_hex || p->maxmem) {
+	p->how = p->stream && converters[format].push_hex ? PLAN_STREAM :
+	    PLAN_SPILL;
+	if(!p->maxmem) {
+	    /* no more than the data could be: a byte for every two
+	       characters of input, and the spill's record table */
+	    p->maxmem = p->budget;
+	    if(p->insize)
+		p->maxmem = MIN(p->maxmem, p->insize / 2 + p->insize / 14);
+	    p->maxmem = MAX(p->maxmem, SPILLMIN);
+	}
+    }
+    else {
+	p->how = PLAN_DENSE;
+	p->spool = !p->inseek;
+    }
+
+    /* the I/O threads only help if they have a CPU of their own, and
+       the input is big enough to make up for starting them. A stream
+       is left alone: its output thread would keep the first bytes
+       back, and its output could not be read back to fall back. */
+    if(!p->pipelined && p->how != PLAN_STREAM)
+	p->pipelined = p->ncpu > 1 &&
+	    (!p->insize || p->insize >= PLANPIPEMIN);
+}
+
+
+/*---------------------------------------------------------------*/
+static void planbytes(FILE *f, ULONG n)
+{
+    if(n >= 10UL*1024*1024)
+	fprintf(f, "%lum", n >> 20);
+    else if(n >= 10UL*1024)
+	fprintf(f, "%luk", n >> 10);
+    else
+	fprintf(f, "%lu", n);
+}
+
+/* Report the plan, and what it was made from */
+void hex_planprint(HEXPLAN *p, FILE *f)
+{
+    fprintf(f, "(plan: input ");
+    if(p->insize) {
+	planbytes(f, p->insize);
+	fprintf(f, " bytes");
+    }
+    else
+	fprintf(f, "of unknown size");
+    fprintf(f, ", %s; output %s; %d cpu%s; memory budget ",
+	    p->inseek ? "seekable" : "not seekable",
+	    p->outseek ? "seekable" : "not seekable", p->ncpu,
+	    p->ncpu == 1 ? "" : "s");
+    planbytes(f, p->budget);
+    fprintf(f, ")\n");
+
+    if(p->ratio) {
+	fprintf(f, "(plan: first block is %d%% data, %d%% dense", p->ratio,
+		p->density);
+	if(p->estdata) {
+	    fprintf(f, "; about ");
+	    planbytes(f, p->estdata);
+	    fprintf(f, " bytes of data");
+	}
+	fprintf(f, ")\n");
+    }
+
+    if(p->how == PLAN_STREAM) {
+	fprintf(f, "(plan: stream: one pass, written as it is decoded; "
+		"falls back to a spill of at most ");
+	planbytes(f, p->maxmem);
+	fprintf(f, " bytes");
+    }
+    else if(p->how == PLAN_SPILL) {
+	fprintf(f, "(plan: spill: one pass, at most ");
+	planbytes(f, p->maxmem);
+	fprintf(f, " bytes of memory%s",
+		p->estdata > p->maxmem ? ", spilling the rest" : "");
+    }
+    else
+	fprintf(f, "(plan: dense: scan, then decode into one buffer%s",
+		p->spool ? ", from a copy of the input" : "");
+    fprintf(f, "; %s)\n", p->pipelined ? "pipelined" :
+	    p->how == PLAN_STREAM ? "not pipelined" :
+	    p->ncpu > 1 ? "not pipelined, too small" :
+	    "not pipelined, one cpu");
+}
@@ -0,0 +1,73 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Push parsing, for hex data that arrives in pieces (over a socket,
+ * say) and should be acted on before all of it is there. The format's
+ * push_hex function in converters[] does the decoding.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+
+/*---------------------------------------------------------------*/
+/* Set up a parser for the given format. rec(arg, addr, data, len) is
+   called for every run of data decoded; if it returns non-zero, the
+   parse stops and hex_push() returns that value, which should be one
+   of the H_ERR_* codes. */
+int hex_pushinit(HEXPUSH *p, int format, int ignoresum, HEXRECFUNC *rec,
+		 void *arg)
+{
+    memset(p, 0, sizeof(*p));
+    if(!converters[format].push_hex) {
+	ERR(H_ERR_UNSUP);
+    }
+    p->format = format;
+    p->ignoresum = ignoresum;
+    p->rec = rec;
+    p->arg = arg;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Feed the next len bytes of hex data. Anything after the end record
+   is ignored. */
+int hex_push(HEXPUSH *p, UCHAR *buf, ULONG len)
+{
+    if(!len)
+	return H_ERR_NONE;
+    return converters[p->format].push_hex(p, buf, len);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Signal the end of the data */
+int hex_pushend(HEXPUSH *p)
+{
+    return converters[p->format].push_hex(p, NULL, 0);
+}
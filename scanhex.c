@@ -0,0 +1,347 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* scanhex: report the size, address range and entry address of hex
+   files, or with -map the extents of contiguous data in them, or with
+   -overlap the records that overlap, or with -repair fix their record
+   checksums in place. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+#include "tools.h"
+
+static void scanusage(void)
+{
+    int i;
+
+    fprintf(stderr,"scanhex %s\n", VERSION);
+    fprintf(stderr,"\nUsage:  scanhex [-f{format}] [-i] [-map] [-a[{depth}]] "\
+	    "[-overlap]\n                [-repair] [-q] [-] [{file} ...]\n");
+    fprintf(stderr,"        scanhex -help\n");
+    fprintf(stderr,"        scanhex -?\n");
+    fprintf(stderr,"        scanhex -version\n");
+    fprintf(stderr,"\n    -map lists each range of contiguous addresses "\
+	    "that holds data.\n    Standard input is scanned if no files "\
+	    "are given.\n");
+    fprintf(stderr,"\n    -overlap lists each data record that overlaps "\
+	    "an earlier one, with\n    the file offsets of both records.\n");
+    fprintf(stderr,"\n    -repair rewrites the checksum of every record "\
+	    "whose checksum is wrong,\n    in place, and lists them. "\
+	    "Nothing else in the file changes;\n    malformed records "\
+	    "are listed and left alone.\n");
+    fprintf(stderr,"\n    -a reads up to {depth} (default %d) files at once, "\
+	    "through io_uring\n    if the kernel allows it (%s here), and "\
+	    "scans each as it arrives.\n", HEXRDDEPTH,
+	    hex_uringok() ? "it does" : "it does not");
+    fprintf(stderr,"\n    formats supported:\n");
+    for(i=0; converters[i].name; i++) {
+	fprintf(stderr,"        %-16s %s\n", converters[i].name,
+		converters[i].desc);
+    }
+}
+
+
+/* the options, and the files to scan */
+typedef struct scanopts {
+    int		format, map, overlap, ignoresum, quiet, repair;
+    char	**names;
+    int		ret;		/* 1 if any file could not be scanned */
+} SCANOPTS;
+
+
+/* list a record that overlaps an earlier one */
+static void tabreport(void *arg, ULONG was, ULONG row)
+{
+    HEXTABLE	*t = arg;
+
+    printf("0x%08lX-0x%08lX at offset %lu overlaps 0x%08lX-0x%08lX at "
+	   "offset %lu\n", t->addr[row], t->addr[row] + t->len[row] - 1,
+	   t->src[row], t->addr[was], t->addr[was] + t->len[was] - 1,
+	   t->src[was]);
+}
+
+
+/* scan the open stream in, which is closed afterwards unless it is
+   stdin. format is as hex_fopen() left it. */
+static int scanstream(FILE *in, char *label, int format, SCANOPTS *o)
+{
+    HEXMAP	m;
+    HEXTABLE	t;
+    ULONG	size, minaddr, maxaddr, entry, used, n, nrec;
+    int		i, ret, map = o->map, quiet = o->quiet;
+
+    if (format == FMT_UNDEF) {
+	format = FMT_DEFAULT;
+	if (!quiet)
+	    fprintf(stderr,"(%s: unknown format, assuming %s)\n", label,
+		    converters[format].name);
+    }
+
+    if (o->overlap) {
+	hex_tabinit(&t);
+	if (!(ret = hex_tabload(in, format, o->ignoresum, &t))) {
+	    nrec = t.n;
+	    if ((n = hex_taboverlap(&t, tabreport, &t)) == (ULONG)-1)
+		ret = hex_errno;
+	    else if (!quiet) {
+		fflush(stdout);
+		fprintf(stderr,"%s: %s, %lu record%s, %lu overlapping\n",
+			label, converters[format].name, nrec,
+			nrec == 1 ? "" : "s", n);
+	    }
+	}
+	hex_tabfree(&t);
+    }
+    else if (!map) {
+	ret = converters[format].scan_hex(in, &size, &minaddr, &maxaddr,
+					  &entry);
+	if (!ret) {
+	    if (size)
+		printf("%s: %s, %lu bytes at 0x%08lX-0x%08lX, "
+		       "entry 0x%08lX\n", label, converters[format].name,
+		       size, minaddr, maxaddr, entry);
+	    else
+		printf("%s: %s, no data\n", label, converters[format].name);
+	}
+    }
+    else {
+	hex_mapinit(&m);
+	if (!(ret = hex_scanmap(in, format, o->ignoresum, &m))) {
+	    used = hex_mapused(&m);
+	    for (i=0; i < m.next; i++)
+		printf("0x%08lX-0x%08lX (%lu byte%s)\n", m.ext[i].addr,
+		       m.ext[i].addr + m.ext[i].len - 1, m.ext[i].len,
+		       m.ext[i].len == 1 ? "" : "s");
+	    if (!quiet)
+		fprintf(stderr,"%s: %s, %d extent%s, %lu bytes used, "
+			"%lu bytes overwritten\n", label,
+			converters[format].name, m.next,
+			m.next == 1 ? "" : "s", used, m.size - used);
+	}
+	hex_mapfree(&m);
+    }
+    if (in != stdin)
+	fclose(in);
+
+    if (ret) {
+	hex_perror(label);
+	return -1;
+    }
+    return 0;
+}
+
+
+/* scan one file, named name or stdin if name is NULL */
+static int scanone(char *name, SCANOPTS *o)
+{
+    FILE	*in;
+    int		format = o->format;
+
+    if (!(in = hex_fopen(name, &format))) {
+	perror(name ? name : "(stdin)");
+	return -1;
+    }
+    return scanstream(in, name ? name : "(stdin)", format, o);
+}
+
+
+/* scan a file that hex_readfiles() has read */
+static int scanread(void *arg, int i, UCHAR *data, ULONG len)
+{
+    SCANOPTS	*o = arg;
+    FILE	*in;
+    int		format = o->format;
+
+    if (!data || !(in = hex_memfopen(data, len, &format))) {
+	perror(o->names[i]);
+	o->ret = 1;
+    }
+    else if (scanstream(in, o->names[i], format, o))
+	o->ret = 1;
+    return 0;
+}
+
+
+/* list a record that -repair fixed, or could not */
+static void fixreport(void *arg, ULONG line, int was, int now)
+{
+    if (was < 0)
+	printf("%s:%lu: malformed record, left alone\n", (char *)arg, line);
+    else
+	printf("%s:%lu: checksum 0x%02X, should be 0x%02X\n", (char *)arg,
+	       line, was, now);
+}
+
+
+/* repair the checksums in the file called name */
+static int fixone(char *name, SCANOPTS *o)
+{
+    HEXFIX	fix;
+    int		format = o->format;
+
+    memset(&fix, 0, sizeof(fix));
+    if (!o->quiet) {
+	fix.report = fixreport;
+	fix.arg = name;
+    }
+    if (hex_fixsums(name, &format, &fix)) {
+	hex_perror(name);
+	return -1;
+    }
+    if (!o->quiet) {
+	fflush(stdout);
+	fprintf(stderr,"%s: %s, %lu record%s, %lu checksum%s repaired",
+		name, converters[format].name, fix.records,
+		fix.records == 1 ? "" : "s", fix.fixed,
+		fix.fixed == 1 ? "" : "s");
+	if (fix.bad)
+	    fprintf(stderr,", %lu malformed record%s", fix.bad,
+		    fix.bad == 1 ? "" : "s");
+	fprintf(stderr,"\n");
+    }
+    return fix.bad ? -1 : 0;
+}
+
+
+/* exits with 0 on success, 1 on trouble */
+int scanhex_main(int argc, char **argv)
+{
+    SCANOPTS	o;
+    int		i, nfiles = 0, depth = 0, argsdone = FALSE;
+    char	*c;
+
+    memset(&o, 0, sizeof(o));
+    o.format = FMT_UNDEF;
+    if (!(o.names = malloc(argc * sizeof(char *)))) {
+	perror("Error");
+	return 1;
+    }
+
+    for(i=1; i<argc; i++) {
+
+	if ((argv[i][0] == '-') && !argsdone) {
+
+	    if (strlen(argv[i]) > 1) {
+
+		switch(argv[i][1]) {
+
+		  case 'i':
+		    o.ignoresum = TRUE;
+		    break;
+
+		  case 'f':
+		    if ((o.format = getformat(argv[i]+2)) == FMT_UNDEF) {
+			fprintf(stderr,
+				"Error: Unknown format \"%s\"\n",argv[i]);
+			scanusage();
+			return 1;
+		    }
+		    break;
+
+		  case 'm':
+		    o.map = TRUE;
+		    break;
+
+		  case 'o':
+		    o.overlap = TRUE;
+		    break;
+
+		  case 'r':
+		    o.repair = TRUE;
+		    break;
+
+		  case 'a':
+		    c="";
+		    depth = HEXRDDEPTH;
+
+		    if (strlen(argv[i]) > 2)
+			depth=(int)strtol(argv[i]+2,&c,0);
+
+		    if (c[0] != '\0' || depth < 1) {
+			fprintf(stderr,"Error: invalid depth\n");
+			scanusage();
+			return 1;
+		    }
+		    break;
+
+		  case 'h':
+		  case '?':
+		    scanusage();
+		    return 0;
+
+		  case 'v':
+		    fprintf(stderr,"scanhex %s\n", VERSION);
+		    return 0;
+
+		  case 'q':
+		    o.quiet = TRUE;
+		    break;
+
+		  default:
+		    fprintf(stderr,"Error: unknown flag \"%s\"\n",argv[i]);
+		    scanusage();
+		    return 1;
+		}
+	    }
+
+	    else {
+		/* "-" ends the flags */
+		argsdone = TRUE;
+	    }
+	}
+
+	else
+	    o.names[nfiles++] = argv[i];
+    }
+
+    /* -repair maps each file, so there is nothing to read ahead, and
+       stdin cannot be repaired */
+    if (o.repair) {
+	if (!nfiles) {
+	    fprintf(stderr,"Error: -repair needs files\n");
+	    scanusage();
+	    free(o.names);
+	    return 1;
+	}
+	for (i=0; i < nfiles; i++)
+	    if (fixone(o.names[i], &o))
+		o.ret = 1;
+    }
+
+    /* with -a the files are read ahead, several at once */
+    else if (!nfiles) {
+	if (scanone(NULL, &o))
+	    o.ret = 1;
+    }
+    else if (depth)
+	hex_readfiles(o.names, nfiles, depth, scanread, &o);
+    else {
+	for (i=0; i < nfiles; i++)
+	    if (scanone(o.names[i], &o))
+		o.ret = 1;
+    }
+    free(o.names);
+    return o.ret;
+}
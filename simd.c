@@ -0,0 +1,1016 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Block kernels.
+ *
+ * The compare and scan kernels return the offset of the first byte
+ * that ends the run they are looking at, or len if the whole block is
+ * one run. With SSE2 they test 64 bytes per loop iteration and only
+ * look at single bytes to locate the end of a run. These are chosen
+ * when the library is compiled.
+ *
+ * The hot kernels of the codec (hex pair decoding and encoding, the
+ * hex digit check, the record checksum, the blank scans, the blank
+ * count and the 16-bit byte swap) are instead chosen at run time,
+ * once, from scalar, SSE4.1, AVX2 and AVX-512 versions, along with
+ * PCLMULQDQ folding for the CRC-32 digest, so that one binary runs at
+ * its best on whatever CPU it finds. The vector versions are compiled
+ * with target attributes rather than with -m flags. The
+ * environment variable HEXCPU (scalar, sse4.1, avx2 or avx512) caps the
+ * choice, for testing and for comparing them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define X86DISPATCH
+#include <immintrin.h>
+#else
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#endif
+#include "etools.h"
+#include "hex.h"
+
+#ifdef __SSE2__
+#define LD(p,i)		_mm_loadu_si128((const __m128i *)(p) + (i))
+#define EQ(a,b)		_mm_cmpeq_epi8((a),(b))
+#define MASK(v)		_mm_movemask_epi8(v)
+#endif /* __SSE2__ */
+
+
+/*---------------------------------------------------------------*/
+/* offset of the first byte where a and b differ */
+ULONG hex_memdiff(const UCHAR *a, const UCHAR *b, ULONG len)
+{
+    ULONG	i = 0;
+#ifdef __SSE2__
+    __m128i	e0, e1, e2, e3;
+
+    for(; i + 64 <= len; i += 64) {
+	e0 = EQ(LD(a+i,0), LD(b+i,0));
+	e1 = EQ(LD(a+i,1), LD(b+i,1));
+	e2 = EQ(LD(a+i,2), LD(b+i,2));
+	e3 = EQ(LD(a+i,3), LD(b+i,3));
+	if(MASK(_mm_and_si128(_mm_and_si128(e0, e1),
+			      _mm_and_si128(e2, e3))) != 0xffff)
+	    break;
+    }
+    for(; i + 16 <= len; i += 16)
+	if(MASK(EQ(LD(a+i,0), LD(b+i,0))) != 0xffff)
+	    return i + __builtin_ctz(~MASK(EQ(LD(a+i,0), LD(b+i,0))));
+#endif /* __SSE2__ */
+    for(; i < len && a[i] == b[i]; i++)
+	;
+    return i;
+}
+
+
+/*---------------------------------------------------------------*/
+/* offset of the first byte where a and b are equal */
+ULONG hex_memsame(const UCHAR *a, const UCHAR *b, ULONG len)
+{
+    ULONG	i = 0;
+#ifdef __SSE2__
+    __m128i	e0, e1, e2, e3;
+
+    for(; i + 64 <= len; i += 64) {
+	e0 = EQ(LD(a+i,0), LD(b+i,0));
+	e1 = EQ(LD(a+i,1), LD(b+i,1));
+	e2 = EQ(LD(a+i,2), LD(b+i,2));
+	e3 = EQ(LD(a+i,3), LD(b+i,3));
+	if(MASK(_mm_or_si128(_mm_or_si128(e0, e1), _mm_or_si128(e2, e3))))
+	    break;
+    }
+    for(; i + 16 <= len; i += 16)
+	if(MASK(EQ(LD(a+i,0), LD(b+i,0))))
+	    return i + __builtin_ctz(MASK(EQ(LD(a+i,0), LD(b+i,0))));
+#endif /* __SSE2__ */
+    for(; i < len && a[i] != b[i]; i++)
+	;
+    return i;
+}
+
+
+/*---------------------------------------------------------------*/
+/* scalar versions, which the vector ones fall back on for the bytes
+   that do not fill a vector. Each wider version takes in the narrower
+   one for its tail (the ISA of the narrower one is a subset), so the
+   tail is compiled with the wider one's encoding and no SSE/AVX
+   transitions happen inside a kernel. */
+
+#define INLINE	inline __attribute__((always_inline))
+
+static INLINE void decode_scalar(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len; i++)
+	dst[i] = H2C(&src[i << 1]);
+}
+
+static INLINE void encode_scalar(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len; i++) {
+	dst[i << 1]       = C2H_H(src[i]);
+	dst[(i << 1) + 1] = C2H_L(src[i]);
+    }
+}
+
+/* The hex digits, as bits c - '0' of a 64 bit word. Testing digits
+   and letters separately would branch on which one each character
+   is, which is as good as random in hex data. */
+#define XDIGITS	(0x3ffULL | (0x3fULL << ('A' - '0')) | \
+		 (0x3fULL << ('a' - '0')))
+
+static INLINE ULONG xspan_scalar(const UCHAR *p, ULONG len)
+{
+    ULONG	i;
+    unsigned	d;
+
+    for(i=0; i < len; i++) {
+	d = (unsigned)(p[i] - '0');
+	if(d >= 64 || !((XDIGITS >> d) & 1))
+	    break;
+    }
+    return i;
+}
+
+static INLINE UCHAR sum8_scalar(const UCHAR *p, ULONG len)
+{
+    UCHAR	sum = 0;
+    ULONG	i;
+
+    for(i=0; i < len; i++)
+	sum += p[i];
+    return sum;
+}
+
+static INLINE ULONG memnotc_scalar(const UCHAR *p, int c, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len && p[i] == (UCHAR)c; i++)
+	;
+    return i;
+}
+
+static INLINE ULONG memisc_scalar(const UCHAR *p, int c, ULONG len)
+{
+    ULONG	i;
+
+    for(i=0; i < len && p[i] != (UCHAR)c; i++)
+	;
+    return i;
+}
+
+static INLINE ULONG count_scalar(const UCHAR *p, int c, ULONG len)
+{
+    ULONG	i, n = 0;
+
+    for(i=0; i < len; i++)
+	n += p[i] == (UCHAR)c;
+    return n;
+}
+
+static INLINE void swap16_scalar(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    ULONG	i;
+    UCHAR	t;
+
+    for(i=0; i + 1 < len; i += 2) {
+	t = src[i];
+	dst[i] = src[i+1];
+	dst[i+1] = t;
+    }
+}
+
+
+#ifdef X86DISPATCH
+/*---------------------------------------------------------------*/
+/* SSE4.1 (with SSSE3 for pshufb and pmaddubsw).
+
+   Decoding turns each character into its nybble the way _hex2nybble_
+   does, so anything that is not a hex digit becomes 0 just as in the
+   scalar version: digits are c - '0', letters are (c | 0x20) - 'a' +
+   10, and the two ranges are told apart with unsigned compares. The
+   pairs are then joined by pmaddubsw with 16 and 1. Encoding splits
+   each byte into nybbles, interleaves them and looks them up with
+   pshufb. */
+
+#define TARGET(t)	__attribute__((target(t)))
+
+TARGET("sse4.1")
+static INLINE __m128i nyb_sse(__m128i c)
+{
+    __m128i	d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i	l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+				 _mm_set1_epi8('a'));
+    __m128i	isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i	isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+    return _mm_or_si128(_mm_and_si128(isd, d),
+			_mm_and_si128(isl, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+TARGET("sse4.1")
+static INLINE void decode_sse41(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m128i	w = _mm_set1_epi16(0x0110);	/* 16, 1 */
+    __m128i		a, b;
+    ULONG		i = 0;
+
+    for(; i + 16 <= len; i += 16) {
+	a = _mm_maddubs_epi16(nyb_sse(_mm_loadu_si128(
+	    (const __m128i *)(src + (i << 1)))), w);
+	b = _mm_maddubs_epi16(nyb_sse(_mm_loadu_si128(
+	    (const __m128i *)(src + (i << 1) + 16))), w);
+	_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+    decode_scalar(dst + i, src + (i << 1), len - i);
+}
+
+TARGET("sse4.1")
+static INLINE void encode_sse41(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m128i	tab = _mm_loadu_si128((const __m128i *)_nybble2hex_);
+    const __m128i	m = _mm_set1_epi8(0x0f);
+    __m128i		v, hi, lo;
+    ULONG		i = 0;
+
+    for(; i + 16 <= len; i += 16) {
+	v = _mm_loadu_si128((const __m128i *)(src + i));
+	hi = _mm_and_si128(_mm_srli_epi16(v, 4), m);
+	lo = _mm_and_si128(v, m);
+	_mm_storeu_si128((__m128i *)(dst + (i << 1)),
+			 _mm_shuffle_epi8(tab, _mm_unpacklo_epi8(hi, lo)));
+	_mm_storeu_si128((__m128i *)(dst + (i << 1) + 16),
+			 _mm_shuffle_epi8(tab, _mm_unpackhi_epi8(hi, lo)));
+    }
+    encode_scalar(dst + (i << 1), src + i, len - i);
+}
+
+TARGET("sse4.1")
+static INLINE UCHAR sum8_sse41(const UCHAR *p, ULONG len)
+{
+    __m128i	acc = _mm_setzero_si128();
+    ULONG	i = 0;
+
+    for(; i + 16 <= len; i += 16)
+	acc = _mm_add_epi64(acc, _mm_sad_epu8(
+	    _mm_loadu_si128((const __m128i *)(p + i)), _mm_setzero_si128()));
+    return (UCHAR)(_mm_cvtsi128_si32(acc) + _mm_extract_epi32(acc, 2) +
+		   sum8_scalar(p + i, len - i));
+}
+
+#define LD(p,i)		_mm_loadu_si128((const __m128i *)(p) + (i))
+#define EQ(a,b)		_mm_cmpeq_epi8((a),(b))
+#define MASK(v)		_mm_movemask_epi8(v)
+
+/* the same range tests as nyb_sse(), giving a bit per hex digit */
+TARGET("sse4.1")
+static INLINE unsigned xmask_sse41(const UCHAR *p)
+{
+    __m128i	c = LD(p,0);
+    __m128i	d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i	l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+				 _mm_set1_epi8('a'));
+
+    return MASK(_mm_or_si128(EQ(_mm_min_epu8(d, _mm_set1_epi8(9)), d),
+			     EQ(_mm_min_epu8(l, _mm_set1_epi8(5)), l)));
+}
+
+/* a partial last vector is checked by loading the last 16 bytes again,
+   overlapping the ones already checked; the scalar loop is only left
+   for runs shorter than a vector */
+TARGET("sse4.1")
+static INLINE ULONG xspan_sse41(const UCHAR *p, ULONG len)
+{
+    unsigned	m;
+    ULONG	i = 0;
+
+    if(len < 16)
+	return xspan_scalar(p, len);
+    for(; i + 16 <= len; i += 16)
+	if((m = xmask_sse41(p + i)) != 0xffff)
+	    return i + __builtin_ctz(~m);
+    if(i < len) {
+	m = xmask_sse41(p + len - 16) | ((1U << (16 - (len - i))) - 1);
+	if(m != 0xffff)
+	    return len - 16 + __builtin_ctz(~m);
+    }
+    return len;
+}
+
+TARGET("sse4.1")
+static INLINE ULONG memnotc_sse41(const UCHAR *p, int c, ULONG len)
+{
+    ULONG	i = 0;
+    __m128i	v = _mm_set1_epi8((char)c);
+    __m128i	e0, e1, e2, e3;
+
+    for(; i + 64 <= len; i += 64) {
+	e0 = EQ(LD(p+i,0), v);
+	e1 = EQ(LD(p+i,1), v);
+	e2 = EQ(LD(p+i,2), v);
+	e3 = EQ(LD(p+i,3), v);
+	if(MASK(_mm_and_si128(_mm_and_si128(e0, e1),
+			      _mm_and_si128(e2, e3))) != 0xffff)
+	    break;
+    }
+    for(; i + 16 <= len; i += 16)
+	if(MASK(EQ(LD(p+i,0), v)) != 0xffff)
+	    return i + __builtin_ctz(~MASK(EQ(LD(p+i,0), v)));
+    return i + memnotc_scalar(p + i, c, len - i);
+}
+
+TARGET("sse4.1")
+static INLINE ULONG memisc_sse41(const UCHAR *p, int c, ULONG len)
+{
+    ULONG	i = 0;
+    __m128i	v = _mm_set1_epi8((char)c);
+    __m128i	e0, e1, e2, e3;
+
+    for(; i + 64 <= len; i += 64) {
+	e0 = EQ(LD(p+i,0), v);
+	e1 = EQ(LD(p+i,1), v);
+	e2 = EQ(LD(p+i,2), v);
+	e3 = EQ(LD(p+i,3), v);
+	if(MASK(_mm_or_si128(_mm_or_si128(e0, e1), _mm_or_si128(e2, e3))))
+	    break;
+    }
+    for(; i + 16 <= len; i += 16)
+	if(MASK(EQ(LD(p+i,0), v)))
+	    return i + __builtin_ctz(MASK(EQ(LD(p+i,0), v)));
+    return i + memisc_scalar(p + i, c, len - i);
+}
+
+/* the compare gives -1 for each match, so subtracting it counts them
+   in bytes; psadbw widens the byte counts before they can wrap */
+TARGET("sse4.1")
+static INLINE ULONG count_sse41(const UCHAR *p, int c, ULONG len)
+{
+    __m128i	v = _mm_set1_epi8((char)c);
+    __m128i	acc, tot = _mm_setzero_si128();
+    ULONG	i = 0, j, n;
+
+    while(i + 16 <= len) {
+	n = MIN((len - i) >> 4, 255);
+	acc = _mm_setzero_si128();
+	for(j=0; j < n; j++, i += 16)
+	    acc = _mm_sub_epi8(acc, EQ(LD(p+i,0), v));
+	tot = _mm_add_epi64(tot, _mm_sad_epu8(acc, _mm_setzero_si128()));
+    }
+    return (ULONG)(unsigned)_mm_cvtsi128_si32(tot) +
+	(ULONG)(unsigned)_mm_extract_epi32(tot, 2) +
+	count_scalar(p + i, c, len - i);
+}
+
+TARGET("sse4.1")
+static INLINE void swap16_sse41(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m128i	sh = _mm_set_epi8(14,15,12,13,10,11,8,9,
+					  6,7,4,5,2,3,0,1);
+    ULONG		i = 0;
+
+    for(; i + 16 <= len; i += 16)
+	_mm_storeu_si128((__m128i *)(dst + i),
+			 _mm_shuffle_epi8(LD(src + i, 0), sh));
+    swap16_scalar(dst + i, src + i, len - i);
+}
+
+#undef LD
+#undef EQ
+#undef MASK
+
+
+/*---------------------------------------------------------------*/
+/* AVX2. The packs and unpacks work within 128 bit lanes, so the lanes
+   are put back in order with a permute. */
+
+TARGET("avx2")
+static INLINE __m256i nyb_avx2(__m256i c)
+{
+    __m256i	d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i	l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+				    _mm256_set1_epi8('a'));
+    __m256i	isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)),
+					d);
+    __m256i	isl = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)),
+					l);
+
+    return _mm256_or_si256(_mm256_and_si256(isd, d),
+			   _mm256_and_si256(isl, _mm256_add_epi8(
+			       l, _mm256_set1_epi8(10))));
+}
+
+TARGET("avx2")
+static INLINE void decode_avx2(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m256i	w = _mm256_set1_epi16(0x0110);
+    __m256i		a, b;
+    ULONG		i = 0;
+
+    for(; i + 32 <= len; i += 32) {
+	a = _mm256_maddubs_epi16(nyb_avx2(_mm256_loadu_si256(
+	    (const __m256i *)(src + (i << 1)))), w);
+	b = _mm256_maddubs_epi16(nyb_avx2(_mm256_loadu_si256(
+	    (const __m256i *)(src + (i << 1) + 32))), w);
+	_mm256_storeu_si256((__m256i *)(dst + i),
+			    _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+						     0xd8));
+    }
+    decode_sse41(dst + i, src + (i << 1), len - i);
+}
+
+TARGET("avx2")
+static INLINE void encode_avx2(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m256i	tab = _mm256_broadcastsi128_si256(
+	_mm_loadu_si128((const __m128i *)_nybble2hex_));
+    const __m256i	m = _mm256_set1_epi8(0x0f);
+    __m256i		v, hi, lo, a, b;
+    ULONG		i = 0;
+
+    for(; i + 32 <= len; i += 32) {
+	v = _mm256_loadu_si256((const __m256i *)(src + i));
+	hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), m);
+	lo = _mm256_and_si256(v, m);
+	a = _mm256_shuffle_epi8(tab, _mm256_unpacklo_epi8(hi, lo));
+	b = _mm256_shuffle_epi8(tab, _mm256_unpackhi_epi8(hi, lo));
+	_mm256_storeu_si256((__m256i *)(dst + (i << 1)),
+			    _mm256_permute2x128_si256(a, b, 0x20));
+	_mm256_storeu_si256((__m256i *)(dst + (i << 1) + 32),
+			    _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    encode_sse41(dst + (i << 1), src + i, len - i);
+}
+
+TARGET("avx2")
+static INLINE UCHAR sum8_avx2(const UCHAR *p, ULONG len)
+{
+    __m256i	acc = _mm256_setzero_si256();
+    __m128i	s;
+    ULONG	i = 0;
+
+    for(; i + 32 <= len; i += 32)
+	acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+	    _mm256_loadu_si256((const __m256i *)(p + i)),
+	    _mm256_setzero_si256()));
+    s = _mm_add_epi64(_mm256_castsi256_si128(acc),
+		      _mm256_extracti128_si256(acc, 1));
+    return (UCHAR)(_mm_cvtsi128_si32(s) + _mm_extract_epi32(s, 2) +
+		   sum8_sse41(p + i, len - i));
+}
+
+TARGET("avx2")
+static INLINE unsigned xmask_avx2(const UCHAR *p)
+{
+    __m256i	c = _mm256_loadu_si256((const __m256i *)p);
+    __m256i	d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i	l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+				    _mm256_set1_epi8('a'));
+
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+	_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d),
+	_mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l)));
+}
+
+/* as xspan_sse41() */
+TARGET("avx2")
+static INLINE ULONG xspan_avx2(const UCHAR *p, ULONG len)
+{
+    unsigned	m;
+    ULONG	i = 0;
+
+    if(len < 32)
+	return xspan_sse41(p, len);
+    for(; i + 32 <= len; i += 32)
+	if((m = xmask_avx2(p + i)) != 0xffffffffU)
+	    return i + __builtin_ctz(~m);
+    if(i < len) {
+	m = xmask_avx2(p + len - 32) | ((1U << (32 - (len - i))) - 1);
+	if(m != 0xffffffffU)
+	    return len - 32 + __builtin_ctz(~m);
+    }
+    return len;
+}
+
+TARGET("avx2")
+static INLINE ULONG memnotc_avx2(const UCHAR *p, int c, ULONG len)
+{
+    __m256i	v = _mm256_set1_epi8((char)c);
+    unsigned	m;
+    ULONG	i = 0;
+
+    for(; i + 32 <= len; i += 32) {
+	m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+	    _mm256_loadu_si256((const __m256i *)(p + i)), v));
+	if(m != 0xffffffffU)
+	    return i + __builtin_ctz(~m);
+    }
+    return i + memnotc_sse41(p + i, c, len - i);
+}
+
+TARGET("avx2")
+static INLINE ULONG memisc_avx2(const UCHAR *p, int c, ULONG len)
+{
+    __m256i	v = _mm256_set1_epi8((char)c);
+    unsigned	m;
+    ULONG	i = 0;
+
+    for(; i + 32 <= len; i += 32) {
+	m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+	    _mm256_loadu_si256((const __m256i *)(p + i)), v));
+	if(m)
+	    return i + __builtin_ctz(m);
+    }
+    return i + memisc_sse41(p + i, c, len - i);
+}
+
+TARGET("avx2")
+static INLINE ULONG count_avx2(const UCHAR *p, int c, ULONG len)
+{
+    __m256i	v = _mm256_set1_epi8((char)c);
+    __m256i	acc, tot = _mm256_setzero_si256();
+    __m128i	s;
+    ULONG	i = 0, j, n;
+
+    while(i + 32 <= len) {
+	n = MIN((len - i) >> 5, 255);
+	acc = _mm256_setzero_si256();
+	for(j=0; j < n; j++, i += 32)
+	    acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(
+		_mm256_loadu_si256((const __m256i *)(p + i)), v));
+	tot = _mm256_add_epi64(tot, _mm256_sad_epu8(acc,
+						    _mm256_setzero_si256()));
+    }
+    s = _mm_add_epi64(_mm256_castsi256_si128(tot),
+		      _mm256_extracti128_si256(tot, 1));
+    return (ULONG)(unsigned)_mm_cvtsi128_si32(s) +
+	(ULONG)(unsigned)_mm_extract_epi32(s, 2) +
+	count_sse41(p + i, c, len - i);
+}
+
+TARGET("avx2")
+static INLINE void swap16_avx2(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m256i	sh = _mm256_set_epi8(14,15,12,13,10,11,8,9,
+					     6,7,4,5,2,3,0,1,
+					     14,15,12,13,10,11,8,9,
+					     6,7,4,5,2,3,0,1);
+    ULONG		i = 0;
+
+    for(; i + 32 <= len; i += 32)
+	_mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(
+	    _mm256_loadu_si256((const __m256i *)(src + i)), sh));
+    swap16_sse41(dst + i, src + i, len - i);
+}
+
+
+/*---------------------------------------------------------------*/
+/* AVX-512 (BW). Compares give masks directly, and the lanes are put
+   back in order with a permute across the whole vector. */
+
+TARGET("avx512bw")
+static __m512i nyb_avx512(__m512i c)
+{
+    __m512i	d = _mm512_sub_epi8(c, _mm512_set1_epi8('0'));
+    __m512i	l = _mm512_sub_epi8(_mm512_or_si512(c, _mm512_set1_epi8(0x20)),
+				    _mm512_set1_epi8('a'));
+    __mmask64	isd = _mm512_cmple_epu8_mask(d, _mm512_set1_epi8(9));
+    __mmask64	isl = _mm512_cmple_epu8_mask(l, _mm512_set1_epi8(5));
+
+    return _mm512_mask_add_epi8(_mm512_maskz_mov_epi8(isd, d), isl,
+				l, _mm512_set1_epi8(10));
+}
+
+TARGET("avx512bw")
+static void decode_avx512(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m512i	w = _mm512_set1_epi16(0x0110);
+    const __m512i	ord = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    __m512i		a, b;
+    ULONG		i = 0;
+
+    for(; i + 64 <= len; i += 64) {
+	a = _mm512_maddubs_epi16(nyb_avx512(_mm512_loadu_si512(
+	    (const void *)(src + (i << 1)))), w);
+	b = _mm512_maddubs_epi16(nyb_avx512(_mm512_loadu_si512(
+	    (const void *)(src + (i << 1) + 64))), w);
+	_mm512_storeu_si512((void *)(dst + i),
+			    _mm512_permutexvar_epi64(ord,
+						     _mm512_packus_epi16(a, b)));
+    }
+    decode_avx2(dst + i, src + (i << 1), len - i);
+}
+
+TARGET("avx512bw")
+static void encode_avx512(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m512i	tab = _mm512_broadcast_i32x4(
+	_mm_loadu_si128((const __m128i *)_nybble2hex_));
+    const __m512i	m = _mm512_set1_epi8(0x0f);
+    const __m512i	o0 = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i	o1 = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+    __m512i		v, hi, lo, a, b;
+    ULONG		i = 0;
+
+    for(; i + 64 <= len; i += 64) {
+	v = _mm512_loadu_si512((const void *)(src + i));
+	hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), m);
+	lo = _mm512_and_si512(v, m);
+	a = _mm512_shuffle_epi8(tab, _mm512_unpacklo_epi8(hi, lo));
+	b = _mm512_shuffle_epi8(tab, _mm512_unpackhi_epi8(hi, lo));
+	_mm512_storeu_si512((void *)(dst + (i << 1)),
+			    _mm512_permutex2var_epi64(a, o0, b));
+	_mm512_storeu_si512((void *)(dst + (i << 1) + 64),
+			    _mm512_permutex2var_epi64(a, o1, b));
+    }
+    encode_avx2(dst + (i << 1), src + i, len - i);
+}
+
+TARGET("avx512bw")
+static UCHAR sum8_avx512(const UCHAR *p, ULONG len)
+{
+    __m512i	acc = _mm512_setzero_si512();
+    ULONG	i = 0;
+
+    for(; i + 64 <= len; i += 64)
+	acc = _mm512_add_epi64(acc, _mm512_sad_epu8(
+	    _mm512_loadu_si512((const void *)(p + i)),
+	    _mm512_setzero_si512()));
+    return (UCHAR)(_mm512_reduce_add_epi64(acc) +
+		   sum8_avx2(p + i, len - i));
+}
+
+/* the last, partial vector is loaded under a mask, which suits the
+   short runs (a record at a time) this is used on */
+TARGET("avx512bw")
+static ULONG xspan_avx512(const UCHAR *p, ULONG len)
+{
+    __m512i	c;
+    __mmask64	k, m;
+    ULONG	i;
+
+    for(i=0; i < len; i += 64) {
+	k = len - i >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << (len - i)) - 1;
+	c = _mm512_maskz_loadu_epi8(k, (const void *)(p + i));
+	m = k & ~(_mm512_cmple_epu8_mask(_mm512_sub_epi8(c,
+					 _mm512_set1_epi8('0')),
+					 _mm512_set1_epi8(9)) |
+		  _mm512_cmple_epu8_mask(_mm512_sub_epi8(
+					 _mm512_or_si512(c,
+					 _mm512_set1_epi8(0x20)),
+					 _mm512_set1_epi8('a')),
+					 _mm512_set1_epi8(5)));
+	if(m)
+	    return i + __builtin_ctzll(m);
+    }
+    return len;
+}
+
+TARGET("avx512bw")
+static ULONG memnotc_avx512(const UCHAR *p, int c, ULONG len)
+{
+    __m512i	v = _mm512_set1_epi8((char)c);
+    __mmask64	m;
+    ULONG	i = 0;
+
+    for(; i + 64 <= len; i += 64) {
+	m = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((const void *)(p + i)),
+				    v);
+	if(m)
+	    return i + __builtin_ctzll(m);
+    }
+    return i + memnotc_avx2(p + i, c, len - i);
+}
+
+TARGET("avx512bw")
+static ULONG memisc_avx512(const UCHAR *p, int c, ULONG len)
+{
+    __m512i	v = _mm512_set1_epi8((char)c);
+    __mmask64	m;
+    ULONG	i = 0;
+
+    for(; i + 64 <= len; i += 64) {
+	m = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(p + i)),
+				   v);
+	if(m)
+	    return i + __builtin_ctzll(m);
+    }
+    return i + memisc_avx2(p + i, c, len - i);
+}
+
+TARGET("avx512bw")
+static ULONG count_avx512(const UCHAR *p, int c, ULONG len)
+{
+    __m512i	v = _mm512_set1_epi8((char)c);
+    __m512i	acc, tot = _mm512_setzero_si512();
+    ULONG	i = 0, j, n;
+
+    while(i + 64 <= len) {
+	n = MIN((len - i) >> 6, 255);
+	acc = _mm512_setzero_si512();
+	for(j=0; j < n; j++, i += 64)
+	    acc = _mm512_sub_epi8(acc, _mm512_movm_epi8(
+		_mm512_cmpeq_epi8_mask(
+		    _mm512_loadu_si512((const void *)(p + i)), v)));
+	tot = _mm512_add_epi64(tot, _mm512_sad_epu8(acc,
+						    _mm512_setzero_si512()));
+    }
+    return (ULONG)_mm512_reduce_add_epi64(tot) +
+	count_avx2(p + i, c, len - i);
+}
+
+TARGET("avx512bw")
+static void swap16_avx512(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    const __m512i	sh = _mm512_broadcast_i32x4(
+	_mm_set_epi8(14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1));
+    ULONG		i = 0;
+
+    for(; i + 64 <= len; i += 64)
+	_mm512_storeu_si512((void *)(dst + i), _mm512_shuffle_epi8(
+	    _mm512_loadu_si512((const void *)(src + i)), sh));
+    swap16_avx2(dst + i, src + i, len - i);
+}
+
+/* CRC-32 by carry-less multiply folding (Intel, "Fast CRC Computation
+   for Generic Polynomials Using PCLMULQDQ Instruction"). len must be
+   at least 64 and a multiple of 16. PCLMULQDQ is not part of any of
+   the levels above, so this is chosen on its own, above scalar. */
+TARGET("pclmul,sse4.1")
+static unsigned int crc32_pclmul(unsigned int crc, const UCHAR *p,
+				 ULONG len)
+{
+    static const unsigned long long k1k2[2] = {0x0154442bd4ULL, 0x01c6e41596ULL};
+    static const unsigned long long k3k4[2] = {0x01751997d0ULL, 0x00ccaa009eULL};
+    static const unsigned long long k5k0[2] = {0x0163cd6124ULL, 0};
+    static const unsigned long long poly[2] = {0x01db710641ULL, 0x01f7011641ULL};
+    __m128i	x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_loadu_si128((const __m128i *)k1k2);
+    p += 64;
+    len -= 64;
+
+    /* fold four 128 bit lanes in parallel */
+    for(; len >= 64; p += 64, len -= 64) {
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+	x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+	x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+	x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+		_mm_loadu_si128((const __m128i *)(p + 0x00)));
+	x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+		_mm_loadu_si128((const __m128i *)(p + 0x10)));
+	x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+		_mm_loadu_si128((const __m128i *)(p + 0x20)));
+	x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+		_mm_loadu_si128((const __m128i *)(p + 0x30)));
+    }
+
+    /* fold the four lanes into one */
+    x0 = _mm_loadu_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    for(; len >= 16; p += 16, len -= 16) {
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,
+		_mm_loadu_si128((const __m128i *)p)), x5);
+    }
+
+    /* 128 -> 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_loadu_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /* X86DISPATCH */
+
+
+/*---------------------------------------------------------------*/
+/* dispatch */
+
+typedef struct kernels {
+    char	*name;
+    char	*feature;	/* for __builtin_cpu_supports() */
+    void	(*decode)(UCHAR *, const UCHAR *, ULONG);
+    void	(*encode)(UCHAR *, const UCHAR *, ULONG);
+    ULONG	(*xspan)(const UCHAR *, ULONG);
+    UCHAR	(*sum8)(const UCHAR *, ULONG);
+    ULONG	(*memnotc)(const UCHAR *, int, ULONG);
+    ULONG	(*memisc)(const UCHAR *, int, ULONG);
+    ULONG	(*count)(const UCHAR *, int, ULONG);
+    void	(*swap16)(UCHAR *, const UCHAR *, ULONG);
+} KERNELS;
+
+/* in ascending order of preference */
+static const KERNELS levels[] = {
+    {"scalar", NULL, decode_scalar, encode_scalar, xspan_scalar,
+     sum8_scalar, memnotc_scalar, memisc_scalar, count_scalar,
+     swap16_scalar},
+#ifdef X86DISPATCH
+    {"sse4.1", "sse4.1", decode_sse41, encode_sse41, xspan_sse41,
+     sum8_sse41, memnotc_sse41, memisc_sse41, count_sse41,
+     swap16_sse41},
+    {"avx2", "avx2", decode_avx2, encode_avx2, xspan_avx2,
+     sum8_avx2, memnotc_avx2, memisc_avx2, count_avx2,
+     swap16_avx2},
+    {"avx512", "avx512bw", decode_avx512, encode_avx512, xspan_avx512,
+     sum8_avx512, memnotc_avx512, memisc_avx512, count_avx512,
+     swap16_avx512},
+#endif
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+static const KERNELS *kern = &levels[0];
+static unsigned int (*crcfold)(unsigned int, const UCHAR *, ULONG) = NULL;
+
+/* TRUE if this CPU can run the given level */
+static int cpu_has(const KERNELS *k)
+{
+#ifdef X86DISPATCH
+    if(!k->feature)
+	return TRUE;
+    __builtin_cpu_init();
+    if(!strcmp(k->feature, "sse4.1"))
+	return __builtin_cpu_supports("sse4.1") &&
+	    __builtin_cpu_supports("ssse3");
+    if(!strcmp(k->feature, "avx2"))
+	return __builtin_cpu_supports("avx2");
+    if(!strcmp(k->feature, "avx512bw"))
+	return __builtin_cpu_supports("avx512bw") &&
+	    __builtin_cpu_supports("avx512f");
+    return FALSE;
+#else
+    return !k->feature;
+#endif
+}
+
+/* Use the best kernels this CPU can run, but none above the level
+   named, if name is not NULL. Returns FALSE if name is not a level. */
+int hex_cpuset(char *name)
+{
+    const KERNELS	*k;
+    int			found = !name;
+
+    kern = &levels[0];
+    for(k = levels; k->name; k++) {
+	if(cpu_has(k))
+	    kern = k;
+	if(name && !strcmp(name, k->name)) {
+	    found = TRUE;
+	    break;
+	}
+    }
+
+    /* the CRC folding goes with any level above scalar */
+    crcfold = NULL;
+#ifdef X86DISPATCH
+    if(kern != &levels[0] && __builtin_cpu_supports("pclmul"))
+	crcfold = crc32_pclmul;
+#endif
+    return found;
+}
+
+/* the name of the level in use */
+char *hex_cpuname(void)
+{
+    return kern->name;
+}
+
+/* the levels there are, in ascending order, so that they can be tried
+   in turn; NULL after the last */
+char *hex_cpulevel(int i)
+{
+    return (i >= 0 && i < (int)(sizeof(levels)/sizeof(levels[0])) - 1) ?
+	levels[i].name : NULL;
+}
+
+/* choose once, at startup */
+__attribute__((constructor))
+static void cpu_init(void)
+{
+    if(!hex_cpuset(getenv("HEXCPU")))
+	hex_cpuset(NULL);
+}
+
+
+/*---------------------------------------------------------------*/
+/* hex pairs at src to len bytes at dst; as H2C(), characters that are
+   not hex digits count as 0 */
+void hex_decode(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    kern->decode(dst, src, len);
+}
+
+/* len bytes at src to 2*len upper case hex characters at dst */
+void hex_encode(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    kern->encode(dst, src, len);
+}
+
+/* number of hex digits at the start of the len characters at p */
+ULONG hex_xspan(const UCHAR *p, ULONG len)
+{
+    return kern->xspan(p, len);
+}
+
+/* 8 bit sum of len bytes */
+UCHAR hex_sum8(const UCHAR *p, ULONG len)
+{
+    return kern->sum8(p, len);
+}
+
+/* offset of the first byte that is not c */
+ULONG hex_memnotc(const UCHAR *p, int c, ULONG len)
+{
+    return kern->memnotc(p, c, len);
+}
+
+/* offset of the first byte that is c */
+ULONG hex_memisc(const UCHAR *p, int c, ULONG len)
+{
+    return kern->memisc(p, c, len);
+}
+
+/* number of bytes that are c */
+ULONG hex_memcount(const UCHAR *p, int c, ULONG len)
+{
+    return kern->count(p, c, len);
+}
+
+/* copy len bytes (even) from src to dst, swapping the bytes of each
+   16-bit word. dst and src may be the same. */
+void hex_swap16(UCHAR *dst, const UCHAR *src, ULONG len)
+{
+    kern->swap16(dst, src, len);
+}
+
+/* fold as much of the len bytes at p into the (reflected, uninverted)
+   CRC-32 at *crc as the kernel in use can; returns the bytes done,
+   which may be 0 */
+ULONG hex_crcfold(unsigned int *crc, const UCHAR *p, ULONG len)
+{
+    if(!crcfold || len < 64)
+	return 0;
+    len &= ~(ULONG)15;
+    *crc = crcfold(*crc, p, len);
+    return len;
+}
@@ -0,0 +1,455 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Streaming output. A HEXSINK takes blocks of data with their addresses
+ * and writes them out in one of the formats in converters[], so images
+ * can be written without first being laid out in a binary file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+#define WRBUFLEN	65536	/* read size for binary input */
+#define BLANKLEN	256	/* blank bytes passed on at a time */
+
+
+/*---------------------------------------------------------------*/
+/* Set up a sink that writes the given format to out */
+void hex_sinkinit(HEXSINK *s, int format, FILE *out)
+{
+    memset(s, 0, sizeof(*s));
+    s->put = converters[format].put_hex;
+    s->end = converters[format].end_hex;
+    s->out = out;
+    s->format = format;
+    s->reclen = HEXRECLEN;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Write an image to a sink, merging overlapping segments (last wins)
+   first if that has not been done already. The data is passed to
+   hex_digest on the way. */
+int hex_imgwrite(HEXIMAGE *img, HEXSINK *s)
+{
+    int		i;
+
+    if(hex_imgsort(img))
+	return hex_errno;
+
+    for(i=0; i < img->nseg; i++) {
+	if(hex_digest)
+	    hex_dgblock(hex_digest, img->seg[i].addr, img->seg[i].data,
+			img->seg[i].len);
+	if(s->put(s, img->seg[i].addr, img->seg[i].data, img->seg[i].len))
+	    return hex_errno;
+    }
+    return s->end(s, img->entry);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Copy binary data from in, which starts at base, to a sink. The data
+   is passed to hex_digest on the way, as wr_hex does. */
+int hex_wrsink(FILE *in, HEXSINK *s, ULONG base, ULONG entry)
+{
+    UCHAR	buf[WRBUFLEN];
+    size_t	n;
+
+    while((n = fread(buf,1,WRBUFLEN,in)) > 0) {
+	if(hex_digest)
+	    hex_dgblock(hex_digest, base, buf, n);
+	if(s->put(s, base, buf, n))
+	    return hex_errno;
+	base += n;
+    }
+    if(ferror(in)) {
+	/* error while reading */
+	ERR(H_ERR_IO);
+    }
+    return s->end(s, entry);
+}
+
+
+/*---------------------------------------------------------------*/
+/* raw binary output. Data goes to the offset of its address less lo,
+   with gaps padded with hex_fill, so addresses must ascend. If lo is
+   (ULONG)-1, the output starts at the first address put. If hi is
+   not (ULONG)-1, data above it is dropped and end() pads the output
+   out to it. The record buffer holds the padding. */
+
+static int bin_pad(HEXSINK *s, ULONG addr)
+{
+    ULONG	n;
+
+    while(s->recaddr < addr) {
+	n = MIN(addr - s->recaddr, sizeof(s->rec));
+	if(fwrite(s->rec, 1, n, s->out) != n) {
+	    ERR(H_ERR_IO);
+	}
+	s->recaddr += n;
+    }
+    return H_ERR_NONE;
+}
+
+static int bin_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    if(!len || addr > s->upper)
+	return H_ERR_NONE;
+    if(!s->upperset) {
+	/* the output starts at the first byte if lo was not given */
+	s->upperset = TRUE;
+	if(s->recaddr == (ULONG)-1)
+	    s->recaddr = s->base = addr;
+    }
+    if(addr < s->recaddr) {
+	ERR(H_ERR_ORDER);
+    }
+    if(s->upper - addr < len)
+	len = s->upper - addr + 1;
+    if(bin_pad(s, addr))
+	return hex_errno;
+    if(fwrite(data, 1, len, s->out) != len) {
+	ERR(H_ERR_IO);
+    }
+    s->recaddr += len;
+    return H_ERR_NONE;
+}
+
+static int bin_end(HEXSINK *s, ULONG entry)
+{
+    if(s->upper != (ULONG)-1) {
+	if(bin_pad(s, s->upper))
+	    return hex_errno;
+	if(s->recaddr == s->upper && fwrite(s->rec, 1, 1, s->out) != 1) {
+	    ERR(H_ERR_IO);
+	}
+    }
+    return H_ERR_NONE;
+}
+
+/* Set up a sink that writes raw binary starting at address lo to out */
+void hex_binsink(HEXSINK *s, FILE *out, ULONG lo, ULONG hi)
+{
+    memset(s, 0, sizeof(*s));
+    s->put = bin_put;
+    s->end = bin_end;
+    s->out = out;
+    s->format = FMT_UNDEF;
+    s->reclen = HEXRECLEN;
+    s->recaddr = s->base = lo;
+    s->upper = hi;
+    memset(s->rec, hex_fill, sizeof(s->rec));
+}
+
+
+/*---------------------------------------------------------------*/
+/* blank skipping filter: runs of at least mingap blank bytes are not
+   passed on, so the hex output gets a gap there instead of records
+   full of blank bytes. A run may span several put() calls, so it is
+   held back until the data after it shows how long it is. The first
+   byte of a run at the start and the last byte of a run at the end
+   are passed on all the same, so that the data keeps its extent and
+   hex2bin gives back the same binary. */
+
+typedef struct skipstate {
+    int		blank;
+    ULONG	mingap;
+    ULONG	gapaddr;	/* blank run held back */
+    ULONG	gaplen;
+    int		started;	/* something has been passed on */
+    UCHAR	buf[BLANKLEN];	/* blank bytes, for passing short runs on */
+} SKIPSTATE;
+
+/* end the blank run held back, passing it on if it is too short; last
+   is set if nothing follows it */
+static int skip_flush(HEXSINK *s, int last)
+{
+    SKIPSTATE	*st = s->priv;
+    ULONG	n;
+
+    if(st->gaplen >= st->mingap) {
+	/* keep the ends of the data where they were */
+	if(!st->started &&
+	   s->next->put(s->next, st->gapaddr, st->buf, 1))
+	    return hex_errno;
+	if(last && (st->started || st->gaplen > 1) &&
+	   s->next->put(s->next, st->gapaddr + st->gaplen - 1, st->buf, 1))
+	    return hex_errno;
+    }
+    else {
+	while(st->gaplen) {
+	    n = MIN(st->gaplen, BLANKLEN);
+	    if(s->next->put(s->next, st->gapaddr, st->buf, n))
+		return hex_errno;
+	    st->gapaddr += n;
+	    st->gaplen -= n;
+	}
+    }
+    st->gaplen = 0;
+    st->started = TRUE;
+    return H_ERR_NONE;
+}
+
+static int skip_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    SKIPSTATE	*st = s->priv;
+    ULONG	i, n;
+
+    /* the run held back only continues if this block follows it */
+    if(st->gaplen && st->gapaddr + st->gaplen != addr &&
+       skip_flush(s, FALSE))
+	return hex_errno;
+
+    for(i=0; i < len; i += n) {
+	if((n = hex_memnotc(data + i, st->blank, len - i))) {
+	    if(!st->gaplen)
+		st->gapaddr = addr + i;
+	    st->gaplen += n;
+	    continue;
+	}
+	if(st->gaplen && skip_flush(s, FALSE))
+	    return hex_errno;
+	n = hex_memisc(data + i, st->blank, len - i);
+	st->started = TRUE;
+	if(s->next->put(s->next, addr + i, data + i, n))
+	    return hex_errno;
+    }
+    return H_ERR_NONE;
+}
+
+static int skip_end(HEXSINK *s, ULONG entry)
+{
+    SKIPSTATE	*st = s->priv;
+    int		ret;
+
+    ret = st->gaplen ? skip_flush(s, TRUE) : H_ERR_NONE;
+    free(s->priv);
+    s->priv = NULL;
+    if(ret)
+	return ret;
+    return s->next->end(s->next, entry);
+}
+
+/* Set up s to pass data on to next, leaving out runs of at least
+   mingap bytes of the value blank */
+int hex_skipsink(HEXSINK *s, HEXSINK *next, int blank, ULONG mingap)
+{
+    SKIPSTATE	*st;
+
+    if(!(st = malloc(sizeof(*st)))) {
+	ERR(H_ERR_IO);
+    }
+    st->blank = blank;
+    st->mingap = MAX(mingap, 1);
+    st->gaplen = 0;
+    st->started = FALSE;
+    memset(st->buf, blank, BLANKLEN);
+
+    memset(s, 0, sizeof(*s));
+    s->put = skip_put;
+    s->end = skip_end;
+    s->out = next->out;
+    s->format = next->format;
+    s->reclen = next->reclen;
+    s->next = next;
+    s->priv = st;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* bank splitting filter: the address space from lo up is cut into
+   windows of size bytes, one per chip, and each window is written to
+   its own file, rebased to address 0 and padded out with hex_fill. A
+   "%d" in the file name is replaced by the bank number, otherwise the
+   number is added as ".{n}" (ahead of a compression suffix). Windows
+   with no data between two that have data are written as well, so the
+   numbering follows the chips; the last bank written is the last one
+   with data. Addresses must ascend. */
+
+typedef struct bankstate {
+    int		format;		/* offset into converters[], or FMT_BINARY */
+    char	*name;
+    ULONG	lo;
+    ULONG	size;
+    long	cur;		/* bank being written, -1 before the first */
+    ULONG	next;		/* offset in it that has been written up to */
+    FILE	*f;
+    HEXSINK	bank;		/* output of the current bank */
+    UCHAR	buf[BLANKLEN];	/* padding */
+} BANKSTATE;
+
+/* pad the current bank out to offset to */
+static int bank_pad(BANKSTATE *st, ULONG to)
+{
+    ULONG	n;
+
+    while(st->next < to) {
+	n = MIN(to - st->next, BLANKLEN);
+	if(st->bank.put(&st->bank, st->next, st->buf, n))
+	    return hex_errno;
+	st->next += n;
+    }
+    return H_ERR_NONE;
+}
+
+/* pad out and close the current bank */
+static int bank_close(BANKSTATE *st, ULONG entry)
+{
+    ULONG	start = st->lo + st->cur * st->size;
+    int		ret;
+
+    if(st->cur < 0 || !st->f)
+	return H_ERR_NONE;
+    ret = bank_pad(st, st->size);
+    if(!ret)
+	ret = st->bank.end(&st->bank, (entry >= start &&
+				       entry - start < st->size) ?
+			   entry - start : 0);
+    if(fclose(st->f) && !ret) {
+	ret = H_ERR_IO;
+    }
+    st->f = NULL;
+    if(ret) {
+	ERR(ret);
+    }
+    return H_ERR_NONE;
+}
+
+/* open the file for the next bank */
+static int bank_open(BANKSTATE *st)
+{
+    char	*name, *c;
+    int		z;
+
+    st->cur++;
+    st->next = 0;
+    if(!(name = malloc(strlen(st->name) + 24))) {
+	ERR(H_ERR_IO);
+    }
+    z = hex_zmethod(st->name, TRUE);
+    if((c = strstr(st->name, "%d")))
+	sprintf(name, "%.*s%ld%s", (int)(c - st->name), st->name, st->cur,
+		c + 2);
+    else if(z >= 0 && (c = strrchr(st->name, '.')))
+	/* keep the compression suffix at the end */
+	sprintf(name, "%.*s.%ld%s", (int)(c - st->name), st->name, st->cur,
+		c);
+    else
+	sprintf(name, "%s.%ld", st->name, st->cur);
+
+    st->f = fopen(name, "w");
+    free(name);
+    if(!st->f || (z >= 0 && !(st->f = hex_zfwrite(st->f, z, 0)))) {
+	st->f = NULL;
+	ERR(H_ERR_IO);
+    }
+    if(st->format == FMT_BINARY)
+	hex_binsink(&st->bank, st->f, 0, (ULONG)-1);
+    else
+	hex_sinkinit(&st->bank, st->format, st->f);
+    return H_ERR_NONE;
+}
+
+static int bank_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    BANKSTATE	*st = s->priv;
+    ULONG	n, off;
+    long	b;
+
+    if(st->cur < 0 && st->lo == (ULONG)-1)
+	st->lo = addr;		/* banks start at the first address */
+    s->base = st->lo;
+    if(addr < st->lo) {
+	/* below the first bank */
+	n = MIN(len, st->lo - addr);
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    while(len) {
+	b = (addr - st->lo) / st->size;
+	off = (addr - st->lo) % st->size;
+	if(b < st->cur || (b == st->cur && off < st->next)) {
+	    ERR(H_ERR_ORDER);
+	}
+	while(st->cur < b) {
+	    if(bank_close(st, 0) || bank_open(st))
+		return hex_errno;
+	    st->bank.reclen = s->reclen;
+	}
+	n = MIN(len, st->size - off);
+	if(bank_pad(st, off) || st->bank.put(&st->bank, off, data, n))
+	    return hex_errno;
+	st->next = off + n;
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    return H_ERR_NONE;
+}
+
+static int bank_end(HEXSINK *s, ULONG entry)
+{
+    BANKSTATE	*st = s->priv;
+    int		ret;
+
+    ret = bank_close(st, entry);
+    free(st);
+    s->priv = NULL;
+    return ret;
+}
+
+/* Set up s to split what is put into it into banks of size bytes from
+   lo (or the first address put, if lo is (ULONG)-1), written in format
+   (FMT_BINARY for raw binary) to files named after name */
+int hex_banksink(HEXSINK *s, int format, char *name, ULONG lo, ULONG size)
+{
+    BANKSTATE	*st;
+
+    if(!size || (format != FMT_BINARY && !converters[format].put_hex)) {
+	ERR(H_ERR_UNSUP);
+    }
+    if(!(st = calloc(1, sizeof(*st)))) {
+	ERR(H_ERR_IO);
+    }
+    st->format = format;
+    st->name = name;
+    st->lo = lo;
+    st->size = size;
+    st->cur = -1;
+    memset(st->buf, hex_fill, BLANKLEN);
+
+    memset(s, 0, sizeof(*s));
+    s->put = bank_put;
+    s->end = bank_end;
+    s->format = format;
+    s->reclen = HEXRECLEN;
+    s->priv = st;
+    return H_ERR_NONE;
+}
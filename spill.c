@@ -0,0 +1,458 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Out-of-core images. A HEXSPILL holds decoded data in a pool of fixed
+ * size, for images too big to be held in memory. When the pool fills,
+ * its records are sorted by address, overlaps are settled (data added
+ * later wins, as in rd_hex) and the result is written to a temporary
+ * file as one run of ascending, non-overlapping blocks. The runs are
+ * merged in address order into a sink at the end. Every record in a
+ * run was added after every record in the runs before it, so where
+ * runs overlap the later run wins.
+ *
+ * The pool and its record table are allocated once, and the merge
+ * shares the same budget between the read buffers of the runs, so
+ * memory use stays flat however large or scattered the image is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "etools.h"
+#include "hex.h"
+
+#define SPILLBUFLEN	65536	/* read size for hex input */
+#define RUNMINBUF	4096	/* smallest read buffer for a run */
+#define SPILLFANIN	16	/* most runs merged at once */
+
+/* a record (or a run of contiguous records) held in the pool */
+typedef struct spent {
+    ULONG	addr;
+    ULONG	len;
+    ULONG	off;		/* offset of the data in the pool */
+    ULONG	seq;		/* order in which records were added */
+} SPENT;
+
+/* a run in the spill file, and its reader during the merge */
+typedef struct sprun {
+    ULONG	pos, end;	/* unread part of the run in the file */
+    UCHAR	*buf;
+    ULONG	bufsize, bufpos, buflen;
+    ULONG	addr;		/* address of the next byte of the block */
+    ULONG	left;		/* bytes of the block not yet taken */
+    ULONG	avail;		/* of those, bytes at buf+bufpos */
+} SPRUN;
+
+/* takes a block of data in address order: arg, address, data, length.
+   In the spill file each block is its address and length, then data. */
+typedef int SPEMITFUNC(void *, ULONG, UCHAR *, ULONG);
+
+
+/*---------------------------------------------------------------*/
+/* Set up a spill of at most maxmem bytes (SPILLMIN at least). An
+   eighth of it goes to the record table. */
+int hex_spillinit(HEXSPILL *sp, ULONG maxmem)
+{
+    memset(sp, 0, sizeof(*sp));
+    maxmem = MAX(maxmem, SPILLMIN);
+    sp->maxmem = maxmem;
+    sp->entalloc = (maxmem / 8) / (sizeof(SPENT) + sizeof(int));
+    sp->poolsize = maxmem - sp->entalloc * (sizeof(SPENT) + sizeof(int));
+    sp->hi = (ULONG)-1;
+    sp->ent = malloc(sp->entalloc * sizeof(SPENT));
+    sp->act = malloc(sp->entalloc * sizeof(int));
+    sp->pool = malloc(sp->poolsize);
+    if(!sp->ent || !sp->act || !sp->pool) {
+	hex_spillfree(sp);
+	ERR(H_ERR_IO);
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_spillfree(HEXSPILL *sp)
+{
+    free(sp->pool);
+    free(sp->ent);
+    free(sp->act);
+    free(sp->runs);
+    if(sp->tmp)
+	fclose(sp->tmp);
+    memset(sp, 0, sizeof(*sp));
+}
+
+
+/*---------------------------------------------------------------*/
+static int cmpent(const void *a, const void *b)
+{
+    const SPENT *ea = a, *eb = b;
+
+    if(ea->addr != eb->addr)
+	return ea->addr < eb->addr ? -1 : 1;
+    return ea->seq < eb->seq ? -1 : 1;
+}
+
+/* Pass the records in the pool to emit() in address order, without
+   overlaps. At each address the newest record that covers it wins;
+   act holds the records that cover the current address. */
+static int spill_sweep(HEXSPILL *sp, SPEMITFUNC *emit, void *arg)
+{
+    SPENT	*e = sp->ent;
+    int		*act = sp->act;
+    int		i, j, k, best, nact = 0;
+    ULONG	addr = 0, end;
+
+    qsort(e, sp->nent, sizeof(SPENT), cmpent);
+
+    for(i=0; i < sp->nent || nact; ) {
+	if(!nact)
+	    addr = e[i].addr;
+	while(i < sp->nent && e[i].addr <= addr)
+	    act[nact++] = i++;
+
+	/* drop the records that end before addr, and find the newest */
+	for(best=-1, j=k=0; j < nact; j++) {
+	    if(e[act[j]].addr + e[act[j]].len <= addr)
+		continue;
+	    act[k++] = act[j];
+	    if(best < 0 || e[act[j]].seq > e[best].seq)
+		best = act[j];
+	}
+	if(!(nact = k))
+	    continue;
+
+	/* it holds until it ends or another record starts */
+	end = e[best].addr + e[best].len;
+	if(i < sp->nent && e[i].addr < end)
+	    end = e[i].addr;
+	if(emit(arg, addr, sp->pool + e[best].off + (addr - e[best].addr),
+		end - addr))
+	    return hex_errno;
+	addr = end;
+    }
+    sp->nent = 0;
+    sp->poolused = 0;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Write a block to the end of the spill file */
+static int run_emit(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    HEXSPILL	*sp = arg;
+    ULONG	hdr[2];
+
+    hdr[0] = addr;
+    hdr[1] = len;
+    if(fwrite(hdr, sizeof(hdr), 1, sp->tmp) != 1 ||
+       fwrite(data, 1, len, sp->tmp) != len) {
+	ERR(H_ERR_IO);
+    }
+    sp->tmplen += sizeof(hdr) + len;
+    return H_ERR_NONE;
+}
+
+/* Write the pool to the spill file as a new run, and empty it */
+static int spill_run(HEXSPILL *sp)
+{
+    SPRUN	*r;
+    int		n;
+
+    if(!sp->tmp && !(sp->tmp = tmpfile())) {
+	ERR(H_ERR_IO);
+    }
+    if(sp->nrun == sp->runalloc) {
+	n = sp->runalloc ? sp->runalloc * 2 : 16;
+	if(!(r = realloc(sp->runs, n * sizeof(SPRUN)))) {
+	    ERR(H_ERR_IO);
+	}
+	sp->runs = r;
+	sp->runalloc = n;
+    }
+    r = (SPRUN *)sp->runs + sp->nrun++;
+    memset(r, 0, sizeof(*r));
+    r->pos = sp->tmplen;
+    if(spill_sweep(sp, run_emit, sp))
+	return hex_errno;
+    r->end = sp->tmplen;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Add data at addr, dropping any outside lo to hi. Contiguous records
+   share an entry in the record table. */
+int hex_spilladd(HEXSPILL *sp, ULONG addr, UCHAR *data, ULONG len)
+{
+    SPENT	*e;
+    ULONG	n;
+
+    if(!len || addr > sp->hi || addr + (len - 1) < sp->lo)
+	return H_ERR_NONE;
+    if(addr < sp->lo) {
+	data += sp->lo - addr;
+	len -= sp->lo - addr;
+	addr = sp->lo;
+    }
+    if(sp->hi - addr < len)
+	len = sp->hi - addr + 1;
+
+    while(len) {
+	if(sp->poolused == sp->poolsize && spill_run(sp))
+	    return hex_errno;
+	e = sp->nent ? (SPENT *)sp->ent + sp->nent - 1 : NULL;
+	if(!e || e->addr + e->len != addr ||
+	   e->off + e->len != sp->poolused) {
+	    if(sp->nent == sp->entalloc && spill_run(sp))
+		return hex_errno;
+	    e = (SPENT *)sp->ent + sp->nent++;
+	    e->addr = addr;
+	    e->len = 0;
+	    e->off = sp->poolused;
+	    e->seq = sp->seq++;
+	}
+	n = MIN(len, sp->poolsize - sp->poolused);
+	memcpy(sp->pool + sp->poolused, data, n);
+	sp->poolused += n;
+	e->len += n;
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int spilladd(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    return hex_spilladd(arg, addr, data, len);
+}
+
+/* Decode the hex file in, which is in the given format, into sp in one
+   pass with the format's push parser */
+int hex_spillload(FILE *in, int format, int ignoresum, HEXSPILL *sp)
+{
+    HEXPUSH	p;
+    UCHAR	buf[SPILLBUFLEN];
+    size_t	n;
+
+    if(hex_pushinit(&p, format, ignoresum, spilladd, sp))
+	return hex_errno;
+    while(!p.done && (n = fread(buf, 1, SPILLBUFLEN, in)) > 0)
+	if(hex_push(&p, buf, n))
+	    return hex_errno;
+    if(ferror(in)) {
+	ERR(H_ERR_IO);
+    }
+    if(hex_pushend(&p))
+	return hex_errno;
+    sp->entry = p.entry;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Make sure need bytes of run r are in its buffer, or as many as are
+   left */
+static int run_fill(int fd, SPRUN *r, ULONG need)
+{
+    ULONG	n;
+    ssize_t	got;
+
+    if(r->buflen - r->bufpos >= need)
+	return H_ERR_NONE;
+    memmove(r->buf, r->buf + r->bufpos, r->buflen - r->bufpos);
+    r->buflen -= r->bufpos;
+    r->bufpos = 0;
+    n = MIN(r->bufsize - r->buflen, r->end - r->pos);
+    while(n) {
+	if((got = pread(fd, r->buf + r->buflen, n, (off_t)r->pos)) <= 0) {
+	    ERR(H_ERR_IO);
+	}
+	r->pos += got;
+	r->buflen += got;
+	n -= got;
+    }
+    return H_ERR_NONE;
+}
+
+/* Set r->avail to the bytes of the current block of r that are in its
+   buffer, starting the next block if need be. It is left at 0 at the
+   end of the run. */
+static int run_head(int fd, SPRUN *r)
+{
+    ULONG	hdr[2];
+
+    if(r->avail)
+	return H_ERR_NONE;
+    if(!r->left) {
+	if(r->pos == r->end && r->bufpos == r->buflen)
+	    return H_ERR_NONE;
+	if(run_fill(fd, r, sizeof(hdr)))
+	    return hex_errno;
+	memcpy(hdr, r->buf + r->bufpos, sizeof(hdr));
+	r->bufpos += sizeof(hdr);
+	r->addr = hdr[0];
+	r->left = hdr[1];
+    }
+    if(run_fill(fd, r, 1))
+	return hex_errno;
+    r->avail = MIN(r->left, r->buflen - r->bufpos);
+    return H_ERR_NONE;
+}
+
+/* Take n bytes from the current block of r */
+static void run_take(SPRUN *r, ULONG n)
+{
+    r->bufpos += n;
+    r->addr += n;
+    r->left -= n;
+    r->avail -= n;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Merge the n runs at r, of which later ones win, and pass the result
+   to emit(). The memory budget is shared out as their read buffers. */
+static int run_merge(HEXSPILL *sp, SPRUN *r, int n, SPEMITFUNC *emit,
+		     void *arg)
+{
+    ULONG	addr = 0, lo, len;
+    int		fd = fileno(sp->tmp), i, best, live, ret = H_ERR_NONE;
+
+    len = MAX(sp->maxmem / n, RUNMINBUF);
+    for(i=0; i < n; i++) {
+	r[i].bufsize = len;
+	r[i].bufpos = r[i].buflen = r[i].left = r[i].avail = 0;
+	if(!(r[i].buf = malloc(len))) {
+	    while(i--)
+		free(r[i].buf);
+	    ERR(H_ERR_IO);
+	}
+    }
+
+    for(;;) {
+	/* skip what lies behind addr, and find the lowest address left */
+	for(live=FALSE, lo=0, i=0; i < n; i++) {
+	    for(;;) {
+		if((ret = run_head(fd, &r[i])))
+		    goto done;
+		if(!r[i].avail || r[i].addr >= addr)
+		    break;
+		run_take(&r[i], MIN(r[i].avail, addr - r[i].addr));
+	    }
+	    if(r[i].avail && (!live || r[i].addr < lo)) {
+		lo = r[i].addr;
+		live = TRUE;
+	    }
+	}
+	if(!live)
+	    break;
+	addr = MAX(addr, lo);
+
+	/* the latest run with data at addr holds until it runs out or a
+	   later run starts */
+	for(best=0, i=0; i < n; i++)
+	    if(r[i].avail && r[i].addr == addr)
+		best = i;
+	len = r[best].avail;
+	for(i=best+1; i < n; i++)
+	    if(r[i].avail)
+		len = MIN(len, r[i].addr - addr);
+	if((ret = emit(arg, addr, r[best].buf + r[best].bufpos, len)))
+	    goto done;
+	run_take(&r[best], len);
+	addr += len;
+    }
+
+  done:
+    for(i=0; i < n; i++)
+	free(r[i].buf);
+    return ret;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Pass a block to the sink, by way of hex_digest */
+static int sink_emit(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    HEXSINK	*s = arg;
+
+    if(hex_digest)
+	hex_dgblock(hex_digest, addr, data, len);
+    return s->put(s, addr, data, len);
+}
+
+/* Write the data to a sink in address order, and end it. If nothing
+   was spilled, the pool goes straight to the sink. Otherwise the pool
+   is spilled too and its memory freed for the merge. While there are
+   more than fanin runs, groups of fanin neighbouring runs are merged
+   into single runs at the end of the spill file, so the last merge
+   takes at most fanin runs and each of them gets a read buffer of a
+   useful size. */
+int hex_spillwrite(HEXSPILL *sp, HEXSINK *s)
+{
+    SPRUN	*r, m;
+    int		i, k, n, fanin;
+
+    if(!sp->nrun) {
+	if(spill_sweep(sp, sink_emit, s))
+	    return hex_errno;
+	return s->end(s, sp->entry);
+    }
+    if(sp->nent && spill_run(sp))
+	return hex_errno;
+    free(sp->pool);
+    free(sp->ent);
+    free(sp->act);
+    sp->pool = NULL;
+    sp->ent = sp->act = NULL;
+    if(fflush(sp->tmp)) {
+	ERR(H_ERR_IO);
+    }
+
+    r = sp->runs;
+    fanin = MAX(MIN(sp->maxmem / RUNMINBUF, SPILLFANIN), 2);
+    while(sp->nrun > fanin) {
+	for(n=0, i=0; i < sp->nrun; i += k) {
+	    k = MIN(fanin, sp->nrun - i);
+	    memset(&m, 0, sizeof(m));
+	    m.pos = sp->tmplen;
+	    if(run_merge(sp, &r[i], k, run_emit, sp))
+		return hex_errno;
+	    m.end = sp->tmplen;
+	    r[n++] = m;
+	}
+	sp->nrun = n;
+	if(fflush(sp->tmp)) {
+	    ERR(H_ERR_IO);
+	}
+    }
+    if(run_merge(sp, r, sp->nrun, sink_emit, s))
+	return hex_errno;
+    return s->end(s, sp->entry);
+}
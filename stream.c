@@ -0,0 +1,189 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Streaming decode. Nearly every hex file has its records in address
+ * order, and for those the binary can be written as each record is
+ * decoded: the push parser feeds a raw binary sink, which fills the
+ * gaps between records. Nothing is scanned first and nothing is held,
+ * so the first bytes come out as soon as the first block of input is
+ * in, and memory use does not depend on the file.
+ *
+ * A record below the end of the data already written breaks this. A
+ * strict stream then fails with H_ERR_ORDER. Otherwise, if the output
+ * is a file that can be read back, the stream falls back: what has
+ * been written (gaps and all, as rd_hex would fill them) goes into a
+ * HEXSPILL as the oldest data, the rest of the input follows it, and
+ * at the end the output is truncated and written again from the
+ * spill. The digests are started again from where they were.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "etools.h"
+#include "hex.h"
+
+#define STREAMBUFLEN	65536	/* read size for hex input, and for
+				   reading the output back */
+
+
+/*---------------------------------------------------------------*/
+/* Set up a stream that writes to out. It falls back to a spill of at
+   most maxmem bytes, if it has to and strict is not set. */
+void hex_streaminit(HEXSTREAM *st, FILE *out, int strict, ULONG maxmem)
+{
+    struct stat	sb;
+    off_t	pos;
+    int		fd;
+
+    memset(st, 0, sizeof(*st));
+    st->out = out;
+    st->strict = strict;
+    st->maxmem = MAX(maxmem, SPILLMIN);
+    hex_binsink(&st->sink, out, (ULONG)-1, (ULONG)-1);
+    if(hex_digest)
+	st->dgsave = *hex_digest;
+
+    /* the output can only be rewritten if it is a file open for
+       reading as well */
+    st->fd = -1;
+    fd = fileno(out);
+    if(!fflush(out) && !fstat(fd, &sb) && S_ISREG(sb.st_mode) &&
+       (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR &&
+       (pos = lseek(fd, 0, SEEK_CUR)) >= 0) {
+	st->fd = fd;
+	st->start = (ULONG)pos;
+    }
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_streamfree(HEXSTREAM *st)
+{
+    if(st->spilled)
+	hex_spillfree(&st->spill);
+    st->spilled = FALSE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Take the output written so far back into a spill */
+static int stream_spill(HEXSTREAM *st)
+{
+    UCHAR	buf[STREAMBUFLEN];
+    ULONG	off, len, n;
+
+    if(fflush(st->out)) {
+	ERR(H_ERR_IO);
+    }
+    if(hex_spillinit(&st->spill, st->maxmem))
+	return hex_errno;
+    st->spilled = TRUE;
+
+    len = st->next - st->sink.base;
+    for(off=0; off < len; off += n) {
+	n = MIN(len - off, STREAMBUFLEN);
+	if(pread(st->fd, buf, n, (off_t)(st->start + off)) != (ssize_t)n) {
+	    ERR(H_ERR_IO);
+	}
+	if(hex_spilladd(&st->spill, st->sink.base + off, buf, n))
+	    return hex_errno;
+    }
+
+    /* the digests see it all again when the spill is written */
+    if(hex_digest)
+	*hex_digest = st->dgsave;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int stream_rec(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    HEXSTREAM	*st = arg;
+
+    if(!len)
+	return H_ERR_NONE;
+    if(st->spilled)
+	return hex_spilladd(&st->spill, addr, data, len);
+
+    if(st->started && addr < st->next) {
+	st->backaddr = addr;
+	if(st->strict || st->fd < 0) {
+	    ERR(H_ERR_ORDER);
+	}
+	if(stream_spill(st))
+	    return hex_errno;
+	return hex_spilladd(&st->spill, addr, data, len);
+    }
+
+    if(hex_digest)
+	hex_dgblock(hex_digest, addr, data, len);
+    if(st->sink.put(&st->sink, addr, data, len))
+	return hex_errno;
+    st->started = TRUE;
+    st->next = addr + len;
+    return H_ERR_NONE;
+}
+
+/* Decode the hex file in, which is in the given format, to the stream's
+   output in one pass. On return base and entry are set; on H_ERR_ORDER
+   backaddr is the address that went back, and next the address the
+   output had reached. */
+int hex_streamload(FILE *in, int format, int ignoresum, HEXSTREAM *st)
+{
+    HEXPUSH	p;
+    UCHAR	buf[STREAMBUFLEN];
+    size_t	n;
+
+    if(hex_pushinit(&p, format, ignoresum, stream_rec, st))
+	return hex_errno;
+    while(!p.done && (n = fread(buf, 1, STREAMBUFLEN, in)) > 0)
+	if(hex_push(&p, buf, n))
+	    return hex_errno;
+    if(ferror(in)) {
+	ERR(H_ERR_IO);
+    }
+    if(hex_pushend(&p))
+	return hex_errno;
+    st->entry = p.entry;
+
+    if(st->spilled) {
+	/* write it all again, from the start of the output */
+	if(fflush(st->out) || ftruncate(st->fd, (off_t)st->start) ||
+	   fseek(st->out, (long)st->start, SEEK_SET)) {
+	    ERR(H_ERR_IO);
+	}
+	hex_binsink(&st->sink, st->out, (ULONG)-1, (ULONG)-1);
+	st->spill.entry = p.entry;
+	if(hex_spillwrite(&st->spill, &st->sink))
+	    return hex_errno;
+    }
+    else if(st->sink.end(&st->sink, p.entry))
+	return hex_errno;
+    st->base = st->sink.base == (ULONG)-1 ? 0 : st->sink.base;
+    return H_ERR_NONE;
+}
@@ -0,0 +1,451 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Record tables. A HEXTABLE holds the records of a hex file as decoded,
+ * one row per record, with each field in an array of its own: the
+ * absolute address, the length, the kind of record, where it was in
+ * the file, and where its data is in one shared arena. The operations
+ * that would otherwise mean parsing the text again (sorting, merging,
+ * finding overlaps, looking up a range, cutting the data into records
+ * of another size) run over the address and length arrays alone,
+ * which are small and read in order. The arrays are plain, so a table
+ * is also a convenient form to hand decoded records to other code.
+ *
+ * Rows other than data (address, start and end records) are only kept
+ * until the table is sorted; out of file order they mean nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+#define TABMINROWS	256	/* smallest allocation of rows */
+#define TABMINARENA	4096	/* smallest allocation of the arena */
+
+/* a row's sort key */
+typedef struct tabkey {
+    ULONG	addr;
+    ULONG	row;
+} TABKEY;
+
+
+/*---------------------------------------------------------------*/
+void hex_tabinit(HEXTABLE *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->sorted = TRUE;
+}
+
+
+/*---------------------------------------------------------------*/
+void hex_tabfree(HEXTABLE *t)
+{
+    free(t->addr);
+    free(t->len);
+    free(t->type);
+    free(t->src);
+    free(t->off);
+    free(t->arena);
+    hex_tabinit(t);
+}
+
+
+/*---------------------------------------------------------------*/
+/* make room for n rows */
+static int tab_grow(HEXTABLE *t, ULONG n)
+{
+    ULONG	*na, *nl, *ns, *no;
+    UCHAR	*nt;
+
+    if(n <= t->alloc)
+	return H_ERR_NONE;
+    n = MAX(n, MAX(t->alloc * 2, TABMINROWS));
+    na = realloc(t->addr, n * sizeof(ULONG));
+    if(na)
+	t->addr = na;
+    nl = realloc(t->len, n * sizeof(ULONG));
+    if(nl)
+	t->len = nl;
+    nt = realloc(t->type, n);
+    if(nt)
+	t->type = nt;
+    ns = realloc(t->src, n * sizeof(ULONG));
+    if(ns)
+	t->src = ns;
+    no = realloc(t->off, n * sizeof(ULONG));
+    if(no)
+	t->off = no;
+    if(!na || !nl || !nt || !ns || !no) {
+	ERR(H_ERR_IO);
+    }
+    t->alloc = n;
+    return H_ERR_NONE;
+}
+
+/* make room for len more bytes in the arena */
+static int tab_arena(HEXTABLE *t, ULONG len)
+{
+    UCHAR	*na;
+    ULONG	n;
+
+    if(t->arenalen + len <= t->arenaalloc)
+	return H_ERR_NONE;
+    n = MAX(t->arenalen + len, MAX(t->arenaalloc * 2, TABMINARENA));
+    if(!(na = realloc(t->arena, n))) {
+	ERR(H_ERR_IO);
+    }
+    t->arena = na;
+    t->arenaalloc = n;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Add a row of the given type for len bytes of data at addr (for
+   rows other than TAB_DATA, addr is the address the record sets, and
+   data is its contents). src is the offset of the record in its file,
+   or (ULONG)-1 if it has none. */
+int hex_tabadd(HEXTABLE *t, int type, ULONG addr, UCHAR *data, ULONG len,
+	       ULONG src)
+{
+    ULONG	n = t->n;
+
+    if(tab_grow(t, n + 1) || tab_arena(t, len))
+	return hex_errno;
+    if(type != TAB_DATA || (n && t->type[n-1] == TAB_DATA &&
+			    addr < t->addr[n-1]))
+	t->sorted = FALSE;
+    t->addr[n] = addr;
+    t->len[n] = len;
+    t->type[n] = type;
+    t->src[n] = src;
+    t->off[n] = t->arenalen;
+    if(len)
+	memcpy(t->arena + t->arenalen, data, len);
+    t->arenalen += len;
+    if(type == TAB_DATA && len > t->maxlen)
+	t->maxlen = len;
+    t->n++;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Decode a hex file into a table, with a row for every record */
+int hex_tabload(FILE *in, int format, int ignoresum, HEXTABLE *t)
+{
+    if(!converters[format].tab_hex) {
+	ERR(H_ERR_UNSUP);
+    }
+    return converters[format].tab_hex(in, ignoresum, t);
+}
+
+
+/*---------------------------------------------------------------*/
+/* Append the data rows of from to t, so that where they overlap the
+   rows of from win */
+int hex_tabmerge(HEXTABLE *t, HEXTABLE *from)
+{
+    ULONG	i;
+
+    for(i=0; i < from->n; i++)
+	if(from->type[i] == TAB_DATA &&
+	   hex_tabadd(t, TAB_DATA, from->addr[i], from->arena + from->off[i],
+		      from->len[i], from->src[i]))
+	    return hex_errno;
+    if(from->entry)
+	t->entry = from->entry;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int cmpkey(const void *a, const void *b)
+{
+    const TABKEY *ka = a, *kb = b;
+
+    if(ka->addr != kb->addr)
+	return ka->addr < kb->addr ? -1 : 1;
+    return ka->row < kb->row ? -1 : ka->row > kb->row;
+}
+
+/* Sort the data rows by address, keeping rows at the same address in
+   the order they were added, and drop the other rows. The arena is
+   left as it is; only the rows move. */
+int hex_tabsort(HEXTABLE *t)
+{
+    TABKEY	*k;
+    ULONG	*na, *nl, *ns, *no;
+    ULONG	i, n;
+
+    if(t->sorted)
+	return H_ERR_NONE;
+
+    /* sort (address, row) pairs rather than whole rows */
+    if(!(k = malloc(MAX(t->n, 1) * sizeof(TABKEY)))) {
+	ERR(H_ERR_IO);
+    }
+    for(i = n = 0; i < t->n; i++)
+	if(t->type[i] == TAB_DATA) {
+	    k[n].addr = t->addr[i];
+	    k[n++].row = i;
+	}
+    qsort(k, n, sizeof(TABKEY), cmpkey);
+
+    /* then gather each column in the new order */
+    na = malloc(MAX(n, 1) * sizeof(ULONG));
+    nl = malloc(MAX(n, 1) * sizeof(ULONG));
+    ns = malloc(MAX(n, 1) * sizeof(ULONG));
+    no = malloc(MAX(n, 1) * sizeof(ULONG));
+    if(!na || !nl || !ns || !no) {
+	free(na);
+	free(nl);
+	free(ns);
+	free(no);
+	free(k);
+	ERR(H_ERR_IO);
+    }
+    for(i=0; i < n; i++) {
+	na[i] = k[i].addr;
+	nl[i] = t->len[k[i].row];
+	ns[i] = t->src[k[i].row];
+	no[i] = t->off[k[i].row];
+    }
+    memset(t->type, TAB_DATA, n);
+    free(t->addr);
+    free(t->len);
+    free(t->src);
+    free(t->off);
+    free(k);
+    t->addr = na;
+    t->len = nl;
+    t->src = ns;
+    t->off = no;
+    t->n = n;
+    t->alloc = MAX(n, 1);
+    t->sorted = TRUE;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Call report with each row of a sorted table that overlaps a row
+   before it, and the earlier row that reaches furthest. Returns the
+   number of such rows, or (ULONG)-1 on error. */
+ULONG hex_taboverlap(HEXTABLE *t, HEXTABFUNC *report, void *arg)
+{
+    ULONG	i, far = (ULONG)-1, n = 0;
+
+    if(hex_tabsort(t))
+	return (ULONG)-1;
+    for(i=0; i < t->n; i++) {
+	if(!t->len[i])
+	    continue;
+	if(far != (ULONG)-1 &&
+	   t->addr[i] <= t->addr[far] + (t->len[far] - 1)) {
+	    n++;
+	    if(report)
+		report(arg, far, i);
+	}
+	if(far == (ULONG)-1 || t->addr[i] + (t->len[i] - 1) >
+	   t->addr[far] + (t->len[far] - 1))
+	    far = i;
+    }
+    return n;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Find the rows of a sorted table that may hold data from lo to hi:
+   *first is set to the first and *last to one past the last. If rows
+   overlap, some of them may end before lo; hex_tabblock() gives a
+   table without overlaps, for which the rows are exactly those. */
+int hex_tabrange(HEXTABLE *t, ULONG lo, ULONG hi, ULONG *first, ULONG *last)
+{
+    ULONG	a, b, m, i;
+
+    if(hex_tabsort(t))
+	return hex_errno;
+
+    /* the first row that starts above hi */
+    for(a=0, b=t->n; a < b; ) {
+	m = a + (b - a) / 2;
+	if(t->addr[m] <= hi)
+	    a = m + 1;
+	else
+	    b = m;
+    }
+    *last = a;
+
+    /* the first row that starts at or above lo, then back over any
+       that start below it and reach it */
+    for(a=0, b=*last; a < b; ) {
+	m = a + (b - a) / 2;
+	if(t->addr[m] < lo)
+	    a = m + 1;
+	else
+	    b = m;
+    }
+    for(i=a; i > 0; i--)
+	if(t->len[i-1] && t->addr[i-1] + (t->len[i-1] - 1) >= lo)
+	    a = i - 1;
+	else if(t->addr[i-1] + t->maxlen <= lo)
+	    break;
+    *first = a;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Pass the data of a table to emit() in address order, without
+   overlaps; where rows overlap, the one added last wins (as in
+   rd_hex). This is the sweep of spill.c, over the table's rows. */
+typedef int TABEMITFUNC(void *, ULONG, UCHAR *, ULONG);
+
+static int tab_sweep(HEXTABLE *t, TABEMITFUNC *emit, void *arg)
+{
+    ULONG	*act;
+    ULONG	i, j, k, best, nact = 0, addr = 0, end;
+    int		found;
+
+    if(hex_tabsort(t))
+	return hex_errno;
+    if(!(act = malloc(MAX(t->n, 1) * sizeof(ULONG)))) {
+	ERR(H_ERR_IO);
+    }
+
+    for(i=0; i < t->n || nact; ) {
+	if(!nact)
+	    addr = t->addr[i];
+	while(i < t->n && t->addr[i] <= addr)
+	    act[nact++] = i++;
+
+	/* drop the rows that end before addr, and find the newest */
+	for(found=FALSE, best=0, j=k=0; j < nact; j++) {
+	    if(t->addr[act[j]] + t->len[act[j]] <= addr)
+		continue;
+	    act[k++] = act[j];
+	    if(!found || t->off[act[j]] > t->off[best]) {
+		best = act[j];
+		found = TRUE;
+	    }
+	}
+	if(!(nact = k))
+	    continue;
+
+	/* it holds until it ends or another row starts */
+	end = t->addr[best] + t->len[best];
+	if(i < t->n && t->addr[i] < end)
+	    end = t->addr[i];
+	if(emit(arg, addr, t->arena + t->off[best] + (addr - t->addr[best]),
+		end - addr)) {
+	    free(act);
+	    return hex_errno;
+	}
+	addr = end;
+    }
+    free(act);
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Re-blocking: runs from the sweep are joined where they meet, and cut
+   into rows of at most reclen bytes that do not cross a multiple of
+   reclen (reclen 0 only joins them) */
+typedef struct tabblock {
+    HEXTABLE	*out;
+    ULONG	reclen;
+    ULONG	row;		/* row being filled, or (ULONG)-1 */
+} TABBLOCK;
+
+static int block_emit(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    TABBLOCK	*b = arg;
+    HEXTABLE	*o = b->out;
+    ULONG	n, room;
+
+    while(len) {
+	/* start a new row unless this carries on from the last one */
+	if(b->row == (ULONG)-1 ||
+	   o->addr[b->row] + o->len[b->row] != addr ||
+	   (b->reclen && (addr % b->reclen) == 0)) {
+	    if(hex_tabadd(o, TAB_DATA, addr, NULL, 0, (ULONG)-1))
+		return hex_errno;
+	    b->row = o->n - 1;
+	}
+	room = b->reclen ? b->reclen - (addr % b->reclen) : len;
+	n = MIN(len, room);
+	if(tab_arena(o, n))
+	    return hex_errno;
+	memcpy(o->arena + o->arenalen, data, n);
+	o->arenalen += n;
+	o->len[b->row] += n;
+	if(o->len[b->row] > o->maxlen)
+	    o->maxlen = o->len[b->row];
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    return H_ERR_NONE;
+}
+
+/* Build in out (which should be empty) the data of t without
+   overlaps, the row added last winning, as rows of at most reclen
+   bytes each aligned to reclen, or as the longest runs if reclen is
+   0. The new rows have no source offset. */
+int hex_tabblock(HEXTABLE *t, HEXTABLE *out, ULONG reclen)
+{
+    TABBLOCK	b;
+
+    b.out = out;
+    b.reclen = reclen;
+    b.row = (ULONG)-1;
+    if(tab_sweep(t, block_emit, &b))
+	return hex_errno;
+    out->entry = t->entry;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+static int sink_emit(void *arg, ULONG addr, UCHAR *data, ULONG len)
+{
+    HEXSINK	*s = arg;
+
+    if(hex_digest)
+	hex_dgblock(hex_digest, addr, data, len);
+    return s->put(s, addr, data, len);
+}
+
+/* Write a table to a sink in address order, the row added last
+   winning where rows overlap. The data is passed to hex_digest on
+   the way, as hex_imgwrite() does. */
+int hex_tabwrite(HEXTABLE *t, HEXSINK *s)
+{
+    if(tab_sweep(t, sink_emit, s))
+	return hex_errno;
+    return s->end(s, t->entry);
+}
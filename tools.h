@@ -0,0 +1,43 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+/* Declarations shared by the programs linked into the bin2hex
+   multi-call binary. Each program is selected by the name it is
+   called by (argv[0]). */
+
+#ifndef __tools_h
+#define __tools_h
+
+#define VERSION "version 0.2 (ALPHA) (C) 1995 Mark J. Blair, distributed under GPLv3"
+
+/* bhmain.c */
+extern int calledas(char *, char *);
+extern int getrange(char *, ULONG *, ULONG *);
+extern int getformat(char *);
+
+/* entry points of the other programs */
+extern int hexcmp_main(int, char **);
+extern int hexmerge_main(int, char **);
+extern int scanhex_main(int, char **);
+extern int blankcheck_main(int, char **);
+
+#endif /* __tools_h */
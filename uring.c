@@ -0,0 +1,488 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Batched file reads, for jobs that go through many small files. Read
+ * one at a time, each file costs an open, a stat, a read or two and a
+ * close, each waited for in turn, and on network storage the waits
+ * dominate. hex_readfiles() reads whole files while keeping a window
+ * of them in flight at once through io_uring, so the waits overlap
+ * with each other and with the decoding of the files already read.
+ *
+ * The ring is driven directly through the system calls and the
+ * structures in <linux/io_uring.h>. If the kernel has no io_uring, it
+ * is not allowed (as under some seccomp policies), or it predates the
+ * open, stat and read operations (5.6), the files are read with plain
+ * system calls instead; the callers see no difference.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "etools.h"
+#include "hex.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/* the ring operations used first appeared in the 5.6 headers */
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define HAVE_URING
+#endif
+
+#define RDCHUNK		65536	/* read size when the file size is unknown */
+#define RDMAXDEPTH	1024	/* most files in flight */
+
+/* what a completion is for (the low bits of its user_data) */
+#define OP_OPEN		0
+#define OP_STAT		1
+#define OP_READ		2
+#define OP_CLOSE	3
+#define OPBITS		2
+
+/* a file being read, in slot (file % depth) of the window */
+typedef struct rdslot {
+    int		file;		/* index into names, or -1 */
+    int		fd;
+    int		pending;	/* open and stat not yet complete */
+    int		done;		/* read to the end, or failed */
+    int		err;		/* errno on failure, or 0 */
+    int		regular;	/* size is known */
+    ULONG	size;
+    UCHAR	*buf;
+    ULONG	len, alloc;
+#ifdef HAVE_URING
+    struct statx stx;
+#endif
+} RDSLOT;
+
+
+/*---------------------------------------------------------------*/
+/* Hand a file to done(), with errno set if it could not be read */
+static int rd_deliver(RDSLOT *sl, HEXFILEFUNC *done, void *arg)
+{
+    int		ret;
+
+    errno = sl->err;
+    ret = done(arg, sl->file, sl->err ? NULL : sl->buf, sl->len);
+    free(sl->buf);
+    sl->buf = NULL;
+    sl->file = -1;
+    return ret;
+}
+
+/* Read a file with plain system calls */
+static void rd_sync(char *name, RDSLOT *sl)
+{
+    struct stat	st;
+    UCHAR	*nb;
+    ssize_t	n;
+    int		fd;
+
+    sl->len = sl->alloc = 0;
+    sl->buf = NULL;
+    sl->err = 0;
+    if((fd = open(name, O_RDONLY)) < 0) {
+	sl->err = errno;
+	return;
+    }
+    sl->alloc = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ?
+	(ULONG)st.st_size + 1 : RDCHUNK;
+    for(;;) {
+	if(sl->len == sl->alloc)
+	    sl->alloc *= 2;
+	if(!(nb = realloc(sl->buf, sl->alloc))) {
+	    sl->err = ENOMEM;
+	    break;
+	}
+	sl->buf = nb;
+	if((n = read(fd, sl->buf + sl->len, sl->alloc - sl->len)) <= 0) {
+	    if(n < 0)
+		sl->err = errno;
+	    break;
+	}
+	sl->len += n;
+    }
+    close(fd);
+}
+
+static int rd_syncall(char **names, int n, HEXFILEFUNC *done, void *arg)
+{
+    RDSLOT	sl;
+    int		i, ret;
+
+    for(i=0; i < n; i++) {
+	sl.file = i;
+	rd_sync(names[i], &sl);
+	if((ret = rd_deliver(&sl, done, arg)))
+	    return ret;
+    }
+    return H_ERR_NONE;
+}
+
+
+#ifdef HAVE_URING
+/*---------------------------------------------------------------*/
+/* the ring, as mapped from the kernel */
+typedef struct uring {
+    int		fd;
+    unsigned	*sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned	*cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned	sqentries;
+    unsigned	queued;		/* entries not yet submitted */
+    void	*sqmap, *cqmap;
+    size_t	sqmaplen, cqmaplen;
+    int		inflight;	/* requests submitted, not completed */
+} URING;
+
+static int ur_setup(URING *r, unsigned entries)
+{
+    struct io_uring_params p;
+    UCHAR	*sq, *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    if((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+	return -1;
+    if(!(p.features & IORING_FEAT_RW_CUR_POS)) {
+	/* older than 5.6: no open, stat or read operations */
+	close(r->fd);
+	return -1;
+    }
+
+    r->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+	r->sqmaplen = r->cqmaplen = MAX(r->sqmaplen, r->cqmaplen);
+    r->sqmap = mmap(NULL, r->sqmaplen, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sqmap == MAP_FAILED)
+	goto fail;
+    r->cqmap = r->sqmap;
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+	r->cqmap = mmap(NULL, r->cqmaplen, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if(r->cqmap == MAP_FAILED) {
+	    munmap(r->sqmap, r->sqmaplen);
+	    goto fail;
+	}
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+		   IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED) {
+	if(r->cqmap != r->sqmap)
+	    munmap(r->cqmap, r->cqmaplen);
+	munmap(r->sqmap, r->sqmaplen);
+	goto fail;
+    }
+
+    sq = r->sqmap;
+    cq = r->cqmap;
+    r->sqhead = (unsigned *)(sq + p.sq_off.head);
+    r->sqtail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqarray = (unsigned *)(sq + p.sq_off.array);
+    r->cqhead = (unsigned *)(cq + p.cq_off.head);
+    r->cqtail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqentries = p.sq_entries;
+    return 0;
+
+  fail:
+    close(r->fd);
+    return -1;
+}
+
+static void ur_close(URING *r)
+{
+    munmap(r->sqes, r->sqentries * sizeof(struct io_uring_sqe));
+    if(r->cqmap != r->sqmap)
+	munmap(r->cqmap, r->cqmaplen);
+    munmap(r->sqmap, r->sqmaplen);
+    close(r->fd);
+}
+
+/* Get a cleared submission entry; the caller sizes the ring so that
+   it never runs out between submissions */
+static struct io_uring_sqe *ur_get(URING *r, int slot, int op)
+{
+    struct io_uring_sqe *sqe;
+    unsigned	tail = *r->sqtail + r->queued;
+
+    sqe = &r->sqes[tail & *r->sqmask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((__u64)slot << OPBITS) | op;
+    r->sqarray[tail & *r->sqmask] = tail & *r->sqmask;
+    r->queued++;
+    return sqe;
+}
+
+/* Submit what is queued and wait for at least one completion */
+static int ur_wait(URING *r)
+{
+    unsigned	n = r->queued;
+    int		ret;
+
+    __atomic_store_n(r->sqtail, *r->sqtail + n, __ATOMIC_RELEASE);
+    r->queued = 0;
+    r->inflight += n;
+    ret = syscall(__NR_io_uring_enter, r->fd, n, 1, IORING_ENTER_GETEVENTS,
+		  NULL, 0);
+    while(ret < 0 && errno == EINTR)
+	ret = syscall(__NR_io_uring_enter, r->fd, 0, 1,
+		      IORING_ENTER_GETEVENTS, NULL, 0);
+    return ret < 0 ? -1 : 0;
+}
+
+
+/*---------------------------------------------------------------*/
+/* Queue the open and stat of file i in sl */
+static void ur_start(URING *r, char *name, RDSLOT *sl, int slot, int i)
+{
+    struct io_uring_sqe *sqe;
+
+    memset(sl, 0, sizeof(*sl));
+    sl->file = i;
+    sl->fd = -1;
+    sl->pending = 2;
+
+    sqe = ur_get(r, slot, OP_OPEN);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (__u64)(unsigned long)name;
+    sqe->open_flags = O_RDONLY;
+
+    sqe = ur_get(r, slot, OP_STAT);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (__u64)(unsigned long)name;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (__u64)(unsigned long)&sl->stx;
+}
+
+/* Queue the next read of sl, growing its buffer if it is full */
+static void ur_read(URING *r, RDSLOT *sl, int slot)
+{
+    struct io_uring_sqe *sqe;
+    UCHAR	*nb;
+
+    if(sl->len == sl->alloc) {
+	sl->alloc = sl->alloc ? sl->alloc * 2 :
+	    sl->regular ? sl->size + 1 : RDCHUNK;
+	if(!(nb = realloc(sl->buf, sl->alloc))) {
+	    sl->err = ENOMEM;
+	    sl->done = TRUE;
+	    return;
+	}
+	sl->buf = nb;
+    }
+    sqe = ur_get(r, slot, OP_READ);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = sl->fd;
+    sqe->addr = (__u64)(unsigned long)(sl->buf + sl->len);
+    sqe->len = MIN(sl->alloc - sl->len, 0x40000000UL);
+    sqe->off = sl->regular ? sl->len : (__u64)-1;
+}
+
+/* Act on one completion */
+static void ur_complete(URING *r, RDSLOT *slots, struct io_uring_cqe *cqe)
+{
+    RDSLOT	*sl = &slots[cqe->user_data >> OPBITS];
+    int		res = cqe->res;
+
+    r->inflight--;
+    switch(cqe->user_data & ((1 << OPBITS) - 1)) {
+
+      case OP_CLOSE:
+	return;
+
+      case OP_OPEN:
+	if(res < 0)
+	    sl->err = -res;
+	else
+	    sl->fd = res;
+	break;
+
+      case OP_STAT:
+	/* without a size the file is read in chunks */
+	if(res == 0 && S_ISREG(sl->stx.stx_mode)) {
+	    sl->regular = TRUE;
+	    sl->size = sl->stx.stx_size;
+	}
+	break;
+
+      case OP_READ:
+	if(res < 0 && res != -EAGAIN && res != -EINTR) {
+	    sl->err = -res;
+	    sl->done = TRUE;
+	}
+	else if(res == 0)
+	    sl->done = TRUE;
+	else if(res > 0)
+	    sl->len += res;
+	if(!sl->done && sl->regular && sl->len == sl->size && sl->len) {
+	    /* a regular file that has all been read needs no read to
+	       find its end */
+	    sl->done = TRUE;
+	}
+	if(!sl->done)
+	    ur_read(r, sl, cqe->user_data >> OPBITS);
+	return;
+    }
+
+    if(--sl->pending)
+	return;
+    if(sl->err)
+	sl->done = TRUE;
+    else
+	ur_read(r, sl, cqe->user_data >> OPBITS);
+}
+
+static int rd_uring(URING *r, char **names, int n, int depth,
+		    HEXFILEFUNC *done, void *arg)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    RDSLOT	*slots;
+    RDSLOT	*sl;
+    unsigned	head;
+    int		i, next = 0, ret = H_ERR_NONE;
+
+    if(!(slots = calloc(depth, sizeof(RDSLOT)))) {
+	ERR(H_ERR_IO);
+    }
+    for(i=0; i < depth && i < n; i++)
+	ur_start(r, names[i], &slots[i], i, i);
+
+    while(next < n) {
+	if(ur_wait(r)) {
+	    ret = hex_errno = H_ERR_IO;
+	    break;
+	}
+
+	/* reap the completions */
+	head = *r->cqhead;
+	while(head != __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE)) {
+	    cqe = &r->cqes[head & *r->cqmask];
+	    ur_complete(r, slots, cqe);
+	    head++;
+	}
+	__atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+
+	/* hand over the files that are done, in order, closing them
+	   and starting the files that take their slots */
+	while(next < n && (sl = &slots[next % depth])->done) {
+	    if(sl->fd >= 0) {
+		sqe = ur_get(r, 0, OP_CLOSE);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = sl->fd;
+	    }
+	    if((ret = rd_deliver(sl, done, arg)))
+		break;
+	    if(next + depth < n)
+		ur_start(r, names[next + depth], sl, next % depth,
+			 next + depth);
+	    next++;
+	}
+	if(ret)
+	    break;
+    }
+
+    /* wait for anything still in flight (closes, or reads that were
+       abandoned) before the buffers and the ring go */
+    while(r->queued || r->inflight) {
+	if(ur_wait(r))
+	    break;
+	head = *r->cqhead;
+	while(head != __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE)) {
+	    cqe = &r->cqes[head & *r->cqmask];
+	    r->inflight--;
+	    if((cqe->user_data & ((1 << OPBITS) - 1)) == OP_OPEN &&
+	       cqe->res >= 0)
+		close(cqe->res);
+	    head++;
+	}
+	__atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+    }
+    for(i=0; i < depth; i++) {
+	if(slots[i].file >= 0 && slots[i].fd >= 0)
+	    close(slots[i].fd);
+	free(slots[i].buf);
+    }
+    free(slots);
+    return ret;
+}
+#endif /* HAVE_URING */
+
+
+/*---------------------------------------------------------------*/
+/* TRUE if hex_readfiles() can use io_uring here */
+int hex_uringok(void)
+{
+#ifdef HAVE_URING
+    static int	ok = -1;
+    URING	r;
+
+    if(ok < 0) {
+	ok = ur_setup(&r, 2) == 0;
+	if(ok)
+	    ur_close(&r);
+    }
+    return ok;
+#else
+    return FALSE;
+#endif
+}
+
+/* Read the n files named in names, with up to depth of them in flight
+   at once, and call done(arg, i, data, len) for each in turn, in the
+   order given. data is NULL, with errno set, if file i could not be
+   read. The data is freed when done() returns. If done() returns
+   non-zero, no more files are handed over and that is returned. */
+int hex_readfiles(char **names, int n, int depth, HEXFILEFUNC *done,
+		  void *arg)
+{
+#ifdef HAVE_URING
+    URING	r;
+    int		ret;
+
+    depth = MIN(MIN(depth, n), RDMAXDEPTH);
+    if(depth > 1 && hex_uringok() && ur_setup(&r, depth * 4) == 0) {
+	ret = rd_uring(&r, names, n, depth, done, arg);
+	ur_close(&r);
+	return ret;
+    }
+#endif
+    return rd_syncall(names, n, done, arg);
+}
@@ -0,0 +1,390 @@
+/*
+ * eprom_tools: A collection of utilities for use with EPROM programmers
+ *
+ * Copyright (C) 1995 Mark J. Blair
+ *
+ * This file is part of eprom_tools.
+ *
+ *  eprom_tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  eprom_tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with eprom_tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Transform chains. hex_xformsink() turns a description such as
+ * "reloc=0x8000,crop=0:0xffff,swap16,fill=0xff" into a chain of filter
+ * sinks, one per stage, that sits between the reader and the writer,
+ * so the whole chain runs in the one streaming pass. The stages are:
+ *
+ *	reloc={base}	move the data so that the first byte lands at
+ *			{base}; the entry address moves with it
+ *	reloc=+{n}	move the data up (or with -, down) by {n}
+ *	crop={lo}:{hi}	drop data outside lo..hi
+ *	swap16		swap the bytes of each 16-bit word (pairs of
+ *			bytes at an even address and the one after it)
+ *	fill={value}	fill holes between the data with {value}; after
+ *			a crop, the whole crop window is filled
+ *
+ * reloc with a base and fill need the data in ascending address order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etools.h"
+#include "hex.h"
+
+#define XBUFLEN		65536	/* swap16 output, and fill pattern */
+
+#define X_RELOC		0
+#define X_CROP		1
+#define X_SWAP16	2
+#define X_FILL		3
+
+typedef struct xstage {
+    HEXSINK	sink;		/* this stage */
+    int		type;
+    long	delta;		/* reloc: offset added to addresses */
+    int		deltaset;	/* reloc: FALSE until the base is known */
+    ULONG	base;		/* reloc: where the first byte goes */
+    ULONG	lo, hi;		/* crop window, or the window filled */
+    int		window;		/* fill: lo..hi is set */
+    int		value;		/* fill: the value */
+    int		started;	/* fill: next is valid */
+    ULONG	next;		/* fill: address up to which data is out */
+    int		wrapped;	/* fill: next went past the top, to 0 */
+    int		pend;		/* swap16: a byte waits for its partner */
+    ULONG	pendaddr;
+    UCHAR	pendbyte;
+    UCHAR	*buf;		/* XBUFLEN bytes, for swap16 and fill */
+} XSTAGE;
+
+
+/*---------------------------------------------------------------*/
+/* relocation */
+
+static int reloc_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    XSTAGE	*x = s->priv;
+
+    if(!x->deltaset) {
+	x->delta = (long)(x->base - addr);
+	x->deltaset = TRUE;
+    }
+    return s->next->put(s->next, addr + x->delta, data, len);
+}
+
+/*---------------------------------------------------------------*/
+/* cropping */
+
+static int crop_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    XSTAGE	*x = s->priv;
+    ULONG	n;
+
+    if(!len || addr > x->hi || addr + (len - 1) < x->lo)
+	return H_ERR_NONE;
+    if(addr < x->lo) {
+	n = x->lo - addr;
+	addr += n;
+	data += n;
+	len -= n;
+    }
+    if(x->hi - addr < len)
+	len = x->hi - addr + 1;
+    return s->next->put(s->next, addr, data, len);
+}
+
+/*---------------------------------------------------------------*/
+/* byte swapping. A word may be split between two puts, so the byte at
+   the even address is held back until the next put shows whether its
+   partner follows. A byte whose partner never turns up still goes to
+   its swapped address. */
+
+static int swap_flush(HEXSINK *s)
+{
+    XSTAGE	*x = s->priv;
+
+    if(!x->pend)
+	return H_ERR_NONE;
+    x->pend = FALSE;
+    return s->next->put(s->next, x->pendaddr + 1, &x->pendbyte, 1);
+}
+
+static int swap_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    XSTAGE	*x = s->priv;
+    UCHAR	pair[2];
+    ULONG	n;
+
+    if(!len)
+	return H_ERR_NONE;
+    if(x->pend && addr == x->pendaddr + 1) {
+	/* the partner of the byte held back */
+	x->pend = FALSE;
+	pair[0] = data[0];
+	pair[1] = x->pendbyte;
+	if(s->next->put(s->next, x->pendaddr, pair, 2))
+	    return hex_errno;
+	addr++;
+	data++;
+	len--;
+    }
+    else if(swap_flush(s))
+	return hex_errno;
+
+    if(len && (addr & 1)) {
+	/* an odd byte whose partner is missing */
+	if(s->next->put(s->next, addr - 1, data, 1))
+	    return hex_errno;
+	addr++;
+	data++;
+	len--;
+    }
+
+    while(len > 1) {
+	n = MIN(len, XBUFLEN) & ~1UL;
+	hex_swap16(x->buf, data, n);
+	if(s->next->put(s->next, addr, x->buf, n))
+	    return hex_errno;
+	addr += n;
+	data += n;
+	len -= n;
+    }
+
+    if(len) {
+	x->pend = TRUE;
+	x->pendaddr = addr;
+	x->pendbyte = data[0];
+    }
+    return H_ERR_NONE;
+}
+
+/*---------------------------------------------------------------*/
+/* filling */
+
+/* fill from x->next up to but not including addr */
+static int fill_to(HEXSINK *s, ULONG addr)
+{
+    XSTAGE	*x = s->priv;
+    ULONG	n;
+
+    while(x->next < addr) {
+	n = MIN(addr - x->next, XBUFLEN);
+	if(s->next->put(s->next, x->next, x->buf, n))
+	    return hex_errno;
+	x->next += n;
+    }
+    return H_ERR_NONE;
+}
+
+static int fill_put(HEXSINK *s, ULONG addr, UCHAR *data, ULONG len)
+{
+    XSTAGE	*x = s->priv;
+
+    if(!len)
+	return H_ERR_NONE;
+    if(!x->started) {
+	x->started = TRUE;
+	x->next = (x->window && addr > x->lo) ? x->lo : addr;
+    }
+    if(x->wrapped || addr < x->next) {
+	ERR(H_ERR_ORDER);
+    }
+    if(fill_to(s, addr) || s->next->put(s->next, addr, data, len))
+	return hex_errno;
+    x->next = addr + len;
+    x->wrapped = x->next < addr;
+    return H_ERR_NONE;
+}
+
+/* fill out the window, if there is one */
+static int fill_finish(HEXSINK *s)
+{
+    XSTAGE	*x = s->priv;
+
+    if(!x->window)
+	return H_ERR_NONE;
+    if(!x->started) {
+	x->started = TRUE;
+	x->next = x->lo;
+    }
+    /* hi is inclusive, and may be the top of the address space */
+    if(!x->wrapped && x->next <= x->hi &&
+       (fill_to(s, x->hi) || s->next->put(s->next, x->hi, x->buf, 1)))
+	return hex_errno;
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* finish a stage, pass end() on and free the stage. The sink of a
+   stage after the first is part of the stage, so s is not touched
+   once it is freed. */
+static int x_end(HEXSINK *s, ULONG entry)
+{
+    XSTAGE	*x = s->priv;
+    int		ret = H_ERR_NONE;
+
+    switch(x->type) {
+      case X_RELOC:
+	if(x->deltaset)
+	    entry += x->delta;
+	break;
+      case X_SWAP16:
+	ret = swap_flush(s);
+	break;
+      case X_FILL:
+	ret = fill_finish(s);
+	break;
+    }
+    if(!ret)
+	ret = s->next->end(s->next, entry);
+    s->priv = NULL;
+    free(x->buf);
+    free(x);
+    if(ret) {
+	ERR(ret);
+    }
+    return H_ERR_NONE;
+}
+
+
+/*---------------------------------------------------------------*/
+/* parse one stage of the description */
+static int xparse(char *spec, XSTAGE *x, XSTAGE *prev)
+{
+    char	*arg, *c;
+
+    if((arg = strchr(spec, '=')))
+	*arg++ = '\0';
+
+    if(strcmp(spec, "reloc") == 0 && arg) {
+	x->type = X_RELOC;
+	if(arg[0] == '+' || arg[0] == '-') {
+	    x->delta = strtol(arg, &c, 0);
+	    x->deltaset = TRUE;
+	}
+	else
+	    x->base = (ULONG)strtoul(arg, &c, 0);
+	return c != arg && c[0] == '\0';
+    }
+
+    if(strcmp(spec, "crop") == 0 && arg) {
+	x->type = X_CROP;
+	x->lo = (ULONG)strtoul(arg, &c, 0);
+	if(c == arg || c[0] != ':')
+	    return FALSE;
+	arg = c+1;
+	x->hi = (ULONG)strtoul(arg, &c, 0);
+	return c != arg && c[0] == '\0' && x->hi >= x->lo;
+    }
+
+    if(strcmp(spec, "swap16") == 0 && !arg) {
+	x->type = X_SWAP16;
+	return TRUE;
+    }
+
+    if(strcmp(spec, "fill") == 0 && arg) {
+	x->type = X_FILL;
+	x->value = (int)strtol(arg, &c, 0);
+	if(c == arg || c[0] != '\0' || x->value < 0 || x->value > 0xff)
+	    return FALSE;
+	/* fill out the window of the crop before, if any */
+	if(prev) {
+	    x->window = TRUE;
+	    x->lo = prev->lo;
+	    x->hi = prev->hi;
+	}
+	return TRUE;
+    }
+    return FALSE;
+}
+
+
+/* Set up s as the head of the chain of transforms described by spec,
+   which passes its output on to next. spec is modified. */
+int hex_xformsink(HEXSINK *s, char *spec, HEXSINK *next)
+{
+    XSTAGE	*x[XFORMMAX], *crop = NULL;
+    HEXSINK	*down = next, *t;
+    char	*c, *stage[XFORMMAX];
+    int		i, n = 0, err = H_ERR_NONE;
+
+    /* split the description into stages */
+    for(c = strtok(spec, ","); c; c = strtok(NULL, ",")) {
+	if(n == XFORMMAX) {
+	    ERR(H_ERR_XFORM);
+	}
+	stage[n++] = c;
+    }
+    if(!n) {
+	ERR(H_ERR_XFORM);
+    }
+
+    for(i=0; i < n; i++) {
+	if(!(x[i] = calloc(1, sizeof(XSTAGE))))
+	    err = H_ERR_IO;
+	else if(!xparse(stage[i], x[i], crop))
+	    err = H_ERR_XFORM;
+	else if((x[i]->type == X_SWAP16 || x[i]->type == X_FILL) &&
+		!(x[i]->buf = malloc(XBUFLEN)))
+	    err = H_ERR_IO;
+	if(err) {
+	    for(; i >= 0; i--) {
+		if(x[i])
+		    free(x[i]->buf);
+		free(x[i]);
+	    }
+	    ERR(err);
+	}
+	if(x[i]->type == X_FILL)
+	    memset(x[i]->buf, x[i]->value, XBUFLEN);
+
+	/* a fill only follows a crop through stages that keep
+	   addresses where they are */
+	if(x[i]->type == X_CROP)
+	    crop = x[i];
+	else if(x[i]->type == X_RELOC)
+	    crop = NULL;
+    }
+
+    /* link the stages from the last one back */
+    for(i = n-1; i >= 0; i--) {
+	t = (i == 0) ? s : &x[i]->sink;
+	memset(t, 0, sizeof(*t));
+	t->next = down;
+	t->end = x_end;
+	t->out = down->out;
+	t->format = down->format;
+	t->reclen = down->reclen;
+	t->priv = x[i];
+	switch(x[i]->type) {
+	  case X_RELOC:
+	    t->put = reloc_put;
+	    break;
+	  case X_CROP:
+	    t->put = crop_put;
+	    break;
+	  case X_SWAP16:
+	    t->put = swap_put;
+	    break;
+	  case X_FILL:
+	    t->put = fill_put;
+	    break;
+	}
+	down = t;
+    }
+    return H_ERR_NONE;
+}